@@ -35,8 +35,16 @@
 #define SIGPWR    30
 #define SIGSYS    31
 
+// Number of signals; pending and blocked signals are kept in 32-bit masks.
 #define SIG_COUNT 32
 
+// Add signals to the set of blocked signals.
+#define SIG_BLOCK   0
+// Remove signals from the set of blocked signals.
+#define SIG_UNBLOCK 1
+// Replace the set of blocked signals.
+#define SIG_SETMASK 2
+
 
 #ifdef BADGEROS_KERNEL
 
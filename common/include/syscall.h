@@ -12,6 +12,7 @@
 #else
 
 #include "hal/gpio.h"
+#include "time_page.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -31,6 +32,11 @@ typedef struct {
 } syscall_info_t;
 
 syscall_info_t syscall_info(int no);
+// Whether the current system call is running as a fast system call, directly in the trap handler.
+bool           syscall_is_fast();
+// Abandon the current fast system call; it will be run again from the start as a normal system call.
+// The return value of the fast system call is ignored.
+void           syscall_fast_defer();
 
 #else
 typedef int file_t;
@@ -69,6 +75,48 @@ typedef int tid_t;
 #define MEMFLAGS_RX  0x00000005
 #define MEMFLAGS_WX  0x00000006
 #define MEMFLAGS_RWX 0x00000007
+// Writes to a file mapping stay private to the process.
+#define MEMFLAGS_PRIVATE 0x00000100
+
+// Buffer descriptor for vectored reads and writes.
+typedef struct {
+    // Start of the buffer.
+    void *base;
+    // Length of the buffer in bytes.
+    long  len;
+} iovec_t;
+
+// Number of buckets in the driver latency histogram.
+#define BLKDEV_LATENCY_BUCKETS 16
+
+// Block device I/O statistics.
+typedef struct {
+    // Read operations; multi-block reads that go through the cache count once per block.
+    uint64_t reads;
+    // Write operations; multi-block writes that go through the cache count once per block.
+    uint64_t writes;
+    // Erase operations; multi-block erases that go through the cache count once per block.
+    uint64_t erases;
+    // Blocks or partial blocks read.
+    uint64_t blocks_read;
+    // Blocks or partial blocks written.
+    uint64_t blocks_written;
+    // Blocks erased.
+    uint64_t blocks_erased;
+    // Accesses served by an existing cache entry.
+    uint64_t cache_hits;
+    // Accesses to a cached device that needed a new cache entry or bypassed the cache.
+    uint64_t cache_misses;
+    // Transfers from the cache back to the device.
+    uint64_t writebacks;
+    // Blocks written back or erased from the cache.
+    uint64_t blocks_written_back;
+    // Calls into the device driver.
+    uint64_t driver_calls;
+    // Histogram of driver call latency.
+    // Bucket `i` counts calls that took less than 2^i microseconds; the last bucket counts all slower calls.
+    uint64_t latency[BLKDEV_LATENCY_BUCKETS];
+} blkdev_stats_t;
 #endif
 
 #include <stdbool.h>
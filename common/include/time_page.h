@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+
+// Timer parameters that the kernel maps read-only into processes so they can read the time without a system call.
+// The time since boot in microseconds is `(ticks - base_tick) * 1000000 / ticks_per_sec`.
+typedef struct {
+    // Timer ticks per second.
+    uint64_t ticks_per_sec;
+    // Timer value at which the time since boot is 0.
+    uint64_t base_tick;
+} time_page_t;
+
+#ifndef BADGEROS_KERNEL
+// Get the time since boot in microseconds.
+// Reads the timer directly if the kernel provides a time page, otherwise uses `SYSCALL_SYS_TIME_US`.
+long long time_us();
+#endif
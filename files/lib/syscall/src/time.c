@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: MIT
+
+#include "time_page.h"
+
+#include "syscall.h"
+
+// Time page mapped by the kernel, or NULL if the time can only be read with a system call.
+static time_page_t const *time_page;
+// Whether the kernel has been asked for the time page yet.
+static bool               time_page_checked;
+
+// Read the timer of the current CPU.
+static inline uint64_t time_ticks() {
+#if __riscv_xlen == 32
+    uint32_t ticks_lo0, ticks_lo1;
+    uint32_t ticks_hi0, ticks_hi1;
+    asm volatile("rdtimeh %0; rdtime %1" : "=r"(ticks_hi0), "=r"(ticks_lo0));
+    asm volatile("rdtimeh %0; rdtime %1" : "=r"(ticks_hi1), "=r"(ticks_lo1));
+    if (ticks_hi0 != ticks_hi1) {
+        return ((uint64_t)ticks_hi1 << 32) | ticks_lo1;
+    } else {
+        return ((uint64_t)ticks_hi0 << 32) | ticks_lo0;
+    }
+#else
+    uint64_t ticks;
+    asm volatile("rdtime %0" : "=r"(ticks));
+    return ticks;
+#endif
+}
+
+// Get the time since boot in microseconds.
+// Reads the timer directly if the kernel provides a time page, otherwise uses `SYSCALL_SYS_TIME_US`.
+long long time_us() {
+    if (!time_page_checked) {
+        // Threads racing here all get the same answer.
+        time_page         = syscall_sys_time_page();
+        time_page_checked = true;
+    }
+    if (!time_page) {
+        return syscall_sys_time_us();
+    }
+    return (time_ticks() - time_page->base_tick) * 1000000 / time_page->ticks_per_sec;
+}
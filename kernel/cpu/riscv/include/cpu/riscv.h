@@ -41,6 +41,14 @@
 
 
 
+/* ==== RISC-V COUNTEREN DEFINITION ==== */
+
+#define RISCV_COUNTEREN_CY_BIT 0
+#define RISCV_COUNTEREN_TM_BIT 1
+#define RISCV_COUNTEREN_IR_BIT 2
+
+
+
 /* ==== RISC-V INTERRUPT LIST ==== */
 #define RISCV_INT_SUPERVISOR_SOFT  1
 #define RISCV_INT_MACHINE_SOFT     3
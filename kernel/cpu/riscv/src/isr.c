@@ -15,6 +15,7 @@
 #include "rawprint.h"
 #include "scheduler/cpu.h"
 #include "scheduler/types.h"
+#include "syscall.h"
 #if MEMMAP_VMEM
 #include "cpu/mmu.h"
 #include "memprotect.h"
@@ -55,6 +56,42 @@ static void kill_proc_on_trap() {
     __builtin_unreachable();
 }
 
+// Fast system call function pointer type; arguments are passed in `a0` through `a6` like normal system calls.
+typedef long long (*riscv_fast_syscall_t)(size_t, size_t, size_t, size_t, size_t, size_t, size_t);
+
+// Try to run a fast system call directly in the trap handler instead of switching to the thread's kernel context.
+// Returns false if the system call must run as a normal system call.
+static bool riscv_fast_syscall(sched_thread_t *thread) {
+    cpu_regs_t    *regs = &thread->user_isr_ctx.regs;
+    syscall_info_t info = syscall_info((int)regs->a7);
+    if (!(info.flags & SYSCALL_FLAG_FAST)) {
+        return false;
+    }
+    // Pending signals and process exit are handled on the way back from a normal system call.
+    if (proc_signals_pending_raw(thread->process) || (atomic_load(&thread->process->flags) & PROC_EXITING)) {
+        return false;
+    }
+
+    riscv_fast_syscall_t func  = (riscv_fast_syscall_t)(void *)info.funcptr;
+    long long            value = func(regs->a0, regs->a1, regs->a2, regs->a3, regs->a4, regs->a5, regs->a6);
+    if (atomic_fetch_and(&thread->flags, ~THREAD_FASTDEFER) & THREAD_FASTDEFER) {
+        return false;
+    }
+
+    // Truncate the return value like `riscv_syscall_wrapper` does.
+    if (!info.retwidth) {
+        value = 0;
+    } else if (info.retwidth <= sizeof(long)) {
+        value = (unsigned long)value;
+    }
+    regs->a0 = value;
+#if __riscv_xlen == 32
+    regs->a1 = value >> 32;
+#endif
+    regs->pc += 4;
+    return true;
+}
+
 // Called from ASM on non-system call trap.
 void riscv_trap_handler() {
     // Redirect interrupts to the interrupt handler.
@@ -93,8 +130,10 @@ void riscv_trap_handler() {
             default: break;
 
             case RISCV_TRAP_U_ECALL:
-                // ECALL from U-mode goes to system call handler.
-                sched_raise_from_isr(kctx->thread, true, riscv_syscall_wrapper);
+                // ECALL from U-mode goes to system call handler, unless it can be handled right here.
+                if (!riscv_fast_syscall(kctx->thread)) {
+                    sched_raise_from_isr(kctx->thread, true, riscv_syscall_wrapper);
+                }
                 isr_ctx_swap(kctx);
                 return;
 
@@ -103,13 +142,19 @@ void riscv_trap_handler() {
             case RISCV_TRAP_SACCESS:
             case RISCV_TRAP_IPAGE:
             case RISCV_TRAP_LPAGE:
-            case RISCV_TRAP_SPAGE:
                 // Memory access faults go to the SIGSEGV handler.
                 sched_raise_from_isr(kctx->thread, true, proc_sigsegv_handler);
                 kctx->thread->kernel_isr_ctx.regs.a0 = tval;
                 isr_ctx_swap(kctx);
                 return;
 
+            case RISCV_TRAP_SPAGE:
+                // Store page faults may be copy-on-write; the handler raises SIGSEGV otherwise.
+                sched_raise_from_isr(kctx->thread, true, proc_store_fault_handler);
+                kctx->thread->kernel_isr_ctx.regs.a0 = tval;
+                isr_ctx_swap(kctx);
+                return;
+
             case RISCV_TRAP_IILLEGAL:
                 // Illegal instruction faults go to the SIGILL handler.
                 sched_raise_from_isr(kctx->thread, true, proc_sigill_handler);
@@ -70,6 +70,8 @@ static void time_init_common() {
     support_sbi_time = res.retval != 0;
     // Set base tick to now so that time_us returns micros since boot.
     base_tick        = time_ticks();
+    // Let userland read the timer for the time page.
+    asm("csrs scounteren, %0" ::"r"(1 << RISCV_COUNTEREN_TM_BIT));
     if (support_sbi_time) {
         logk(LOG_INFO, "Using SBI timer");
     } else {
@@ -111,6 +113,17 @@ timestamp_us_t time_us() {
     return time_ticks() * 1000000 / ticks_per_sec;
 }
 
+// Get the timer parameters userland needs to compute `time_us` itself.
+// Returns false if userland can't read the timer.
+bool time_get_user_params(time_page_t *params) {
+    if (!ticks_per_sec) {
+        return false;
+    }
+    params->ticks_per_sec = ticks_per_sec;
+    params->base_tick     = base_tick;
+    return true;
+}
+
 // Called by the interrupt handler when the CPU-local timer fires.
 void riscv_sbi_timer_interrupt() {
     time_cpu_timer_isr();
@@ -232,3 +232,11 @@ void sched_prepare_user_entry(sched_thread_t *thread, size_t entry_point, size_t
     thread->user_isr_ctx.regs.pc = entry_point;
     thread->user_isr_ctx.regs.a0 = arg;
 }
+
+// Prepares a userland thread created by another thread of the same process to run on a new stack.
+// The new thread shares the global pointer of its creator.
+void sched_prepare_user_stack(sched_thread_t *thread, sched_thread_t const *creator, size_t stack_top) {
+    // The RISC-V psABI requires 16-byte stack alignment.
+    thread->user_isr_ctx.regs.sp = stack_top & ~(size_t)15;
+    thread->user_isr_ctx.regs.gp = creator->user_isr_ctx.regs.gp;
+}
@@ -228,6 +228,8 @@ static void cpu1_init1_limine(struct limine_smp_info *info) {
     tmp_ctx.cpulocal->cpuid = info->hartid;
     tmp_ctx.cpulocal->cpu   = cur_cpu;
     asm("csrw sscratch, %0" ::"r"(&tmp_ctx));
+    // Let userland read the timer for the time page.
+    asm("csrs scounteren, %0" ::"r"(1 << RISCV_COUNTEREN_TM_BIT));
     cpu_status[cur_cpu].entrypoint();
     __builtin_trap();
 }
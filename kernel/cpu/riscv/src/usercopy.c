@@ -85,9 +85,19 @@ bool copy_from_user_raw(process_t *process, void *kernel_vaddr, size_t user_vadd
 // Copy from kernel to user.
 // Returns whether the user has access to all of these bytes.
 // If the user doesn't have access, no copy is performed.
-bool copy_to_user_raw(process_t *process, size_t user_vaddr, void *kernel_vaddr0, size_t len) {
+// The caller must hold `process->mtx` because copy-on-write pages are copied first.
+bool copy_to_user_raw(process_t *process, size_t user_vaddr, void *kernel_vaddr, size_t len) {
+    // Copy-on-write pages must be copied first because the write bypasses the user's page table.
+    proc_map_unshare_raw(NULL, process, user_vaddr, len);
+    return copy_to_user_from_isr(process, user_vaddr, kernel_vaddr, len);
+}
+
+// Copy from kernel to user without first copying copy-on-write pages, so it is safe to use in the trap handler.
+// Returns whether the user has access to all of these bytes; copy-on-write pages count as not writable.
+// If the user doesn't have access, no copy is performed.
+bool copy_to_user_from_isr(process_t *process, size_t user_vaddr, void *kernel_vaddr0, size_t len) {
     uint8_t const *kernel_vaddr = kernel_vaddr0;
-    if (!proc_map_contains_raw(process, user_vaddr, len)) {
+    if (!(proc_map_contains_raw(process, user_vaddr, len) & MEMPROTECT_FLAG_W)) {
         return false;
     }
 #if RISCV_M_MODE_KERNEL
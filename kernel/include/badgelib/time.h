@@ -4,6 +4,7 @@
 #pragma once
 
 #include "port/time.h"
+#include "time_page.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -26,3 +27,6 @@ int64_t        time_add_async_task(timestamp_us_t timestamp, timer_fn_t callback
 bool           time_cancel_async_task(int64_t taskno);
 // Get current time in microseconds.
 timestamp_us_t time_us();
+// Get the timer parameters userland needs to compute `time_us` itself.
+// Returns false if userland can't read the timer.
+bool           time_get_user_params(time_page_t *params);
@@ -6,14 +6,17 @@
 #include "badge_err.h"
 #include "time.h"
 
+#include <stdatomic.h>
 #include <stddef.h>
 
 // Maximum age in microseconds of a write cache entry.
 #define BLKDEV_WRITE_CACHE_TIMEOUT 1000000
-// Minimum age in microseconds of a read cache entry.
-#define BLKDEV_READ_CACHE_TIMEOUT  1000000
+// Percentage of dirty cache entries above which housekeeping writes back all of them regardless of age.
+#define BLKDEV_DIRTY_RATIO         50
 // Default depth of block device cache.
 #define BLKDEV_DEFAULT_CACHE_DEPTH 64
+// Number of buckets in the driver latency histogram.
+#define BLKDEV_LATENCY_BUCKETS     16
 
 // Size type used for block devices.
 typedef uint64_t blksize_t;
@@ -23,6 +26,74 @@ typedef int64_t  blkoff_t;
 // Block device handle.
 typedef struct blkdev blkdev_t;
 
+// Asynchronous block device request.
+typedef struct blkdev_req blkdev_req_t;
+// Called when an asynchronous request finishes; `req->ec` holds the result.
+// The callback runs in the thread that dispatched the request and may release the request.
+typedef void (*blkdev_req_cb_t)(blkdev_req_t *req);
+
+// Asynchronous block device request.
+// Filled in by the caller and passed to `blkdev_submit`; it must stay valid until it finishes.
+struct blkdev_req {
+    // Next request in the device queue; used internally.
+    blkdev_req_t   *next;
+    // Device the request was submitted to; set by `blkdev_submit`.
+    blkdev_t       *dev;
+    // Is a write request; otherwise a read.
+    bool            write;
+    // First block to transfer.
+    blksize_t       block;
+    // Number of blocks to transfer.
+    blksize_t       count;
+    // Buffer of `count` blocks.
+    uint8_t        *buf;
+    // Called when the request finishes; if NULL, wait for the request using `blkdev_wait`.
+    blkdev_req_cb_t callback;
+    // Caller data for the callback.
+    void           *cookie;
+    // Result of the request.
+    badge_err_t     ec;
+    // Request without callback has finished.
+    atomic_bool     done;
+};
+
+// Block device I/O statistics.
+typedef struct {
+    // Read operations; multi-block reads that go through the cache count once per block.
+    uint64_t reads;
+    // Write operations; multi-block writes that go through the cache count once per block.
+    uint64_t writes;
+    // Erase operations; multi-block erases that go through the cache count once per block.
+    uint64_t erases;
+    // Blocks or partial blocks read.
+    uint64_t blocks_read;
+    // Blocks or partial blocks written.
+    uint64_t blocks_written;
+    // Blocks erased.
+    uint64_t blocks_erased;
+    // Accesses served by an existing cache entry.
+    uint64_t cache_hits;
+    // Accesses to a cached device that needed a new cache entry or bypassed the cache.
+    uint64_t cache_misses;
+    // Transfers from the cache back to the device.
+    uint64_t writebacks;
+    // Blocks written back or erased from the cache.
+    uint64_t blocks_written_back;
+    // Calls into the device driver.
+    uint64_t driver_calls;
+    // Histogram of driver call latency.
+    // Bucket `i` counts calls that took less than 2^i microseconds; the last bucket counts all slower calls.
+    uint64_t latency[BLKDEV_LATENCY_BUCKETS];
+} blkdev_stats_t;
+
+// Buffer descriptor for multi-block reads and writes.
+typedef struct {
+    // Start of the buffer.
+    void  *base;
+    // Length of the buffer in bytes.
+    size_t len;
+} blkdev_iovec_t;
+
 // Prepare a block device for reading and/or writing.
 // All other `blkdev_*` functions assume the block device was opened using this function.
 // For some block devices, this may allocate caches.
@@ -64,6 +135,37 @@ void blkdev_write_partial(
 void blkdev_read_partial(
     badge_err_t *ec, blkdev_t *dev, blksize_t block, size_t subblock_offset, uint8_t *readbuf, size_t readbuf_len
 );
+// Read consecutive blocks starting at `block` into a list of buffers.
+// The buffers must add up to a whole number of blocks.
+// Long ranges bypass the cache and are passed to the driver as one request.
+void blkdev_readv(badge_err_t *ec, blkdev_t *dev, blksize_t block, blkdev_iovec_t const *iov, size_t iovcnt);
+// Erase if necessary and write consecutive blocks starting at `block` from a list of buffers.
+// The buffers must add up to a whole number of blocks.
+// Long ranges bypass the cache and are passed to the driver as one request.
+void blkdev_writev(badge_err_t *ec, blkdev_t *dev, blksize_t block, blkdev_iovec_t const *iov, size_t iovcnt);
+// Explicitly erase `count` consecutive blocks starting at `block`, if possible.
+// On devices which cannot erase blocks, this will do nothing.
+void blkdev_erase_range(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count);
+// Hint that the contents of `count` consecutive blocks starting at `block` are no longer needed.
+// Cached changes to the blocks are dropped and their contents are undefined until they are written again.
+// Devices that support it are told right away; otherwise the blocks are erased later by `blkdev_housekeeping` so a
+// write to them won't need to erase first.
+void blkdev_discard(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count);
+// Get a pointer to the memory holding `count` consecutive blocks starting at `block`, on devices kept in memory.
+// Cached changes to the blocks are written back first. If `write` is true, cached copies are dropped as well so the
+// memory may be modified directly; cached access to the same blocks after that may see stale data until the next call.
+// Returns NULL and raises `ECAUSE_UNSUPPORTED` if the device doesn't support direct access.
+void *blkdev_direct_access(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, bool write);
+
+// Queue an asynchronous read or write.
+// Queued requests are sorted by block and adjacent ones are merged into one transfer when dispatched.
+// Requests are dispatched by `blkdev_wait`, `blkdev_unplug`, `blkdev_flush` and `blkdev_housekeeping`.
+// Overlapping requests may be dispatched in any order.
+void blkdev_submit(badge_err_t *ec, blkdev_t *dev, blkdev_req_t *req);
+// Dispatch all queued requests of a device.
+void blkdev_unplug(blkdev_t *dev);
+// Wait for a request without callback to finish, dispatching queued requests meanwhile.
+void blkdev_wait(blkdev_req_t *req);
 
 // Flush the write cache to the block device.
 void blkdev_flush(badge_err_t *ec, blkdev_t *dev);
@@ -71,9 +173,17 @@ void blkdev_flush(badge_err_t *ec, blkdev_t *dev);
 // Manages flushing of caches and erasure.
 void blkdev_housekeeping(badge_err_t *ec, blkdev_t *dev);
 // Allocate a cache for a block device.
+// Lookups are hashed and replacement is least recently used, so large depths are cheap.
 void blkdev_create_cache(badge_err_t *ec, blkdev_t *dev, size_t cache_depth, bool cache_reads);
 // Remove a cache from a block device.
 void blkdev_delete_cache(badge_err_t *ec, blkdev_t *dev);
 
+// Get the I/O statistics of a block device.
+void blkdev_get_stats(badge_err_t *ec, blkdev_t *dev, blkdev_stats_t *stats_out);
+// Reset the I/O statistics of a block device to zero.
+void blkdev_reset_stats(blkdev_t *dev);
+
 // Show a summary of the cache entries.
 void blkdev_dump_cache(blkdev_t *dev);
+// Show the I/O statistics.
+void blkdev_dump_stats(blkdev_t *dev);
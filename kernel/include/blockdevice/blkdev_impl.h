@@ -33,6 +33,27 @@ typedef void (*blkdev_write_partial_t)(
 typedef void (*blkdev_read_partial_t)(
     badge_err_t *ec, blkdev_t *dev, blksize_t block, size_t subblock_offset, uint8_t *readbuf, size_t readbuf_len
 );
+// Read `count` consecutive blocks into a list of buffers that add up to exactly that many blocks.
+// Optional; without it, ranges are read one block at a time.
+typedef void (*blkdev_read_range_t)(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, blkdev_iovec_t const *iov, size_t iovcnt
+);
+// Erase if required and write `count` consecutive blocks from a list of buffers that add up to exactly that many
+// blocks.
+// Optional; without it, ranges are written one block at a time.
+typedef void (*blkdev_write_range_t)(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, blkdev_iovec_t const *iov, size_t iovcnt
+);
+// Erase `count` consecutive blocks.
+// Optional; without it, ranges are erased one block at a time.
+typedef void (*blkdev_erase_range_t)(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count);
+// Tell the device that the contents of `count` consecutive blocks are no longer needed, like TRIM.
+// Optional; without it, discarded blocks are erased by housekeeping instead.
+typedef void (*blkdev_discard_t)(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count);
+// Get a pointer to the memory holding `count` consecutive blocks, which the block layer may read and write directly.
+// Optional; only for devices whose contents are in memory.
+// Returns NULL if the blocks aren't directly accessible.
+typedef void *(*blkdev_direct_access_t)(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count);
 
 // Block device virtual function table.
 typedef struct blkdev_vtable blkdev_vtable_t;
@@ -46,6 +67,11 @@ struct blkdev_vtable {
     blkdev_read_t          read;
     blkdev_write_partial_t write_partial;
     blkdev_read_partial_t  read_partial;
+    blkdev_read_range_t    read_range;
+    blkdev_write_range_t   write_range;
+    blkdev_erase_range_t   erase_range;
+    blkdev_direct_access_t direct_access;
+    blkdev_discard_t       discard;
 };
 
 // Create a new block device with a vtable and a cookie.
@@ -4,6 +4,18 @@
 #pragma once
 
 #include "blockdevice.h"
+#include "mutex.h"
+
+#include <stdatomic.h>
+
+// Timeout for block device mutexes.
+#define BLKDEV_MUTEX_TIMEOUT 5000000
+// Multi-block transfers of at least this many blocks bypass the cache.
+#define BLKDEV_BYPASS_BLOCKS 16
+// Maximum number of queued requests merged into one transfer.
+#define BLKDEV_MERGE_MAX     16
+// Number of blocks per word of the erase bitmaps.
+#define BLKDEV_MAP_BITS      (sizeof(size_t) * 8)
 
 // Block device virtual function table.
 typedef struct blkdev_vtable blkdev_vtable_t;
@@ -16,24 +28,71 @@ typedef struct {
     timestamp_us_t update_time;
     // Block index referred to.
     blksize_t      index;
+    // Next entry in the same hash bucket, or -1.
+    ptrdiff_t      hash_next;
+    // Previous entry in the LRU list, towards the most recently used entry, or -1.
+    ptrdiff_t      lru_prev;
+    // Next entry in the LRU list, towards the least recently used entry, or -1.
+    ptrdiff_t      lru_next;
     // Cache entry contains data.
     bool           present;
     // Block is marked for erasure.
     bool           erase;
     // Cache entry differs from disk.
     bool           dirty;
+    // Data is being transferred between the entry and the device without the device lock held.
+    // A busy entry may not be modified, read or reused until the transfer finishes.
+    bool           busy;
+    // Entry was used since the replacement policy last passed it; set by lookups under a shared lock.
+    atomic_bool    referenced;
 } blkdev_flags_t;
 
+// Counters behind `blkdev_stats_t`; updated without locking.
+typedef struct {
+    atomic_size_t reads;
+    atomic_size_t writes;
+    atomic_size_t erases;
+    atomic_size_t blocks_read;
+    atomic_size_t blocks_written;
+    atomic_size_t blocks_erased;
+    atomic_size_t cache_hits;
+    atomic_size_t cache_misses;
+    atomic_size_t writebacks;
+    atomic_size_t blocks_written_back;
+    atomic_size_t driver_calls;
+    atomic_size_t latency[BLKDEV_LATENCY_BUCKETS];
+} blkdev_counters_t;
+
+// Dirty cache entry; used to sort writeback by block.
+typedef struct {
+    // Block index referred to.
+    blksize_t block;
+    // Index of the entry in the cache.
+    size_t    slot;
+} blkdev_wb_ent_t;
+
 // Block device cache data.
+// The hash table, LRU list and entry flags other than `referenced` may only be changed with `blkdev_t::mtx` held
+// exclusively.
 typedef struct {
     // Pointer to block cache memory.
     // Must be large enough for `cache_depth` blocks.
-    uint8_t        *block_cache;
+    uint8_t         *block_cache;
     // Pointer to block flags memory.
     // Must be large enough for `cache_depth` entries.
-    blkdev_flags_t *block_flags;
+    blkdev_flags_t  *block_flags;
     // Amount of cache entries.
-    size_t          cache_depth;
+    size_t           cache_depth;
+    // Hash table of present entries by block index; each bucket is the first entry of a chain, or -1.
+    ptrdiff_t       *buckets;
+    // Number of hash buckets; a power of two.
+    size_t           bucket_count;
+    // Scratch space for `cache_depth` entries used to sort writeback; guarded by `blkdev_t::wb_mtx`.
+    blkdev_wb_ent_t *writeback;
+    // Most recently used entry.
+    ptrdiff_t        lru_head;
+    // Least recently used entry; vacant entries are kept at this end.
+    ptrdiff_t        lru_tail;
 } blkdev_cache_t;
 
 // Block device descriptor.
@@ -53,17 +112,55 @@ struct blkdev {
     blkdev_cache_t        *cache;
     // Cookie for device driver.
     void                  *cookie;
+    // Guards the cache; cache hits that only read take it shared.
+    mutex_t                mtx;
+    // Serializes calls into the device driver.
+    mutex_t                io_mtx;
+    // One block of scratch memory for the partial access fallbacks; allocated by `blkdev_open` and guarded by `io_mtx`.
+    uint8_t               *bounce;
+    // Bitmap of blocks whose erased state is known from earlier driver calls; guarded by `io_mtx`.
+    // Allocated by `blkdev_open` together with `erased` and `discarded`.
+    size_t                *erase_known;
+    // Bitmap of blocks known to be erased, if the bit in `erase_known` is set.
+    size_t                *erased;
+    // Bitmap of discarded blocks waiting to be erased by housekeeping.
+    size_t                *discarded;
+    // Serializes cache writeback; taken before `mtx`.
+    mutex_t                wb_mtx;
+    // Queued asynchronous requests, sorted by block.
+    blkdev_req_t          *queue;
+    // Guards `queue` and `queue_pos`.
+    mutex_t                queue_mtx;
+    // Block after the last dispatched request; the queue is swept upwards from here.
+    blksize_t              queue_pos;
+    // A thread is dispatching queued requests.
+    atomic_bool            dispatching;
+    // I/O statistics.
+    blkdev_counters_t      stats;
 };
 
 // Write without caching.
+// This and the other `_raw` functions take `io_mtx`, so drivers must not call them from their own functions.
 void blkdev_write_raw(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t const *writebuf);
 // Read without caching.
 void blkdev_read_raw(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t *readbuf);
 // Erase without caching.
 void blkdev_erase_raw(badge_err_t *ec, blkdev_t *dev, blksize_t block);
+// Read consecutive blocks without caching.
+void blkdev_readv_raw(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, blkdev_iovec_t const *iov, size_t iovcnt
+);
+// Write consecutive blocks without caching.
+void blkdev_writev_raw(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, blkdev_iovec_t const *iov, size_t iovcnt
+);
+// Erase consecutive blocks without caching.
+// Blocks already known to be erased are skipped.
+void blkdev_erase_range_raw(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count);
 
 // Perform a read-modify-write operation for partial write.
 // Made for block devices that don't support partial write.
+// Uses the device's bounce buffer, so it never allocates.
 void blkdev_write_partial_fallback(
     badge_err_t   *ec,
     blkdev_t      *dev,
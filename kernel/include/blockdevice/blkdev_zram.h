@@ -0,0 +1,15 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "blockdevice.h"
+
+// Largest supported block size of a compressed RAM block device.
+#define BLKDEV_ZRAM_MAX_BLOCK_SIZE 65536
+
+// Create a new compressed RAM block device; all blocks start out zero-filled.
+// The block size must be a multiple of the word size and at most `BLKDEV_ZRAM_MAX_BLOCK_SIZE`.
+blkdev_t *blkdev_zram_create(badge_err_t *ec, size_t block_count, size_t block_size);
+// Get the number of bytes of memory used to store the blocks of a compressed RAM block device.
+size_t    blkdev_zram_get_stored(blkdev_t const *dev);
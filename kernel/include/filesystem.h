@@ -17,12 +17,24 @@
 #define FILESYSTEM_SYMLINK_MAX 8
 // Maximum supported directory entries.
 #define FILESYSTEM_DIRENT_MAX  64
+// Maximum supported number of buffers in one vectored read or write.
+#define FILESYSTEM_IOV_MAX     64
 
 // Mount as read-only filesystem (default: read-write).
 #define MOUNTFLAGS_READONLY 0x00000001
 // Filesystem mounting flags.
 typedef uint32_t mountflags_t;
 
+// Filesystem mounting options.
+// Options that do not apply to the filesystem being mounted are ignored.
+// A value of 0 selects the filesystem's default.
+typedef struct {
+    // RAMFS: Maximum amount of RAM in bytes used by file data and inodes.
+    size_t ramfs_ram_limit;
+    // RAMFS: Maximum number of inodes, including the root directory.
+    size_t ramfs_inode_limit;
+} mountopts_t;
+
 // Open for read-only.
 #define OFLAGS_READONLY  0x00000001
 // Open for write-only.
@@ -120,6 +132,14 @@ typedef struct {
     char      name[FILESYSTEM_NAME_MAX + 1];
 } dirent_t;
 
+// Buffer descriptor for vectored reads and writes.
+typedef struct {
+    // Start of the buffer.
+    void     *base;
+    // Length of the buffer in bytes.
+    fileoff_t len;
+} iovec_t;
+
 // File or directory status.
 typedef struct stat {
     // ID of device containing file.
@@ -143,9 +163,13 @@ typedef struct stat {
 // Try to mount a filesystem.
 // Some filesystems (like RAMFS) do not use a block device, for which `media` must be NULL.
 // Filesystems which do use a block device can often be automatically detected.
-void      fs_mount(badge_err_t *ec, fs_type_t type, blkdev_t *media, char const *mountpoint, mountflags_t flags);
+// If `opts` is NULL, the default options are used.
+void      fs_mount(
+    badge_err_t *ec, fs_type_t type, blkdev_t *media, char const *mountpoint, mountflags_t flags, mountopts_t const *opts
+);
 // Unmount a filesystem.
-// Only raises an error if there isn't a valid filesystem to unmount.
+// Raises an error if there isn't a valid filesystem to unmount.
+// Files that are still open on the filesystem are closed, and opening new files on it fails while it is unmounted.
 void      fs_umount(badge_err_t *ec, char const *mountpoint);
 // Try to identify the filesystem stored in the block device
 // Returns `FS_TYPE_UNKNOWN` on error or if the filesystem is unknown.
@@ -177,7 +201,8 @@ bool   fs_dir_read(badge_err_t *ec, dirent_t *dirent_out, file_t dir);
 // Open a file for reading and/or writing.
 file_t    fs_open(badge_err_t *ec, char const *path, oflags_t oflags);
 // Close a file opened by `fs_open`.
-// Only raises an error if `file` is an invalid file descriptor.
+// Raises an error if `file` is an invalid file descriptor or if its cached data could not be written back.
+// The file is closed even if writing back failed.
 void      fs_close(badge_err_t *ec, file_t file);
 // Read bytes from a file.
 // Returns the amount of data successfully read.
@@ -185,6 +210,29 @@ fileoff_t fs_read(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen
 // Write bytes to a file.
 // Returns the amount of data successfully written.
 fileoff_t fs_write(badge_err_t *ec, file_t file, void const *writebuf, fileoff_t writelen);
+// Read bytes from a file at a given offset.
+// Does not use or change the file's current offset.
+// Returns the amount of data successfully read.
+fileoff_t fs_pread(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen, fileoff_t offset);
+// Write bytes to a file at a given offset.
+// Does not use or change the file's current offset.
+// Returns the amount of data successfully written.
+fileoff_t fs_pwrite(badge_err_t *ec, file_t file, void const *writebuf, fileoff_t writelen, fileoff_t offset);
+// Read bytes from a file into multiple buffers.
+// The buffers are filled in order as if by a single `fs_read` and the offset is advanced by the total read.
+// Returns the amount of data successfully read.
+fileoff_t fs_readv(badge_err_t *ec, file_t file, iovec_t const *iov, int iovcnt);
+// Write bytes to a file from multiple buffers.
+// The buffers are written in order as if by a single `fs_write` and the offset is advanced by the total written.
+// Returns the amount of data successfully written.
+fileoff_t fs_writev(badge_err_t *ec, file_t file, iovec_t const *iov, int iovcnt);
+// Copy bytes from one file to another without going through a caller-supplied buffer.
+// A NULL `src_offset` or `dst_offset` uses and advances that file's current offset, otherwise `*offset` is.
+// Copying a range of a file onto an overlapping range of the same file is not allowed.
+// Returns the amount of data successfully copied, which is less than `len` at the end of the source file.
+fileoff_t fs_copy_range(
+    badge_err_t *ec, file_t src, fileoff_t *src_offset, file_t dst, fileoff_t *dst_offset, fileoff_t len
+);
 // Get the current offset in the file.
 fileoff_t fs_tell(badge_err_t *ec, file_t file);
 // Set the current offset in the file.
@@ -193,3 +241,13 @@ fileoff_t fs_seek(badge_err_t *ec, file_t file, fileoff_t off, fs_seek_t seekmod
 // Force any write caches to be flushed for a given file.
 // If the file is `FILE_NONE`, all open files are flushed.
 void      fs_flush(badge_err_t *ec, file_t file);
+// Pin the page of a file's contents at `offset` in the page cache so it can be mapped into a process.
+// `offset` must be page-aligned and within the file; the part of the last page past the end of the file reads as zero.
+// Writes to the file show up in the page as soon as they are made.
+// Returns the physical page number on success, 0 on failure, and stores the handle for `fs_unpin_page` in `*pin_out`.
+size_t    fs_pin_page(badge_err_t *ec, file_t file, fileoff_t offset, void **pin_out);
+// Release a page pinned by `fs_pin_page`.
+void      fs_unpin_page(void *pin);
+// Get the I/O statistics of the block device that holds the filesystem of an open file.
+// Raises `ECAUSE_UNSUPPORTED` if the filesystem isn't stored on a block device.
+void      fs_blkdev_stats(badge_err_t *ec, file_t file, blkdev_stats_t *stats_out);
@@ -23,3 +23,27 @@ long syscall_fs_write(int fd, void const *write_buf, long write_len);
 // See `dirent_t` for the format.
 // Returns <= -1 on error, read count on success.
 long syscall_fs_getdents(int fd, void *read_buf, long read_len);
+
+// Read bytes from a file at a given offset without using or changing the current offset.
+// Returns <= -1 on error, read count on success.
+long syscall_fs_pread(int fd, void *read_buf, long read_len, long offset);
+
+// Write bytes to a file at a given offset without using or changing the current offset.
+// Returns <= -1 on error, write count on success.
+long syscall_fs_pwrite(int fd, void const *write_buf, long write_len, long offset);
+
+// Read bytes from a file into `iovcnt` buffers described by `iov`.
+// Returns <= -1 on error, total read count on success.
+long syscall_fs_readv(int fd, iovec_t const *iov, int iovcnt);
+
+// Write bytes to a file from `iovcnt` buffers described by `iov`.
+// Returns <= -1 on error, total write count on success.
+long syscall_fs_writev(int fd, iovec_t const *iov, int iovcnt);
+
+// Copy bytes from one file to another inside the kernel.
+// Returns <= -1 on error, copy count on success.
+long syscall_fs_copy_range(int src, long *src_offset, int dst, long *dst_offset, long len);
+
+// Get the I/O statistics of the block device that holds the filesystem of an open file.
+// Returns <= -1 on error, 0 on success.
+long syscall_fs_blkdev_stats(int fd, blkdev_stats_t *stats);
@@ -7,8 +7,20 @@
 #include "filesystem/vfs_types.h"
 #include "mutex.h"
 
+#include <stdatomic.h>
+
 #define VFS_MUTEX_TIMEOUT 1500000
 
+// Number of bits of a `file_t` that select the slot in the file handle table.
+// The remaining bits hold the generation of that slot.
+#define VFS_FILE_SLOT_BITS 16
+// Maximum number of open file handles.
+#define VFS_FILE_SLOT_MAX  (1 << VFS_FILE_SLOT_BITS)
+// Mask of the slot number in a `file_t`.
+#define VFS_FILE_SLOT_MASK (VFS_FILE_SLOT_MAX - 1)
+// Mask of the generation number in a `file_t` after shifting.
+#define VFS_FILE_GEN_MASK  (INT32_MAX >> VFS_FILE_SLOT_BITS)
+
 // Index in the VFS table of the filesystem mounted at /.
 // Set to -1 if no filesystem is mounted at /.
 // If no filesystem is mounted at /, the FS API will not work.
@@ -19,43 +31,57 @@ extern vfs_t     vfs_table[FILESYSTEM_MOUNT_MAX];
 // Taken exclusively during mount / unmount operations.
 // Taken shared during filesystem access.
 extern mutex_t   vfs_mount_mtx;
-// Mutex for creating and destroying directory and file handles.
-// Taken exclusively when a handle is created or destroyed.
-// Taken shared when a handle is used.
+// Mutex for the file handle table.
+// Taken exclusively while a handle is inserted or removed.
+// Taken shared while a handle is looked up.
 extern mutex_t   vfs_handle_mtx;
+// Mutex for the shared file handle table.
+// Taken exclusively while a shared handle is inserted or removed.
+// Taken shared while a shared handle is looked up.
+extern mutex_t   vfs_shared_mtx;
 
-// List of open shared file handles.
-extern vfs_file_shared_t **vfs_file_shared_list;
 // Number of open shared file handles.
-extern size_t              vfs_file_shared_list_len;
-// Capacity of open shared file handles list.
-extern size_t              vfs_file_shared_list_cap;
+extern atomic_size_t vfs_file_shared_list_len;
 
-// List of open file handles.
-extern vfs_file_handle_t *vfs_file_handle_list;
+// Table of open file handles, indexed by the slot number in `file_t`.
+extern vfs_file_slot_t *vfs_file_handle_list;
 // Number of open file handles.
-extern size_t             vfs_file_handle_list_len;
-// Capacity of open file handles list.
-extern size_t             vfs_file_handle_list_cap;
-
-
-
-/* ==== Thread-unsafe functions ==== */
-
-// Find a shared file handle by inode, if any.
-ptrdiff_t vfs_shared_by_inode(vfs_t *vfs, inode_t inode);
-// Get a file handle by number.
-ptrdiff_t vfs_file_by_handle(file_t fileno);
-// Create a new empty shared file handle.
-ptrdiff_t vfs_file_create_shared();
-// Destroy a shared file handle assuming the underlying file is already closed.
-void      vfs_file_destroy_shared(ptrdiff_t shared);
-// Create a new file handle.
-// If `shared` is -1, a new shared empty handle is created.
-ptrdiff_t vfs_file_create_handle(ptrdiff_t shared);
-// Delete a file handle.
-// If this is the last handle referring to one file, the shared handle is closed too.
-void      vfs_file_destroy_handle(ptrdiff_t handle);
+extern size_t           vfs_file_handle_list_len;
+// Capacity of open file handles table.
+extern size_t           vfs_file_handle_list_cap;
+
+
+
+/* ==== Handle tables ==== */
+
+// Find a shared file handle by inode and take a reference to it, if any.
+vfs_file_shared_t *vfs_shared_get(vfs_t *vfs, inode_t inode);
+// Drop a reference to a shared file handle.
+// If this was the last reference, the file is closed and the shared handle destroyed.
+void               vfs_shared_put(vfs_file_shared_t *shared);
+// Create a new empty shared file handle for a file on `vfs` with one reference.
+// Fails with `ECAUSE_INUSE` if the filesystem is being unmounted.
+vfs_file_shared_t *vfs_file_create_shared(badge_err_t *ec, vfs_t *vfs);
+// Set whether a filesystem is being unmounted; no shared handles are created or looked up for it while it is.
+void               vfs_set_unmounting(vfs_t *vfs, bool unmounting);
+// Add a shared file handle to the lookup table once its `vfs` and `inode` are set.
+// If another shared handle for the same file was added concurrently, `shared` is closed and destroyed,
+// and a reference to the existing shared handle is returned instead.
+vfs_file_shared_t *vfs_file_register_shared(vfs_file_shared_t *shared);
+// Destroy a shared file handle that is not in the lookup table, assuming the underlying file is already closed.
+void               vfs_file_destroy_shared(vfs_file_shared_t *shared);
+// Get a file handle by number and take a reference to it.
+vfs_file_handle_t *vfs_file_get(file_t fileno);
+// Drop a reference to a file handle.
+// If this was the last reference, the handle is freed and its shared handle released.
+void               vfs_file_put(vfs_file_handle_t *handle);
+// Create a new file handle and add it to the file handle table.
+// On success, the caller's reference to `shared` is transferred to the new handle.
+// Returns the new handle number, or `FILE_NONE` if out of memory or handles.
+file_t             vfs_file_create_handle(vfs_file_shared_t *shared, bool read, bool write, bool is_dir);
+// Remove a file handle from the file handle table and drop the table's reference to it.
+// Returns false if there is no such handle.
+bool               vfs_file_destroy_handle(file_t fileno);
 
 
 
@@ -74,9 +100,10 @@ void vfs_create_dir(badge_err_t *ec, vfs_file_shared_t *dir, char const *name);
 // If this is the last reference to an inode, the inode is deleted.
 void vfs_unlink(badge_err_t *ec, vfs_file_shared_t *dir, char const *name);
 
-// Atomically read all directory entries and cache them into the directory handle.
-// Refer to `dirent_t` for the structure of the cache.
-void vfs_dir_read(badge_err_t *ec, vfs_file_handle_t *dir);
+// Read the directory entry at `*cookie` and advance `*cookie` to the next entry.
+// A cookie of 0 refers to the first entry; cookies stay valid while entries are added or removed.
+// Returns false without error at the end of the directory.
+bool vfs_dir_read(badge_err_t *ec, vfs_file_shared_t *dir, fileoff_t *cookie, dirent_t *out);
 // Atomically read the directory entry with the matching name.
 // Returns true if the entry was found.
 bool vfs_dir_find_ent(badge_err_t *ec, vfs_file_shared_t *dir, dirent_t *ent, char const *name);
@@ -98,7 +125,20 @@ void vfs_file_write(
 );
 // Change the length of a file opened by `vfs_file_open`.
 void vfs_file_resize(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t new_size);
+// Read bytes from a file, bypassing the page cache.
+// The entire read succeeds or the entire read fails, never partial read.
+void vfs_file_read_direct(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen
+);
+// Write bytes to a file, bypassing the page cache.
+// The entire write succeeds or the entire write fails, never partial write.
+void vfs_file_write_direct(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
+);
+// Change the length of a file, bypassing the page cache.
+void vfs_file_resize_direct(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t new_size);
 
 // Commit all pending writes to disk.
 // The filesystem, if it does caching, must always sync everything to disk at once.
 void vfs_flush(badge_err_t *ec, vfs_t *vfs);
+
@@ -0,0 +1,99 @@
+
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "filesystem/vfs_types.h"
+#include "port/hardware_allocation.h"
+#include "time.h"
+
+#include <stdatomic.h>
+
+// Size of a page in the page cache.
+#define VFS_PCACHE_PAGE_SIZE      MEMMAP_PAGE_SIZE
+#if MEMMAP_VMEM
+// Maximum number of pages held by the page cache.
+#define VFS_PCACHE_MAX_PAGES      256
+#else
+// Maximum number of pages held by the page cache.
+#define VFS_PCACHE_MAX_PAGES      64
+#endif
+// Number of buckets in the page cache hash table; must be a power of two.
+#define VFS_PCACHE_BUCKETS        128
+// Interval at which housekeeping checks for dirty pages to write back.
+#define VFS_PCACHE_WRITEBACK_TIME 1000000
+// Minimum time a page is dirty before housekeeping writes it back.
+#define VFS_PCACHE_WRITEBACK_AGE  3000000
+
+typedef struct vfs_page vfs_page_t;
+
+// Page of cached file data.
+// The LRU links are guarded by the page cache LRU mutex and `referenced` is atomic;
+// all other fields are guarded by the mutex of the hash table bucket the page belongs to.
+struct vfs_page {
+    // Next page in the same bucket of the hash table.
+    vfs_page_t        *hash_next;
+    // Previous page in the LRU list; towards the most recently used page.
+    vfs_page_t        *lru_prev;
+    // Next page in the LRU list; towards the least recently used page.
+    vfs_page_t        *lru_next;
+    // VFS of the cached file; does not change while the page is allocated.
+    vfs_t             *vfs;
+    // Inode number of the cached file; does not change while the page is allocated.
+    inode_t            inode;
+    // Index of this page in the file; does not change while the page is allocated.
+    fileoff_t          index;
+    // Physical page number of the page's memory.
+    size_t             ppn;
+    // Page contains data not yet written to the filesystem.
+    bool               dirty;
+    // When the page was last made dirty.
+    timestamp_us_t     dirty_since;
+    // Shared handle to write the page back through; only valid while dirty.
+    vfs_file_shared_t *dirty_file;
+    // Number of process mappings of this page; pinned pages are never evicted.
+    size_t             pins;
+    // Page is being loaded or written back without its bucket locked.
+    // Busy pages are never changed, evicted or dropped by other threads.
+    bool               busy;
+    // Page data has been loaded; pages that are not valid yet are waited for instead of read.
+    bool               valid;
+    // Page was dropped from the cache while pinned and is freed when unpinned.
+    bool               dropped;
+    // Page was used since eviction last looked at it.
+    atomic_bool        referenced;
+};
+
+// Start periodic writeback of dirty pages.
+void vfs_pcache_init();
+
+// Read bytes from a file through the page cache.
+// The caller must hold `file->mutex` and the read must lie within the file.
+void vfs_pcache_read(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen);
+// Write bytes to a file through the page cache.
+// The caller must hold `file->mutex` exclusively and the file must already be large enough.
+void vfs_pcache_write(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
+);
+// Change the length of a file, dropping cached pages past the new end.
+// The caller must hold `file->mutex` exclusively.
+void vfs_pcache_resize(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t new_size);
+
+// Pin the page of a file at a given index in the cache so it can be mapped into a process.
+// Pinned pages do not count towards `VFS_PCACHE_MAX_PAGES`.
+// The caller must hold `file->mutex` and the page must lie within the file.
+vfs_page_t *vfs_pcache_pin(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t index);
+// Get the kernel address of the memory of a pinned page.
+uint8_t    *vfs_pcache_page_mem(vfs_page_t const *page);
+// Release a page pinned by `vfs_pcache_pin`.
+// If the page was dropped from the cache while pinned, its memory is freed now.
+void        vfs_pcache_unpin(vfs_page_t *page);
+
+// Write back the dirty pages of a file.
+void vfs_pcache_flush(badge_err_t *ec, vfs_file_shared_t *file);
+// Write back all dirty pages.
+void vfs_pcache_flush_all(badge_err_t *ec);
+// Drop all cached pages of an inode, e.g. because its number was reused for a new file.
+void vfs_pcache_drop_inode(vfs_t *vfs, inode_t inode);
+// Drop all cached pages of a filesystem that is being unmounted.
+void vfs_pcache_drop_vfs(vfs_t *vfs);
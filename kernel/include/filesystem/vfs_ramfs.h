@@ -10,8 +10,15 @@
 // First regular inode of a RAM filesystem.
 #define VFS_RAMFS_INODE_FIRST 2
 
+// Initial capacity of the inode table of a RAM filesystem.
+#define VFS_RAMFS_INODE_INITIAL       32
+// Default maximum number of inodes of a RAM filesystem.
+#define VFS_RAMFS_DEFAULT_INODE_LIMIT 4096
+// Default RAM limit of a RAM filesystem; only limited by available memory.
+#define VFS_RAMFS_DEFAULT_RAM_LIMIT   SIZE_MAX
+
 // Try to mount a ramfs filesystem.
-void vfs_ramfs_mount(badge_err_t *ec, vfs_t *vfs);
+void vfs_ramfs_mount(badge_err_t *ec, vfs_t *vfs, mountopts_t const *opts);
 // Unmount a ramfs filesystem.
 void vfs_ramfs_umount(vfs_t *vfs);
 
@@ -31,9 +38,9 @@ void vfs_ramfs_unlink(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, char
 // If `dir` is NULL, the root directory is used.
 bool vfs_ramfs_exists(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, char const *name);
 
-// Atomically read all directory entries and cache them into the directory handle.
-// Refer to `dirent_t` for the structure of the cache.
-void vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_handle_t *dir);
+// Read the directory entry at `*cookie` and advance `*cookie` to the next entry.
+// Returns false without error at the end of the directory.
+bool vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, fileoff_t *cookie, dirent_t *out);
 // Atomically read the directory entry with the matching name.
 // Returns true if the entry was found.
 bool vfs_ramfs_dir_find_ent(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, dirent_t *ent, char const *name);
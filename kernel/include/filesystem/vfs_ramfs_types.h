@@ -44,9 +44,14 @@ typedef struct {
     int      uid;
     // Owner group ID.
     int      gid;
+    // Directory generation; incremented when merging or trimming removed entries invalidates entry offsets.
+    uint32_t dir_gen;
 } vfs_ramfs_inode_t;
 
 // RAMFS directory entry.
+// Removed entries are left in place with an inode of `INODE_NONE`, merged with adjacent removed entries and trimmed
+// from the end of the directory. Directory read cookies hold the entry offset and the directory generation, so a
+// cookie from before a merge or trim is moved to the next entry instead of pointing into another entry.
 typedef struct {
     // Entry size.
     size_t  size;
@@ -65,17 +70,20 @@ typedef vfs_ramfs_inode_t *vfs_ramfs_file_t;
 // Mounted RAM filesystem.
 typedef struct {
     // RAM limit for the entire filesystem.
-    size_t             ram_limit;
+    size_t              ram_limit;
     // RAM usage.
-    atomic_size_t      ram_usage;
+    atomic_size_t       ram_usage;
+    // Maximum number of inodes.
+    size_t              inode_limit;
     // Inode table, indices 0 and 1 are unused.
-    vfs_ramfs_inode_t *inode_list;
-    // Inode table usage map.
-    bool              *inode_usage;
-    // Number of allocated inodes.
-    size_t             inode_list_len;
+    // Inodes are allocated separately so that pointers to them remain valid when the table grows.
+    vfs_ramfs_inode_t **inode_list;
+    // Inode table usage bitmap, one bit per inode.
+    size_t             *inode_usage;
+    // Capacity of the inode table.
+    size_t              inode_list_len;
     // THE RAMFS mutex.
     // Acquired shared for all read-only operations.
     // Acquired exclusive for any write operation.
-    mutex_t            mtx;
+    mutex_t             mtx;
 } vfs_ramfs_t;
@@ -9,15 +9,24 @@
 #include "filesystem/vfs_ramfs_types.h"
 #include "mutex.h"
 
-typedef struct vfs vfs_t;
+#include <stdatomic.h>
+
+typedef struct vfs               vfs_t;
+typedef struct vfs_file_shared vfs_file_shared_t;
 
 // VFS shared opened file handle.
 // Shared between all file handles referring to the same file.
-typedef struct {
+struct vfs_file_shared {
     // Reference count.
-    size_t    refcount;
-    // Index in the shared file handle table.
-    ptrdiff_t index;
+    atomic_size_t      refcount;
+    // Mutex that guards the file size and contents.
+    // Taken exclusively when the file is written or resized.
+    // Taken shared when the file is read.
+    mutex_t            mutex;
+    // Next shared handle in the same bucket of the shared handle table.
+    vfs_file_shared_t *hash_next;
+    // Whether this handle is in the shared handle table.
+    bool               hashed;
     // Current file size.
     fileoff_t size;
     // Filesystem-specific information.
@@ -28,12 +37,9 @@ typedef struct {
         vfs_fat_file_t   fat_file;
     };
 
-    // Cached region offset.
-    fileoff_t cache_off;
-    // Cached region size.
-    fileoff_t cache_size;
-    // Cached register buffer.
-    char     *cache;
+    // Number of pages of this file that are dirty in the page cache.
+    // Atomic because the pages of a file are guarded by the mutexes of different page cache buckets.
+    atomic_size_t pcache_dirty;
 
     // Inode number (gauranteed to be unique per VFS).
     // No file or directory may have the same inode number.
@@ -41,46 +47,56 @@ typedef struct {
     inode_t inode;
     // Pointer to the VFS on which this file exists.
     vfs_t  *vfs;
-} vfs_file_shared_t;
+};
 
 // VFS opened file handle.
 typedef struct {
+    // Reference count; one for the file handle table and one for each ongoing operation.
+    atomic_int refcount;
     // Current access position.
     // Note: Must be bounds-checked on every file I/O.
-    fileoff_t offset;
+    // Directories: Cookie of the next entry to read, as produced by `vfs_dir_read`.
+    fileoff_t  offset;
     // File is writeable.
-    bool      write;
+    bool       write;
     // File is readable.
-    bool      read;
+    bool       read;
     // Handle refers to a directory.
-    bool      is_dir;
+    bool       is_dir;
     // Handle mutex for concurrency.
-    mutex_t   mutex;
-
-    // Directories: Cached size.
-    fileoff_t dir_cache_size;
-    // Directories: Cache.
-    char     *dir_cache;
+    mutex_t    mutex;
 
     // Pointer to shared file handle.
-    // Directories do not have a shared handle.
+    // Directories have one as well; it is passed to the filesystem for directory operations.
     vfs_file_shared_t *shared;
     // Handle number.
     file_t             fileno;
 } vfs_file_handle_t;
 
+// Slot in the file handle table.
+typedef struct {
+    // Handle occupying this slot, or NULL if vacant.
+    vfs_file_handle_t *handle;
+    // Generation counter, incremented every time the slot is vacated.
+    uint32_t           gen;
+} vfs_file_slot_t;
+
 // VFS mounted filesystem.
 struct vfs {
     // Copy of mount point.
-    char     *mountpoint;
+    char         *mountpoint;
     // Read-only flag.
-    bool      readonly;
+    bool          readonly;
     // Associated block device.
-    blkdev_t *media;
+    blkdev_t     *media;
     // Filesystem type.
-    fs_type_t type;
+    fs_type_t     type;
     // Inode number given to the root directory.
-    inode_t   inode_root;
+    inode_t       inode_root;
+    // Number of shared file handles registered for this filesystem that are not yet closed.
+    atomic_size_t shared_count;
+    // Filesystem is being unmounted; guarded by the shared handle table mutex.
+    bool          unmounting;
     // Filesystem-specific information.
     union {
         // RAMFS.
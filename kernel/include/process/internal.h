@@ -6,6 +6,15 @@
 #include "filesystem.h"
 #include "process/process.h"
 
+// Number of file descriptors per word in the file descriptor usage bitmap.
+#define PROC_FD_BITS (sizeof(size_t) * 8)
+// Flag for `proc_map_file_raw`: writes to the mapping stay private to the process instead of going to the file.
+#define PROC_MAP_PRIVATE 0x00000100
+// Virtual address of the shared read-only time page; just below the lowest address `proc_map_raw` hands out.
+#define PROC_TIME_PAGE_VADDR (65536 - MEMMAP_PAGE_SIZE)
+// Default size of the user stack of threads created with `SYSCALL_THREAD_CREATE`.
+#define PROC_THREAD_STACK_SIZE 16384
+
 extern mutex_t proc_mtx;
 
 
@@ -20,6 +29,14 @@ process_t *proc_get_unsafe(pid_t pid);
 void proc_suspend(process_t *process, tid_t current);
 // Resume all threads for a process.
 void proc_resume(process_t *process);
+// Add a file to the process file handle list while holding `process->mtx`.
+// Returns the lowest vacant file descriptor number.
+int    proc_add_fd(badge_err_t *ec, process_t *process, file_t real);
+// Find a file in the process file handle list while holding `process->mtx` shared.
+file_t proc_find_fd(badge_err_t *ec, process_t *process, int virt);
+// Remove a file from the process file handle list while holding `process->mtx`.
+// Returns the file that was removed.
+file_t proc_remove_fd(badge_err_t *ec, process_t *process, int virt);
 // Release all process runtime resources (threads, memory, files, etc.).
 // Does not remove args, exit code, etc.
 void proc_delete_runtime_raw(process_t *process);
@@ -37,19 +54,41 @@ process_t *proc_current();
 void proc_start_raw(badge_err_t *ec, process_t *process);
 
 // Create a new thread in a process.
+// If `stack_size` is nonzero, a user stack is allocated and the thread shares the global pointer of the current thread.
 // Returns created thread handle.
-tid_t    proc_create_thread_raw(badge_err_t *ec, process_t *process, size_t entry_point, size_t arg, int priority);
-// Delete a thread in a process.
-void   proc_delete_thread_raw_unsafe(badge_err_t *ec, process_t *process, sched_thread_t *thread);
+tid_t  proc_create_thread_raw(
+    badge_err_t *ec, process_t *process, size_t entry_point, size_t arg, int priority, size_t stack_size
+);
+// Whether a thread is in the process' thread list.
+bool   proc_has_thread_raw(process_t *process, tid_t thread);
+// Remove a thread from the process' thread list.
+// The caller must hold `process->mtx`; the thread itself is not stopped.
+void   proc_delete_thread_raw_unsafe(badge_err_t *ec, process_t *process, tid_t thread);
 // Allocate more memory to a process.
 // Returns actual virtual address on success, 0 on failure.
 size_t proc_map_raw(badge_err_t *ec, process_t *process, size_t vaddr, size_t size, size_t align, uint32_t flags);
+// Map part of a file into a process.
+// Returns actual virtual address on success, 0 on failure.
+size_t proc_map_file_raw(
+    badge_err_t *ec, process_t *process, size_t vaddr, size_t size, file_t file, fileoff_t offset, uint32_t flags
+);
+// Map a shared memory object into a process.
+// Returns actual virtual address on success, 0 on failure.
+size_t proc_map_shm_raw(badge_err_t *ec, process_t *process, size_t vaddr, int shm, uint32_t flags);
+// Give the process its own copy of pages of private file mappings in this range that still share the file's pages.
+// Returns the number of pages copied.
+size_t proc_map_unshare_raw(badge_err_t *ec, process_t *process, size_t vaddr, size_t size);
+// Whether `vaddr` lies in a writable private file mapping and its page is already the process' own copy.
+bool   proc_map_is_unshared_raw(process_t *process, size_t vaddr);
 // Release memory allocated to a process.
 void   proc_unmap_raw(badge_err_t *ec, process_t *process, size_t base);
 // Whether the process owns this range of memory.
 // Returns the lowest common denominator of the access bits.
 int    proc_map_contains_raw(process_t *proc, size_t base, size_t size);
+// Map the shared read-only time page into a new process, if this platform lets userland read the timer.
+void   proc_map_time_page_raw(process_t *proc);
 // Add a file to the process file handle list.
+// Returns the lowest vacant file descriptor number.
 int    proc_add_fd_raw(badge_err_t *ec, process_t *process, file_t real);
 // Find a file in the process file handle list.
 file_t proc_find_fd_raw(badge_err_t *ec, process_t *process, int virt);
@@ -61,5 +100,8 @@ void   proc_remove_fd_raw(badge_err_t *ec, process_t *process, int virt);
 void proc_pre_resume_cb(sched_thread_t *thread);
 // Atomically whether signals are pending.
 bool proc_signals_pending_raw(process_t *process);
+// Update `PROC_SIGPEND` after the pending or blocked signals changed.
+// The caller must hold `process->mtx`.
+void proc_update_sigpend_raw(process_t *process);
 // Raise a signal to a process' main thread or a specified thread, while suspending it's other threads.
 void proc_raise_signal_raw(badge_err_t *ec, process_t *process, int signum);
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "badge_err.h"
+#include "process/types.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+
+
+// Shared memory object that multiple processes can map.
+struct shm {
+    // Handle processes use to refer to this object.
+    int        id;
+    // Process that created this object and may destroy it.
+    pid_t      owner;
+    // Size in bytes; a multiple of `MEMMAP_PAGE_SIZE`.
+    size_t     size;
+    // Physical page number of every page.
+    size_t    *ppns;
+    // One reference for the handle until it is destroyed, plus one per mapping.
+    atomic_int refcount;
+};
+
+
+
+// Create a zero-filled shared memory object of at least `size` bytes.
+// Returns the handle of the new object, or 0 on failure.
+int    shm_create(badge_err_t *ec, pid_t owner, size_t size);
+// Look up a shared memory object by handle and take a reference to it.
+shm_t *shm_get(badge_err_t *ec, int id);
+// Release a reference to a shared memory object; its memory is freed when the last reference is gone.
+void   shm_unref(shm_t *shm);
+// Destroy the handle of a shared memory object; existing mappings stay valid.
+// Only the process that created the object may destroy it.
+void   shm_destroy(badge_err_t *ec, pid_t caller, int id);
+// Destroy the handles of all shared memory objects created by a process.
+void   shm_destroy_owned(pid_t owner);
@@ -13,6 +13,9 @@ void proc_signal_handler() NORETURN;
 // Raises a segmentation fault to the current thread.
 // Called in the kernel side of a used thread when hardware detects a segmentation fault.
 void proc_sigsegv_handler(size_t vaddr) NORETURN;
+// Handles a store page fault from a user thread.
+// Copies the page if it belongs to a private file mapping and retries the store, otherwise raises a segmentation fault.
+void proc_store_fault_handler(size_t vaddr) NORETURN;
 // Raises an illegal instruction fault to the current thread.
 // Called in the kernel side of a used thread when hardware detects an illegal instruction fault.
 void proc_sigill_handler() NORETURN;
@@ -18,6 +18,9 @@
 
 
 
+// Shared memory object that multiple processes can map.
+typedef struct shm shm_t;
+
 // A memory map entry.
 typedef struct {
     // Base physical address of the region.
@@ -32,6 +35,14 @@ typedef struct {
     bool   write;
     // Execution permission.
     bool   exec;
+#if MEMMAP_VMEM
+    // Private file mapping; pages are copied on the first write instead of writing to the file.
+    bool   cow;
+    // File mappings: page cache pins from `fs_pin_page` per page, NULL for pages copied on write.
+    void **file_pins;
+    // Shared memory mappings: the mapped object, which holds a reference for this mapping.
+    shm_t *shm;
+#endif
 } proc_memmap_ent_t;
 
 // Process memory map information.
@@ -51,20 +62,6 @@ typedef struct proc_memmap_t {
 #endif
 } proc_memmap_t;
 
-// Process file descriptor.
-typedef struct {
-    int    virt;
-    file_t real;
-} proc_fd_t;
-
-// Pending signal entry.
-typedef struct {
-    // Doubly-linked list node.
-    dlist_node_t node;
-    // Signal number.
-    int          signum;
-} sigpending_t;
-
 // Globally unique process ID.
 typedef int pid_t;
 
@@ -82,10 +79,12 @@ typedef struct process_t {
     char        **argv;
     // Size required to store all of argv.
     size_t        argv_size;
-    // Number of file descriptors.
-    size_t        fds_len;
-    // File descriptors.
-    proc_fd_t    *fds;
+    // Capacity of the file descriptor table.
+    size_t        fds_cap;
+    // File descriptor table, indexed by virtual file descriptor; `FILE_NONE` if vacant.
+    file_t       *fds;
+    // File descriptor table usage bitmap.
+    size_t       *fds_usage;
     // Number of threads.
     size_t        threads_len;
     // Thread handles.
@@ -98,8 +97,10 @@ typedef struct process_t {
     mutex_t       mtx;
     // Process status flags.
     atomic_int    flags;
-    // Pending signals list.
-    dlist_t       sigpending;
+    // Pending signals bitmask, indexed by signal number.
+    uint32_t      sigpending;
+    // Blocked signals bitmask; blocked signals stay pending until unblocked.
+    uint32_t      sigmask;
     // Child process list.
     dlist_t       children;
     // Signal handler virtual addresses.
@@ -39,3 +39,7 @@ void sched_prepare_kernel_entry(sched_thread_t *thread, void *entry_point, void
 // Prepares a pair of contexts to be invoked as a userland thread.
 // Kernel-side in these threads is always started by an ISR and the entry point is given at that time.
 void sched_prepare_user_entry(sched_thread_t *thread, size_t entry_point, size_t arg);
+
+// Prepares a userland thread created by another thread of the same process to run on a new stack.
+// The new thread shares the global pointer of its creator.
+void sched_prepare_user_stack(sched_thread_t *thread, sched_thread_t const *creator, size_t stack_top);
@@ -94,9 +94,12 @@ void thread_resume_from_isr(badge_err_t *ec, tid_t thread);
 void thread_resume_now_from_isr(badge_err_t *ec, tid_t thread);
 // Returns whether a thread is running; it is neither suspended nor has it exited.
 bool thread_is_running(badge_err_t *ec, tid_t thread);
+// Makes a user thread exit the next time it is scheduled in user mode, resuming it if it was suspended.
+void thread_kill_user(badge_err_t *ec, tid_t thread);
 
 // Exits the current thread.
 // If the thread is detached, resources will be cleaned up.
 void thread_exit(int code) NORETURN;
 // Wait for another thread to exit.
-void thread_join(tid_t thread);
+// Returns its exit code, or 0 if it no longer exists.
+int  thread_join(tid_t thread);
@@ -48,6 +48,10 @@
 #define THREAD_EXITED     (1 << 9)
 // The thread is blocked on a resource.
 #define THREAD_BLOCKED    (1 << 10)
+// The fast system call running on this thread must be run again as a normal system call.
+#define THREAD_FASTDEFER  (1 << 11)
+// The user thread should exit the next time it is scheduled in user mode.
+#define THREAD_KILLUSER   (1 << 12)
 
 // The scheduler is starting on this CPU.
 #define SCHED_STARTING (1 << 0)
@@ -73,6 +77,8 @@ struct sched_thread_t {
     size_t      kernel_stack_bottom;
     // Highest address of the kernel stack.
     size_t      kernel_stack_top;
+    // Virtual address of the user stack the kernel allocated, 0 if the thread brought its own.
+    size_t      user_stack;
     // Priority of this thread.
     int         priority;
     // Time usage information.
@@ -15,7 +15,7 @@
         badge_err_t ec_buf = {0};                                                                                      \
         func(&ec_buf, __VA_ARGS__);                                                                                    \
         if (ec) {                                                                                                      \
-            sigsegv_assert(copy_to_user(proc_current_pid(), (size_t)ec, &ec_buf, sizeof(badge_err_t)), (size_t)ec);    \
+            sysutil_ec_to_user(ec, &ec_buf);                                                                           \
         }                                                                                                              \
     }
 
@@ -24,7 +24,7 @@
         badge_err_t ec_buf    = {0};                                                                                   \
         rettype     ec_rettmp = func(&ec_buf, __VA_ARGS__);                                                            \
         if (ec) {                                                                                                      \
-            sigsegv_assert(copy_to_user(proc_current_pid(), (size_t)ec, &ec_buf, sizeof(badge_err_t)), (size_t)ec);    \
+            sysutil_ec_to_user(ec, &ec_buf);                                                                           \
         }                                                                                                              \
         ec_rettmp;                                                                                                     \
     })
@@ -32,7 +32,7 @@
 #define badge_err_userset(ec, loc, cause)                                                                              \
     {                                                                                                                  \
         badge_err_t ec_buf = {(loc), (cause)};                                                                         \
-        sigsegv_assert(copy_to_user(proc_current_pid(), (size_t)ec, &ec_buf, sizeof(badge_err_t)), (size_t)ec);        \
+        sysutil_ec_to_user(ec, &ec_buf);                                                                               \
     }
 
 
@@ -41,6 +41,9 @@
 void sigsys_assert(bool condition);
 // Assert that a condition is true, or raise SIGSEGV and don't return.
 void sigsegv_assert(bool condition, size_t vaddr);
+// Copy an error code to the user, or raise SIGSEGV and don't return if the process can't write it.
+// Fast system calls are deferred instead of raising SIGSEGV.
+void sysutil_ec_to_user(badge_err_t *ec, badge_err_t *ec_buf);
 // Checks whether the process has permission for a range of memory.
 bool sysutil_memperm(void const *ptr, size_t len, uint32_t flags);
 // If the process does not have access, raise SIGSEGV and don't return.
@@ -17,7 +17,12 @@ bool copy_from_user_raw(process_t *process, void *kernel_vaddr, size_t user_vadd
 // Copy from kernel to user.
 // Returns whether the user has access to all of these bytes.
 // If the user doesn't have access, no copy is performed.
+// The caller must hold `process->mtx` because copy-on-write pages are copied first.
 bool copy_to_user_raw(process_t *process, size_t user_vaddr, void *const kernel_vaddr, size_t len);
+// Copy from kernel to user without first copying copy-on-write pages, so it is safe to use in the trap handler.
+// Returns whether the user has access to all of these bytes; copy-on-write pages count as not writable.
+// If the user doesn't have access, no copy is performed.
+bool copy_to_user_from_isr(process_t *process, size_t user_vaddr, void *const kernel_vaddr, size_t len);
 
 // Determine string length in memory a user owns.
 // Returns -1 if the user doesn't have access to any byte in the string.
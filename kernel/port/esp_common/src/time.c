@@ -78,3 +78,11 @@ void time_init() {
 timestamp_us_t time_us() {
     return timer_value_get(smp_cur_cpu());
 }
+
+// Get the timer parameters userland needs to compute `time_us` itself.
+// Returns false if userland can't read the timer.
+bool time_get_user_params(time_page_t *params) {
+    // The timer is a peripheral that userland has no access to.
+    (void)params;
+    return false;
+}
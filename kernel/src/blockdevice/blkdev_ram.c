@@ -67,6 +67,42 @@ void blkdev_ram_read_partial(
     mem_copy(readbuf, ram_addr + block * block_size + subblock_offset, readbuf_len);
 }
 
+static void blkdev_ram_read_range(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, blkdev_iovec_t const *iov, size_t iovcnt
+) {
+    (void)count;
+    badge_err_set_ok(ec);
+    uint8_t const *ram_addr = (uint8_t const *)blkdev_impl_get_cookie(dev) + block * blkdev_get_block_size(dev);
+    for (size_t i = 0; i < iovcnt; i++) {
+        mem_copy(iov[i].base, ram_addr, iov[i].len);
+        ram_addr += iov[i].len;
+    }
+}
+
+static void blkdev_ram_write_range(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, blkdev_iovec_t const *iov, size_t iovcnt
+) {
+    (void)count;
+    badge_err_set_ok(ec);
+    uint8_t *ram_addr = (uint8_t *)blkdev_impl_get_cookie(dev) + block * blkdev_get_block_size(dev);
+    for (size_t i = 0; i < iovcnt; i++) {
+        mem_copy(ram_addr, iov[i].base, iov[i].len);
+        ram_addr += iov[i].len;
+    }
+}
+
+static void blkdev_ram_erase_range(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count) {
+    (void)dev;
+    (void)block;
+    (void)count;
+    badge_err_set_ok(ec);
+}
+
+static void *blkdev_ram_direct_access(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count) {
+    (void)count;
+    badge_err_set_ok(ec);
+    return (uint8_t *)blkdev_impl_get_cookie(dev) + block * blkdev_get_block_size(dev);
+}
 
 static blkdev_vtable_t const blkdev_ram_vtable = {
     .destroy       = blkdev_ram_destroy,
@@ -78,6 +114,10 @@ static blkdev_vtable_t const blkdev_ram_vtable = {
     .read          = blkdev_ram_read,
     .write_partial = blkdev_ram_write_partial,
     .read_partial  = blkdev_ram_read_partial,
+    .read_range    = blkdev_ram_read_range,
+    .write_range   = blkdev_ram_write_range,
+    .erase_range   = blkdev_ram_erase_range,
+    .direct_access = blkdev_ram_direct_access,
 };
 
 
@@ -0,0 +1,387 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "blockdevice/blkdev_zram.h"
+
+#include "badge_strings.h"
+#include "blockdevice/blkdev_impl.h"
+#include "blockdevice/blkdev_internal.h"
+#include "malloc.h"
+
+#include <stdatomic.h>
+
+// Number of bits of the match finder's hash.
+#define ZRAM_HASH_BITS  10
+// Number of entries in the match finder's hash table.
+#define ZRAM_HASH_SIZE  (1 << ZRAM_HASH_BITS)
+// Shortest match that is encoded as a back-reference.
+#define ZRAM_MIN_MATCH  4
+// Largest distance a back-reference can reach.
+#define ZRAM_MAX_OFFSET 65535
+// Largest length that fits in one nibble of a sequence token; longer lengths continue in extra bytes.
+#define ZRAM_NIBBLE_MAX 15
+
+
+
+// Storage of a single block.
+typedef struct {
+    // Compressed or raw block data, or NULL if the block is filled with `pattern`.
+    uint8_t *data;
+    // Length of `data`; equal to the block size if the block is stored uncompressed.
+    size_t   len;
+    // Word the block is filled with if `data` is NULL.
+    size_t   pattern;
+} zram_slot_t;
+
+// Compressed RAM block device state.
+typedef struct {
+    // Per-block storage.
+    zram_slot_t   *slots;
+    // One block of scratch memory to compress into.
+    uint8_t       *scratch;
+    // Match finder hash table of positions in the block being compressed.
+    uint16_t      *table;
+    // Number of bytes allocated for block storage.
+    atomic_size_t  stored;
+} blkdev_zram_t;
+
+
+
+// Load a little-endian 32-bit word from possibly unaligned memory.
+static inline uint32_t zram_load32(uint8_t const *ptr) {
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+// Hash the 4 bytes at a position for the match finder.
+static inline size_t zram_hash(uint8_t const *ptr) {
+    return (zram_load32(ptr) * 2654435761u) >> (32 - ZRAM_HASH_BITS);
+}
+
+// Append the extra bytes of a sequence length that did not fit in its nibble.
+// Returns false if the output buffer is full.
+static bool zram_put_length(uint8_t *out, size_t out_cap, size_t *out_pos, size_t len) {
+    if (len < ZRAM_NIBBLE_MAX) {
+        return true;
+    }
+    len -= ZRAM_NIBBLE_MAX;
+    while (true) {
+        if (*out_pos >= out_cap) {
+            return false;
+        }
+        uint8_t byte      = len >= 255 ? 255 : len;
+        out[(*out_pos)++] = byte;
+        len              -= byte;
+        if (byte < 255) {
+            return true;
+        }
+    }
+}
+
+// Append one sequence of literals optionally followed by a back-reference; `match_len` 0 means no back-reference.
+// Returns false if the output buffer is full.
+static bool zram_put_sequence(
+    uint8_t       *out,
+    size_t         out_cap,
+    size_t        *out_pos,
+    uint8_t const *literals,
+    size_t         lit_len,
+    size_t         offset,
+    size_t         match_len
+) {
+    size_t match_code = match_len ? match_len - ZRAM_MIN_MATCH : 0;
+    if (*out_pos >= out_cap) {
+        return false;
+    }
+    out[(*out_pos)++] = (lit_len < ZRAM_NIBBLE_MAX ? lit_len : ZRAM_NIBBLE_MAX) << 4
+                        | (match_code < ZRAM_NIBBLE_MAX ? match_code : ZRAM_NIBBLE_MAX);
+    if (!zram_put_length(out, out_cap, out_pos, lit_len) || out_cap - *out_pos < lit_len) {
+        return false;
+    }
+    mem_copy(out + *out_pos, literals, lit_len);
+    *out_pos += lit_len;
+    if (!match_len) {
+        return true;
+    }
+    if (out_cap - *out_pos < 2) {
+        return false;
+    }
+    out[(*out_pos)++] = offset;
+    out[(*out_pos)++] = offset >> 8;
+    return zram_put_length(out, out_cap, out_pos, match_code);
+}
+
+// Compress a block into an LZ4-style stream of sequences; the last sequence is literals only.
+// Returns the compressed length, or 0 if it would not fit in `out_cap` bytes.
+static size_t zram_compress(uint16_t *table, uint8_t const *in, size_t in_len, uint8_t *out, size_t out_cap) {
+    size_t out_pos = 0;
+    size_t anchor  = 0;
+    size_t pos     = 0;
+    mem_set(table, 0, ZRAM_HASH_SIZE * sizeof(uint16_t));
+
+    while (pos + ZRAM_MIN_MATCH <= in_len) {
+        size_t hash = zram_hash(in + pos);
+        size_t cand = table[hash];
+        table[hash] = pos;
+        if (cand >= pos || pos - cand > ZRAM_MAX_OFFSET || zram_load32(in + cand) != zram_load32(in + pos)) {
+            pos++;
+            continue;
+        }
+
+        // Extend the match as far as it goes.
+        size_t match_len = ZRAM_MIN_MATCH;
+        while (pos + match_len < in_len && in[cand + match_len] == in[pos + match_len]) {
+            match_len++;
+        }
+        if (!zram_put_sequence(out, out_cap, &out_pos, in + anchor, pos - anchor, pos - cand, match_len)) {
+            return 0;
+        }
+        pos   += match_len;
+        anchor = pos;
+    }
+
+    if (!zram_put_sequence(out, out_cap, &out_pos, in + anchor, in_len - anchor, 0, 0)) {
+        return 0;
+    }
+    return out_pos;
+}
+
+// Read the extra bytes of a sequence length that did not fit in its nibble.
+// Returns false if the input ends early.
+static bool zram_get_length(uint8_t const *in, size_t in_len, size_t *in_pos, size_t *len) {
+    if (*len < ZRAM_NIBBLE_MAX) {
+        return true;
+    }
+    while (*in_pos < in_len) {
+        uint8_t byte = in[(*in_pos)++];
+        *len        += byte;
+        if (byte < 255) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decompress a stream made by `zram_compress`.
+// Returns false if the stream is malformed or does not decompress to exactly `out_len` bytes.
+static bool zram_decompress(uint8_t const *in, size_t in_len, uint8_t *out, size_t out_len) {
+    size_t in_pos  = 0;
+    size_t out_pos = 0;
+
+    while (in_pos < in_len) {
+        uint8_t token   = in[in_pos++];
+        size_t  lit_len = token >> 4;
+        if (!zram_get_length(in, in_len, &in_pos, &lit_len) || in_len - in_pos < lit_len
+            || out_len - out_pos < lit_len) {
+            return false;
+        }
+        mem_copy(out + out_pos, in + in_pos, lit_len);
+        in_pos  += lit_len;
+        out_pos += lit_len;
+        if (in_pos == in_len) {
+            break;
+        }
+
+        if (in_len - in_pos < 2) {
+            return false;
+        }
+        size_t offset    = in[in_pos] | (in[in_pos + 1] << 8);
+        size_t match_len = token & ZRAM_NIBBLE_MAX;
+        in_pos          += 2;
+        if (!zram_get_length(in, in_len, &in_pos, &match_len)) {
+            return false;
+        }
+        match_len += ZRAM_MIN_MATCH;
+        if (!offset || offset > out_pos || out_len - out_pos < match_len) {
+            return false;
+        }
+        // Matches may overlap their own output, so copy byte by byte.
+        for (size_t i = 0; i < match_len; i++, out_pos++) {
+            out[out_pos] = out[out_pos - offset];
+        }
+    }
+
+    return out_pos == out_len;
+}
+
+// Check whether a block consists of a single repeated word.
+static bool zram_same_filled(uint8_t const *data, size_t len, size_t *pattern) {
+    for (size_t i = sizeof(size_t); i < len; i++) {
+        if (data[i] != data[i - sizeof(size_t)]) {
+            return false;
+        }
+    }
+    mem_copy(pattern, data, sizeof(size_t));
+    return true;
+}
+
+// Free the storage of a block and make it filled with a word.
+static void zram_set_pattern(blkdev_zram_t *zram, blksize_t block, size_t pattern) {
+    zram_slot_t *slot = &zram->slots[block];
+    if (slot->data) {
+        atomic_fetch_sub(&zram->stored, slot->len);
+        free(slot->data);
+    }
+    slot->data    = NULL;
+    slot->len     = 0;
+    slot->pattern = pattern;
+}
+
+
+
+static void blkdev_zram_destroy(blkdev_t *dev) {
+    blkdev_zram_t *zram   = blkdev_impl_get_cookie(dev);
+    blksize_t      blocks = blkdev_get_size(dev);
+    for (blksize_t i = 0; i < blocks; i++) {
+        free(zram->slots[i].data);
+    }
+    free(zram->slots);
+    free(zram->scratch);
+    free(zram->table);
+    free(zram);
+}
+
+static void blkdev_zram_nop(badge_err_t *ec, blkdev_t *dev) {
+    (void)dev;
+    badge_err_set_ok(ec);
+}
+
+static bool blkdev_zram_is_erased(badge_err_t *ec, blkdev_t *dev, blksize_t block) {
+    blkdev_zram_t const *zram = blkdev_impl_get_cookie(dev);
+    zram_slot_t const   *slot = &zram->slots[block];
+    badge_err_set_ok(ec);
+    // Erased blocks read as all ones, like flash.
+    return !slot->data && slot->pattern == SIZE_MAX;
+}
+
+static void blkdev_zram_erase(badge_err_t *ec, blkdev_t *dev, blksize_t block) {
+    zram_set_pattern(blkdev_impl_get_cookie(dev), block, SIZE_MAX);
+    badge_err_set_ok(ec);
+}
+
+static void blkdev_zram_write(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t const *writebuf) {
+    blkdev_zram_t *zram       = blkdev_impl_get_cookie(dev);
+    blksize_t      block_size = blkdev_get_block_size(dev);
+
+    // Same-filled blocks need no storage at all.
+    size_t pattern;
+    if (zram_same_filled(writebuf, block_size, &pattern)) {
+        zram_set_pattern(zram, block, pattern);
+        badge_err_set_ok(ec);
+        return;
+    }
+
+    // Store the block raw if compressing it doesn't save anything.
+    uint8_t const *src = zram->scratch;
+    size_t         len = zram_compress(zram->table, writebuf, block_size, zram->scratch, block_size - 1);
+    if (!len) {
+        src = writebuf;
+        len = block_size;
+    }
+
+    // On allocation failure, the old contents of the block are kept.
+    uint8_t *data = malloc(len);
+    if (!data) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
+        return;
+    }
+    mem_copy(data, src, len);
+    zram_set_pattern(zram, block, 0);
+    zram->slots[block].data = data;
+    zram->slots[block].len  = len;
+    atomic_fetch_add(&zram->stored, len);
+    badge_err_set_ok(ec);
+}
+
+static void blkdev_zram_read(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t *readbuf) {
+    blkdev_zram_t const *zram       = blkdev_impl_get_cookie(dev);
+    blksize_t            block_size = blkdev_get_block_size(dev);
+    zram_slot_t const   *slot       = &zram->slots[block];
+
+    if (!slot->data) {
+        for (blksize_t i = 0; i < block_size; i += sizeof(size_t)) {
+            mem_copy(readbuf + i, &slot->pattern, sizeof(size_t));
+        }
+    } else if (slot->len == block_size) {
+        mem_copy(readbuf, slot->data, block_size);
+    } else if (!zram_decompress(slot->data, slot->len, readbuf, block_size)) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_FORMAT);
+        return;
+    }
+    badge_err_set_ok(ec);
+}
+
+static void blkdev_zram_erase_range(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count) {
+    blkdev_zram_t *zram = blkdev_impl_get_cookie(dev);
+    for (blksize_t i = 0; i < count; i++) {
+        zram_set_pattern(zram, block + i, SIZE_MAX);
+    }
+    badge_err_set_ok(ec);
+}
+
+static void blkdev_zram_discard(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count) {
+    blkdev_zram_t *zram = blkdev_impl_get_cookie(dev);
+    for (blksize_t i = 0; i < count; i++) {
+        zram_set_pattern(zram, block + i, 0);
+    }
+    badge_err_set_ok(ec);
+}
+
+static blkdev_vtable_t const blkdev_zram_vtable = {
+    .destroy       = blkdev_zram_destroy,
+    .open          = blkdev_zram_nop,
+    .close         = blkdev_zram_nop,
+    .is_erased     = blkdev_zram_is_erased,
+    .erase         = blkdev_zram_erase,
+    .write         = blkdev_zram_write,
+    .read          = blkdev_zram_read,
+    .write_partial = blkdev_write_partial_fallback,
+    .read_partial  = blkdev_read_partial_fallback,
+    .erase_range   = blkdev_zram_erase_range,
+    .discard       = blkdev_zram_discard,
+};
+
+
+// Create a new compressed RAM block device; all blocks start out zero-filled.
+// The block size must be a multiple of the word size and at most `BLKDEV_ZRAM_MAX_BLOCK_SIZE`.
+blkdev_t *blkdev_zram_create(badge_err_t *ec, size_t block_count, size_t block_size) {
+    if (!block_size || block_size % sizeof(size_t) || block_size > BLKDEV_ZRAM_MAX_BLOCK_SIZE) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
+        return NULL;
+    }
+
+    // Zero-initialized slots are zero-filled blocks.
+    blkdev_zram_t *zram = calloc(1, sizeof(blkdev_zram_t));
+    if (zram) {
+        zram->slots   = calloc(block_count, sizeof(zram_slot_t));
+        zram->scratch = malloc(block_size);
+        zram->table   = malloc(ZRAM_HASH_SIZE * sizeof(uint16_t));
+    }
+    if (!zram || !zram->slots || !zram->scratch || !zram->table) {
+        if (zram) {
+            free(zram->slots);
+            free(zram->scratch);
+            free(zram->table);
+        }
+        free(zram);
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
+        return NULL;
+    }
+
+    blkdev_t *handle = blkdev_impl_create(ec, &blkdev_zram_vtable, zram);
+    if (!handle) {
+        free(zram->slots);
+        free(zram->scratch);
+        free(zram->table);
+        free(zram);
+        return NULL;
+    }
+    blkdev_impl_set_block_size(handle, block_size);
+    blkdev_impl_set_size(handle, block_count);
+    return handle;
+}
+
+// Get the number of bytes of memory used to store the blocks of a compressed RAM block device.
+size_t blkdev_zram_get_stored(blkdev_t const *dev) {
+    blkdev_zram_t const *zram = blkdev_impl_get_cookie(dev);
+    return atomic_load(&zram->stored);
+}
@@ -9,8 +9,12 @@
 #include "blockdevice/blkdev_internal.h"
 #include "log.h"
 #include "malloc.h"
+#include "scheduler/scheduler.h"
 
-// TODO: Integrate mutexes to prevent race conditions.
+
+// Add to one of the I/O statistics counters of a device.
+#define blkdev_count(dev, counter, amount)                                                                             \
+    atomic_fetch_add_explicit(&(dev)->stats.counter, (amount), memory_order_relaxed)
 
 
 
@@ -20,67 +24,178 @@ static bool blkdev_is_dirty(blkdev_flags_t flags) {
     return flags.present && (flags.erase || flags.dirty);
 }
 
-// Flush a cache entry.
+// Hash bucket of a block index.
+static inline size_t blkdev_hash(blkdev_cache_t const *cache, blksize_t block) __attribute__((pure));
+static inline size_t blkdev_hash(blkdev_cache_t const *cache, blksize_t block) {
+    uint64_t hash = block * 0x9e3779b97f4a7c15ull;
+    return (size_t)(hash >> 32) & (cache->bucket_count - 1);
+}
+
+// Remove an entry from the LRU list.
+static void blkdev_lru_unlink(blkdev_cache_t *cache, ptrdiff_t i) {
+    blkdev_flags_t *flags = cache->block_flags;
+    if (flags[i].lru_prev >= 0) {
+        flags[flags[i].lru_prev].lru_next = flags[i].lru_next;
+    } else {
+        cache->lru_head = flags[i].lru_next;
+    }
+    if (flags[i].lru_next >= 0) {
+        flags[flags[i].lru_next].lru_prev = flags[i].lru_prev;
+    } else {
+        cache->lru_tail = flags[i].lru_prev;
+    }
+}
+
+// Insert an entry at the most recently used end of the LRU list.
+static void blkdev_lru_push_head(blkdev_cache_t *cache, ptrdiff_t i) {
+    blkdev_flags_t *flags = cache->block_flags;
+    flags[i].lru_prev     = -1;
+    flags[i].lru_next     = cache->lru_head;
+    if (cache->lru_head >= 0) {
+        flags[cache->lru_head].lru_prev = i;
+    } else {
+        cache->lru_tail = i;
+    }
+    cache->lru_head = i;
+}
+
+// Insert an entry at the least recently used end of the LRU list.
+static void blkdev_lru_push_tail(blkdev_cache_t *cache, ptrdiff_t i) {
+    blkdev_flags_t *flags = cache->block_flags;
+    flags[i].lru_next     = -1;
+    flags[i].lru_prev     = cache->lru_tail;
+    if (cache->lru_tail >= 0) {
+        flags[cache->lru_tail].lru_next = i;
+    } else {
+        cache->lru_head = i;
+    }
+    cache->lru_tail = i;
+}
+
+// Mark a cache entry as used.
+// Only needs `dev->mtx` held shared; the entry is moved to the front of the LRU list when it is next passed over for
+// replacement.
+static void blkdev_touch_cache(blkdev_t *dev, ptrdiff_t i) {
+    atomic_store_explicit(&dev->cache->block_flags[i].referenced, true, memory_order_relaxed);
+}
+
+// Discard a cache entry without writing it back and make it the first to be reused.
+static void blkdev_invalidate_cache(blkdev_t *dev, ptrdiff_t i) {
+    blkdev_cache_t *cache = dev->cache;
+    blkdev_flags_t *flags = cache->block_flags;
+    if (!flags[i].present) {
+        return;
+    }
+
+    // Remove from the hash chain.
+    ptrdiff_t *cur = &cache->buckets[blkdev_hash(cache, flags[i].index)];
+    while (*cur != i) {
+        cur = &flags[*cur].hash_next;
+    }
+    *cur = flags[i].hash_next;
+
+    flags[i].present = false;
+    flags[i].dirty   = false;
+    flags[i].erase   = false;
+    blkdev_lru_unlink(cache, i);
+    blkdev_lru_push_tail(cache, i);
+}
+
+// Write back or erase a dirty cache entry.
+// Must be called with `dev->mtx` held exclusively; it is dropped during the transfer while the entry is busy.
+// If the transfer fails, the entry stays dirty.
 static void blkdev_flush_cache(badge_err_t *ec, blkdev_t *dev, size_t i) {
-    uint8_t        *cache = dev->cache->block_cache;
-    blkdev_flags_t *flags = dev->cache->block_flags;
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    blkdev_cache_t *cache = dev->cache;
+    blkdev_flags_t *flags = cache->block_flags;
 
-    // Clear dirty flags before operation for concurrency.
-    bool dirty     = flags[i].dirty;
-    bool erase     = flags[i].erase;
-    flags[i].dirty = false;
-    flags[i].erase = false;
+    bool dirty = flags[i].dirty;
+    bool erase = flags[i].erase;
+    if (!dirty && !erase) {
+        badge_err_set_ok(ec);
+        return;
+    }
+
+    // Clear dirty flags before the transfer; writers wait until the entry is no longer busy.
+    blksize_t block = flags[i].index;
+    flags[i].dirty  = false;
+    flags[i].erase  = false;
+    flags[i].busy   = true;
+    mutex_release(NULL, &dev->mtx);
 
     if (dirty) {
-        // Only keep the entry if read caching is enabled.
-        flags[i].present = dev->cache_read;
-        if (dev->cache_read) {
-            flags[i].update_time = time_us();
-        }
-        blkdev_write_raw(ec, dev, flags[i].index, cache + (i * dev->block_size));
-    } else if (erase) {
-        // If it is erased, discard the cache entry.
-        flags[i].present = false;
-        blkdev_erase_raw(ec, dev, flags[i].index);
+        blkdev_write_raw(ec, dev, block, cache->block_cache + (i * dev->block_size));
+    } else {
+        blkdev_erase_raw(ec, dev, block);
+    }
+    blkdev_count(dev, writebacks, 1);
+    blkdev_count(dev, blocks_written_back, 1);
+
+    assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    flags[i].busy = false;
+    if (!badge_err_is_ok(ec)) {
+        flags[i].dirty = dirty;
+        flags[i].erase = erase;
+    } else if (!dirty || !dev->cache_read) {
+        // Erased entries are discarded, written ones are only kept if read caching is enabled.
+        blkdev_invalidate_cache(dev, (ptrdiff_t)i);
+    } else {
+        flags[i].update_time = time_us();
     }
 }
 
-// Find an empty cache entry.
-// Returns -1 when not found.
-static inline ptrdiff_t blkdev_alloc_cache(blkdev_t *dev, blksize_t block) __attribute__((pure));
-static inline ptrdiff_t blkdev_alloc_cache(blkdev_t *dev, blksize_t block) {
+// Claim the least recently used cache entry for a block that is not yet cached.
+// Recently referenced entries get a second chance and busy entries are skipped.
+// A dirty entry is written back before it is reused, which drops `dev->mtx` meanwhile.
+// The new entry is present, clean and most recently used.
+// Must be called with `dev->mtx` held exclusively.
+// Returns -1 if uncached, if every entry is busy or if writing back the old entry failed.
+// Returns -2 if an old entry was written back, after which the caller must look up the block again.
+static ptrdiff_t blkdev_alloc_cache(blkdev_t *dev, blksize_t block) {
     if (!dev->cache)
         return -1;
 
-    blkdev_flags_t *flags = dev->cache->block_flags;
-
-    timestamp_us_t oldest_read_time  = time_us() - BLKDEV_READ_CACHE_TIMEOUT;
-    ptrdiff_t      oldest_read_index = -1;
-
-    for (ptrdiff_t i = 0; i < (ptrdiff_t)dev->cache->cache_depth; i++) {
-        if (flags[i].present && flags[i].index == block) {
-            // Cache entry for this block found.
-            return i;
-        } else if (!flags[i].present) {
-            // Vacant cache entry found.
-            oldest_read_time  = 0;
-            oldest_read_index = i;
-        } else if (!blkdev_is_dirty(flags[i]) && oldest_read_time > flags[i].update_time) {
-            // Sufficiently old read cache entry found.
-            oldest_read_time  = flags[i].update_time;
-            oldest_read_index = i;
+    blkdev_cache_t *cache = dev->cache;
+    blkdev_flags_t *flags = cache->block_flags;
+
+    // Each entry is passed over at most twice; once to clear its reference and once more to be picked.
+    ptrdiff_t i = -1;
+    for (size_t tries = 0; tries < 2 * cache->cache_depth; tries++) {
+        ptrdiff_t cur = cache->lru_tail;
+        blkdev_lru_unlink(cache, cur);
+        blkdev_lru_push_head(cache, cur);
+        if (!flags[cur].busy && !atomic_exchange_explicit(&flags[cur].referenced, false, memory_order_relaxed)) {
+            i = cur;
+            break;
         }
     }
-
-    if (oldest_read_index >= 0) {
-        // Only the oldest read cache entry is replaced.
-        return oldest_read_index;
+    if (i < 0) {
+        return -1;
     }
 
-    return -1;
+    if (blkdev_is_dirty(flags[i])) {
+        badge_err_t ec;
+        blkdev_flush_cache(&ec, dev, i);
+        return badge_err_is_ok(&ec) ? -2 : -1;
+    }
+    blkdev_invalidate_cache(dev, i);
+
+    size_t bucket          = blkdev_hash(cache, block);
+    flags[i].index         = block;
+    flags[i].update_time   = time_us();
+    flags[i].present       = true;
+    flags[i].hash_next     = cache->buckets[bucket];
+    cache->buckets[bucket] = i;
+    blkdev_lru_unlink(cache, i);
+    blkdev_lru_push_head(cache, i);
+
+    return i;
 }
 
 // Find the cache entry for a certain block.
+// Must be called with `dev->mtx` held.
 // Returns -1 when not found.
 static inline ptrdiff_t blkdev_find_cache(blkdev_t *dev, blksize_t block) __attribute__((pure));
 static inline ptrdiff_t blkdev_find_cache(blkdev_t *dev, blksize_t block) {
@@ -89,19 +204,537 @@ static inline ptrdiff_t blkdev_find_cache(blkdev_t *dev, blksize_t block) {
 
     blkdev_flags_t *flags = dev->cache->block_flags;
 
-    for (ptrdiff_t i = 0; i < (ptrdiff_t)dev->cache->cache_depth; i++) {
-        if (flags[i].present && flags[i].index == block) {
+    ptrdiff_t i = dev->cache->buckets[blkdev_hash(dev->cache, block)];
+    while (i >= 0 && flags[i].index != block) {
+        i = flags[i].hash_next;
+    }
+
+    return i;
+}
+
+
+
+// Find the cache entry for a block, waiting for I/O in progress on it to finish.
+// Must be called with `dev->mtx` held (shared if `shared`); it is dropped while waiting.
+// Returns -1 when not found.
+static ptrdiff_t blkdev_find_idle_cache(blkdev_t *dev, blksize_t block, bool shared) {
+    while (true) {
+        ptrdiff_t i = blkdev_find_cache(dev, block);
+        if (i < 0 || !dev->cache->block_flags[i].busy) {
             return i;
         }
+        if (shared) {
+            mutex_release_shared(NULL, &dev->mtx);
+            thread_yield();
+            assert_always(mutex_acquire_shared(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+        } else {
+            mutex_release(NULL, &dev->mtx);
+            thread_yield();
+            assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+        }
     }
+}
 
-    return -1;
+// Wait until a cache entry is not busy.
+// Must be called with `dev->mtx` held exclusively; it is dropped while waiting.
+// Returns false if the cache was deleted or replaced in the meantime.
+static bool blkdev_wait_idle(blkdev_t *dev, blkdev_cache_t *cache, size_t i) {
+    while (dev->cache == cache && cache->block_flags[i].busy) {
+        mutex_release(NULL, &dev->mtx);
+        thread_yield();
+        assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    }
+    return dev->cache == cache;
 }
 
+// Get the cache entry for a block, allocating one if it isn't cached.
+// If `load` is true, a new entry is read from the device without holding `dev->mtx` while the entry is busy.
+// Must be called with `dev->mtx` held exclusively, which is held again on return.
+// Returns -1 if the block cannot be cached, or with an error if loading it failed.
+static ptrdiff_t blkdev_get_cache(badge_err_t *ec, blkdev_t *dev, blksize_t block, bool load) {
+    badge_err_set_ok(ec);
+    // A lookup retried after writing back an old entry still counts as a miss.
+    bool retry = false;
+    while (true) {
+        ptrdiff_t i = blkdev_find_idle_cache(dev, block, false);
+        if (i >= 0) {
+            if (!retry) {
+                blkdev_count(dev, cache_hits, 1);
+            }
+            blkdev_touch_cache(dev, i);
+            return i;
+        }
+        if (dev->cache && !retry) {
+            blkdev_count(dev, cache_misses, 1);
+        }
+        i = blkdev_alloc_cache(dev, block);
+        if (i == -2) {
+            // Another thread may have cached the block while an old entry was written back.
+            retry = true;
+            continue;
+        } else if (i < 0 || !load) {
+            return i;
+        }
 
+        // Load the block while other blocks can still be accessed.
+        dev->cache->block_flags[i].busy = true;
+        mutex_release(NULL, &dev->mtx);
+        blkdev_read_raw(ec, dev, block, dev->cache->block_cache + i * dev->block_size);
+        assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+        dev->cache->block_flags[i].busy = false;
+        if (!badge_err_is_ok(ec)) {
+            blkdev_invalidate_cache(dev, i);
+            return -1;
+        }
+        return i;
+    }
+}
 
-// Read a block into a single-use read cache and copy out part of it.
-// Made for block devices that don't support partial read.
+// Move an entry down a max-heap of `blkdev_wb_ent_t` ordered by block until it is in place.
+static void blkdev_wb_sift_down(blkdev_wb_ent_t *heap, size_t len, size_t i) {
+    blkdev_wb_ent_t ent = heap[i];
+    while (2 * i + 1 < len) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < len && heap[child + 1].block > heap[child].block) {
+            child++;
+        }
+        if (heap[child].block <= ent.block) {
+            break;
+        }
+        heap[i] = heap[child];
+        i       = child;
+    }
+    heap[i] = ent;
+}
+
+// Sort `blkdev_wb_ent_t` by block in-place using heapsort.
+static void blkdev_wb_sort(blkdev_wb_ent_t *ents, size_t len) {
+    for (size_t i = len / 2; i-- > 0;) {
+        blkdev_wb_sift_down(ents, len, i);
+    }
+    while (len > 1) {
+        len--;
+        blkdev_wb_ent_t tmp = ents[0];
+        ents[0]             = ents[len];
+        ents[len]           = tmp;
+        blkdev_wb_sift_down(ents, len, 0);
+    }
+}
+
+// Write back dirty cache entries in order of block.
+// Adjacent dirty blocks are written as one multi-block transfer, which is done if any of them was last synced before
+// `before`, or regardless of age if more than `BLKDEV_DIRTY_RATIO` percent of the cache is dirty.
+// Transfers are done without holding `dev->mtx` so I/O to other blocks can continue meanwhile.
+static void blkdev_writeback(badge_err_t *ec, blkdev_t *dev, timestamp_us_t before) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+    assert_always(mutex_acquire(NULL, &dev->wb_mtx, BLKDEV_MUTEX_TIMEOUT));
+    assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    if (!dev->cache) {
+        mutex_release(NULL, &dev->mtx);
+        mutex_release(NULL, &dev->wb_mtx);
+        return;
+    }
+
+    blkdev_cache_t  *cache   = dev->cache;
+    blkdev_flags_t  *flags   = cache->block_flags;
+    blkdev_wb_ent_t *sorted  = cache->writeback;
+    size_t           n_dirty = 0;
+
+    // Collect and sort the dirty entries; busy entries are being transferred and aren't dirty.
+    for (size_t i = 0; i < cache->cache_depth; i++) {
+        if (!flags[i].busy && blkdev_is_dirty(flags[i])) {
+            sorted[n_dirty++] = (blkdev_wb_ent_t){.block = flags[i].index, .slot = i};
+        }
+    }
+    blkdev_wb_sort(sorted, n_dirty);
+    bool force = n_dirty * 100 > cache->cache_depth * BLKDEV_DIRTY_RATIO;
+
+    size_t i = 0;
+    while (i < n_dirty) {
+        // Entries may have changed while a previous run was being written; skip the ones that did.
+        size_t len   = 0;
+        bool   erase = false;
+        bool   due   = force;
+        while (i + len < n_dirty && len < BLKDEV_MERGE_MAX) {
+            blkdev_wb_ent_t ent  = sorted[i + len];
+            blkdev_flags_t *flag = &flags[ent.slot];
+            if (!flag->present || flag->busy || flag->index != ent.block || !blkdev_is_dirty(*flag)) {
+                if (len) {
+                    break;
+                }
+                i++;
+                continue;
+            }
+            if (len && (flag->erase != erase || ent.block != sorted[i + len - 1].block + 1)) {
+                break;
+            }
+            erase = flag->erase;
+            due  |= flag->update_time < before;
+            len++;
+        }
+        if (!due) {
+            i += len;
+            continue;
+        }
+
+        // Clear dirty flags before the transfer; writers wait until the entries are no longer busy.
+        blkdev_iovec_t iov[BLKDEV_MERGE_MAX];
+        for (size_t j = 0; j < len; j++) {
+            size_t slot       = sorted[i + j].slot;
+            flags[slot].dirty = false;
+            flags[slot].erase = false;
+            flags[slot].busy  = true;
+            iov[j].base       = cache->block_cache + slot * dev->block_size;
+            iov[j].len        = dev->block_size;
+        }
+        mutex_release(NULL, &dev->mtx);
+
+        if (erase) {
+            blkdev_erase_range_raw(ec, dev, sorted[i].block, len);
+        } else {
+            blkdev_writev_raw(ec, dev, sorted[i].block, len, iov, len);
+        }
+        blkdev_count(dev, writebacks, 1);
+        blkdev_count(dev, blocks_written_back, len);
+
+        assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+        timestamp_us_t now = time_us();
+        for (size_t j = 0; j < len; j++) {
+            size_t slot      = sorted[i + j].slot;
+            flags[slot].busy = false;
+            if (!badge_err_is_ok(ec)) {
+                flags[slot].dirty = !erase;
+                flags[slot].erase = erase;
+            } else if (erase || !dev->cache_read) {
+                blkdev_invalidate_cache(dev, (ptrdiff_t)slot);
+            } else {
+                flags[slot].update_time = now;
+            }
+        }
+        if (!badge_err_is_ok(ec)) {
+            break;
+        }
+        i += len;
+    }
+
+    mutex_release(NULL, &dev->mtx);
+    mutex_release(NULL, &dev->wb_mtx);
+}
+
+// Write back or discard the cache entries of a range of blocks.
+// If `discard` is true, entries are dropped even if dirty because the range is about to be overwritten.
+static void blkdev_sync_range(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, bool discard) {
+    badge_err_set_ok(ec);
+    assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    blkdev_cache_t *cache = dev->cache;
+    if (!cache) {
+        mutex_release(NULL, &dev->mtx);
+        return;
+    }
+
+    if (count <= cache->cache_depth) {
+        // Look up every block in the range.
+        for (blksize_t b = block; b < block + count; b++) {
+            ptrdiff_t i = blkdev_find_idle_cache(dev, b, false);
+            if (i < 0) {
+                continue;
+            } else if (discard) {
+                blkdev_invalidate_cache(dev, i);
+            } else if (blkdev_is_dirty(dev->cache->block_flags[i])) {
+                blkdev_flush_cache(ec, dev, (size_t)i);
+                if (!badge_err_is_ok(ec))
+                    break;
+            }
+        }
+    } else {
+        // The range is larger than the cache; check every entry instead.
+        for (size_t i = 0; i < cache->cache_depth; i++) {
+            if (!blkdev_wait_idle(dev, cache, i)) {
+                break;
+            }
+            blkdev_flags_t *flags = &cache->block_flags[i];
+            if (!flags->present || flags->index < block || flags->index >= block + count) {
+                continue;
+            } else if (discard) {
+                blkdev_invalidate_cache(dev, (ptrdiff_t)i);
+            } else if (blkdev_is_dirty(*flags)) {
+                blkdev_flush_cache(ec, dev, i);
+                if (!badge_err_is_ok(ec))
+                    break;
+            }
+        }
+    }
+
+    mutex_release(NULL, &dev->mtx);
+}
+
+// Transfers part of a block for `blkdev_iov_walk`.
+typedef void (*blkdev_chunk_t)(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, size_t subblock_offset, uint8_t *buf, size_t len
+);
+
+// Split a list of buffers into pieces that each lie within one block, starting at `block`.
+static void blkdev_iov_walk(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blkdev_iovec_t const *iov, size_t iovcnt, blkdev_chunk_t chunk
+) {
+    badge_err_set_ok(ec);
+    size_t subblock_offset = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        uint8_t *buf = iov[i].base;
+        size_t   len = iov[i].len;
+        while (len) {
+            size_t max = dev->block_size - subblock_offset;
+            size_t n   = len < max ? len : max;
+            chunk(ec, dev, block, subblock_offset, buf, n);
+            if (!badge_err_is_ok(ec)) {
+                return;
+            }
+            buf             += n;
+            len             -= n;
+            subblock_offset += n;
+            if (subblock_offset == dev->block_size) {
+                block++;
+                subblock_offset = 0;
+            }
+        }
+    }
+}
+
+// Read part of a block through the cache.
+static void blkdev_chunk_read(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, size_t subblock_offset, uint8_t *buf, size_t len
+) {
+    blkdev_read_partial(ec, dev, block, subblock_offset, buf, len);
+}
+
+// Write part of a block through the cache.
+static void blkdev_chunk_write(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, size_t subblock_offset, uint8_t *buf, size_t len
+) {
+    if (len == dev->block_size) {
+        blkdev_write(ec, dev, block, buf);
+    } else {
+        blkdev_write_partial(ec, dev, block, subblock_offset, buf, len);
+    }
+}
+
+// Read part of a block from the driver; `dev->io_mtx` must be held.
+static void blkdev_chunk_read_raw(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, size_t subblock_offset, uint8_t *buf, size_t len
+) {
+    if (len == dev->block_size) {
+        dev->vtable->read(ec, dev, block, buf);
+    } else {
+        dev->vtable->read_partial(ec, dev, block, subblock_offset, buf, len);
+    }
+}
+
+// Write part of a block to the driver; `dev->io_mtx` must be held.
+static void blkdev_chunk_write_raw(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, size_t subblock_offset, uint8_t *buf, size_t len
+) {
+    if (len == dev->block_size) {
+        dev->vtable->write(ec, dev, block, buf);
+    } else {
+        dev->vtable->write_partial(ec, dev, block, subblock_offset, buf, len);
+    }
+}
+
+// Count the blocks covered by a list of buffers starting at `block`.
+// Returns false if they are not a whole number of blocks or do not fit in the device.
+static bool blkdev_iov_count(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blkdev_iovec_t const *iov, size_t iovcnt, blksize_t *count_out
+) {
+    size_t total = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        total += iov[i].len;
+    }
+    if (total % dev->block_size) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
+        return false;
+    }
+    blksize_t count = total / dev->block_size;
+    if (block > dev->blocks || count > dev->blocks - block) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_RANGE);
+        return false;
+    }
+    *count_out = count;
+    return true;
+}
+
+
+
+// Take the driver lock and start timing a driver call.
+static timestamp_us_t blkdev_io_begin(blkdev_t *dev) {
+    assert_always(mutex_acquire(NULL, &dev->io_mtx, BLKDEV_MUTEX_TIMEOUT));
+    return time_us();
+}
+
+// Record the latency of a driver call and release the driver lock.
+static void blkdev_io_end(blkdev_t *dev, timestamp_us_t start) {
+    timestamp_us_t latency = time_us() - start;
+    size_t         bucket  = 0;
+    while (bucket < BLKDEV_LATENCY_BUCKETS - 1 && latency >= ((timestamp_us_t)1 << bucket)) {
+        bucket++;
+    }
+    blkdev_count(dev, driver_calls, 1);
+    blkdev_count(dev, latency[bucket], 1);
+    mutex_release(NULL, &dev->io_mtx);
+}
+
+// Get a bit from one of the erase bitmaps.
+static inline bool blkdev_bit_get(size_t const *map, blksize_t block) {
+    return (map[block / BLKDEV_MAP_BITS] >> (block % BLKDEV_MAP_BITS)) & 1;
+}
+
+// Set a bit in one of the erase bitmaps.
+static inline void blkdev_bit_set(size_t *map, blksize_t block, bool value) {
+    size_t mask = (size_t)1 << (block % BLKDEV_MAP_BITS);
+    if (value) {
+        map[block / BLKDEV_MAP_BITS] |= mask;
+    } else {
+        map[block / BLKDEV_MAP_BITS] &= ~mask;
+    }
+}
+
+// Test whether a block is known to be erased; `dev->io_mtx` must be held.
+static bool blkdev_known_erased(blkdev_t *dev, blksize_t block) {
+    return dev->erase_known && blkdev_bit_get(dev->erase_known, block) && blkdev_bit_get(dev->erased, block);
+}
+
+// Record the erased state of blocks after a driver call and clear their discard hints; `dev->io_mtx` must be held.
+// If `known` is false the state is forgotten, e.g. because the blocks were written; only the driver can tell whether
+// a written block still counts as erased.
+static void blkdev_mark_erased(blkdev_t *dev, blksize_t block, blksize_t count, bool known, bool erased) {
+    if (!dev->erase_known) {
+        return;
+    }
+    for (blksize_t i = block; i < block + count; i++) {
+        blkdev_bit_set(dev->erase_known, i, known);
+        blkdev_bit_set(dev->erased, i, erased);
+        blkdev_bit_set(dev->discarded, i, false);
+    }
+}
+
+// Erase blocks through the driver and record that they are erased; `dev->io_mtx` must be held.
+static void blkdev_erase_run(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count) {
+    if (dev->vtable->erase_range) {
+        dev->vtable->erase_range(ec, dev, block, count);
+    } else {
+        badge_err_set_ok(ec);
+        for (blksize_t i = 0; i < count && badge_err_is_ok(ec); i++) {
+            dev->vtable->erase(ec, dev, block + i);
+        }
+    }
+    bool ok = badge_err_is_ok(ec);
+    blkdev_mark_erased(dev, block, count, ok, ok);
+}
+
+// Erase the blocks hinted as discarded in the background.
+static void blkdev_erase_discarded(badge_err_t *ec, blkdev_t *dev) {
+    badge_err_set_ok(ec);
+    if (!dev->discarded) {
+        return;
+    }
+
+    timestamp_us_t io_start = blkdev_io_begin(dev);
+    blksize_t      block    = 0;
+    while (block < dev->blocks && badge_err_is_ok(ec)) {
+        if (!dev->discarded[block / BLKDEV_MAP_BITS]) {
+            // Skip a whole word of blocks at once.
+            block = (block / BLKDEV_MAP_BITS + 1) * BLKDEV_MAP_BITS;
+            continue;
+        } else if (!blkdev_bit_get(dev->discarded, block)) {
+            block++;
+            continue;
+        }
+        blksize_t count = 1;
+        while (block + count < dev->blocks && blkdev_bit_get(dev->discarded, block + count)) {
+            count++;
+        }
+        blkdev_erase_run(ec, dev, block, count);
+        block += count;
+    }
+    blkdev_io_end(dev, io_start);
+}
+
+// Write without caching.
+void blkdev_write_raw(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t const *writebuf) {
+    timestamp_us_t io_start = blkdev_io_begin(dev);
+    dev->vtable->write(ec, dev, block, writebuf);
+    blkdev_mark_erased(dev, block, 1, false, false);
+    blkdev_io_end(dev, io_start);
+}
+
+// Read without caching.
+void blkdev_read_raw(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t *readbuf) {
+    timestamp_us_t io_start = blkdev_io_begin(dev);
+    dev->vtable->read(ec, dev, block, readbuf);
+    blkdev_io_end(dev, io_start);
+}
+
+// Erase without caching.
+void blkdev_erase_raw(badge_err_t *ec, blkdev_t *dev, blksize_t block) {
+    blkdev_erase_range_raw(ec, dev, block, 1);
+}
+
+// Read consecutive blocks without caching.
+void blkdev_readv_raw(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, blkdev_iovec_t const *iov, size_t iovcnt
+) {
+    timestamp_us_t io_start = blkdev_io_begin(dev);
+    if (dev->vtable->read_range) {
+        dev->vtable->read_range(ec, dev, block, count, iov, iovcnt);
+    } else {
+        blkdev_iov_walk(ec, dev, block, iov, iovcnt, blkdev_chunk_read_raw);
+    }
+    blkdev_io_end(dev, io_start);
+}
+
+// Write consecutive blocks without caching.
+void blkdev_writev_raw(
+    badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, blkdev_iovec_t const *iov, size_t iovcnt
+) {
+    timestamp_us_t io_start = blkdev_io_begin(dev);
+    if (dev->vtable->write_range) {
+        dev->vtable->write_range(ec, dev, block, count, iov, iovcnt);
+    } else {
+        blkdev_iov_walk(ec, dev, block, iov, iovcnt, blkdev_chunk_write_raw);
+    }
+    blkdev_mark_erased(dev, block, count, false, false);
+    blkdev_io_end(dev, io_start);
+}
+
+// Erase consecutive blocks without caching.
+// Blocks already known to be erased are skipped.
+void blkdev_erase_range_raw(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+
+    timestamp_us_t io_start = blkdev_io_begin(dev);
+    blksize_t      i        = 0;
+    while (i < count && badge_err_is_ok(ec)) {
+        if (blkdev_known_erased(dev, block + i)) {
+            i++;
+            continue;
+        }
+        blksize_t run = 1;
+        while (i + run < count && !blkdev_known_erased(dev, block + i + run)) {
+            run++;
+        }
+        blkdev_erase_run(ec, dev, block + i, run);
+        i += run;
+    }
+    blkdev_io_end(dev, io_start);
+}
+
+// Perform a read-modify-write operation for partial write.
+// Made for block devices that don't support partial write.
 void blkdev_write_partial_fallback(
     badge_err_t   *ec,
     blkdev_t      *dev,
@@ -110,52 +743,43 @@ void blkdev_write_partial_fallback(
     uint8_t const *writebuf,
     size_t         writebuf_len
 ) {
-    // Allocate temporary space to write to the device.
-    uint8_t *tmp = malloc(dev->block_size);
-    if (!tmp) {
-        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
-        return;
-    }
+    // The bounce buffer is guarded by `io_mtx`, which the caller holds.
+    assert_dev_drop(dev->bounce);
+    uint8_t *tmp = dev->bounce;
 
     // Read into the temporary buffer.
     badge_err_t ec0;
     if (!ec)
         ec = &ec0;
-    blkdev_read_raw(ec, dev, block, tmp);
+    dev->vtable->read(ec, dev, block, tmp);
     if (!badge_err_is_ok(ec)) {
-        free(tmp);
         return;
     }
 
     // Modify and write back.
     mem_copy(tmp + subblock_offset, writebuf, writebuf_len);
-    blkdev_write_raw(ec, dev, block, tmp);
-    free(tmp);
+    dev->vtable->write(ec, dev, block, tmp);
 }
 
-// Perform a read-modify-write operation for partial write.
-// Made for block devices that don't support partial write.
+// Read a block into a single-use read cache and copy out part of it.
+// Made for block devices that don't support partial read.
 void blkdev_read_partial_fallback(
     badge_err_t *ec, blkdev_t *dev, blksize_t block, size_t subblock_offset, uint8_t *readbuf, size_t readbuf_len
 ) {
-    // Allocate temporary space to read from the device.
-    uint8_t *tmp = malloc(dev->block_size);
-    if (!tmp) {
-        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
-        return;
-    }
+    // The bounce buffer is guarded by `io_mtx`, which the caller holds.
+    assert_dev_drop(dev->bounce);
+    uint8_t *tmp = dev->bounce;
+
     // Read into the temporary buffer.
     badge_err_t ec0;
     if (!ec)
         ec = &ec0;
-    blkdev_read_raw(ec, dev, block, tmp);
+    dev->vtable->read(ec, dev, block, tmp);
     if (!badge_err_is_ok(ec)) {
-        free(tmp);
         return;
     }
     // Partial copy.
     mem_copy(readbuf, tmp + subblock_offset, readbuf_len);
-    free(tmp);
 }
 
 
@@ -176,7 +800,32 @@ void blkdev_open(badge_err_t *ec, blkdev_t *dev) {
     assert_dev_drop(dev->vtable->read);
     assert_dev_drop(dev->vtable->write_partial);
     assert_dev_drop(dev->vtable->read_partial);
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
     dev->vtable->open(ec, dev);
+
+    if (!badge_err_is_ok(ec)) {
+        return;
+    }
+
+    // Allocate the bounce buffer for partial access fallbacks up front so they never allocate.
+    if (!dev->bounce) {
+        dev->bounce = malloc(dev->block_size);
+    }
+    // Allocate the erase bitmaps; all blocks start out in an unknown state.
+    if (!dev->erase_known) {
+        size_t words     = (dev->blocks + BLKDEV_MAP_BITS - 1) / BLKDEV_MAP_BITS;
+        dev->erase_known = calloc(3 * words, sizeof(size_t));
+        if (dev->erase_known) {
+            dev->erased    = dev->erase_known + words;
+            dev->discarded = dev->erase_known + 2 * words;
+        }
+    }
+    if (!dev->bounce || !dev->erase_known) {
+        dev->vtable->close(NULL, dev);
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
+    }
 }
 
 // Flush write caches and close block device.
@@ -186,6 +835,12 @@ void blkdev_close(badge_err_t *ec, blkdev_t *dev) {
         return;
     }
     dev->vtable->close(ec, dev);
+    free(dev->bounce);
+    free(dev->erase_known);
+    dev->bounce      = NULL;
+    dev->erase_known = NULL;
+    dev->erased      = NULL;
+    dev->discarded   = NULL;
 }
 
 // Get a block device's size in blocks.
@@ -225,13 +880,31 @@ bool blkdev_is_erased(badge_err_t *ec, blkdev_t *dev, blksize_t block) {
     }
 
     // Check cache before querying hardware.
-    ptrdiff_t i = blkdev_find_cache(dev, block);
+    assert_always(mutex_acquire_shared(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    ptrdiff_t i = blkdev_find_idle_cache(dev, block, true);
     if (i >= 0) {
+        bool erase = dev->cache->block_flags[i].erase;
+        mutex_release_shared(NULL, &dev->mtx);
         badge_err_set_ok(ec);
-        return dev->cache->block_flags[i].erase;
+        return erase;
     }
+    mutex_release_shared(NULL, &dev->mtx);
 
-    return dev->vtable->is_erased(ec, dev, block);
+    // Only ask the driver if the state isn't known from earlier driver calls.
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    timestamp_us_t io_start = blkdev_io_begin(dev);
+    bool           erased;
+    if (dev->erase_known && blkdev_bit_get(dev->erase_known, block)) {
+        erased = blkdev_bit_get(dev->erased, block);
+        badge_err_set_ok(ec);
+    } else {
+        erased = dev->vtable->is_erased(ec, dev, block);
+        blkdev_mark_erased(dev, block, 1, badge_err_is_ok(ec), erased);
+    }
+    blkdev_io_end(dev, io_start);
+    return erased;
 }
 
 // Explicitly erase a block, if possible.
@@ -252,87 +925,36 @@ void blkdev_erase(badge_err_t *ec, blkdev_t *dev, blksize_t block) {
         return;
     }
 
-    blkdev_flags_t *flags = dev->cache->block_flags;
+    blkdev_count(dev, erases, 1);
+    blkdev_count(dev, blocks_erased, 1);
 
     // Attempt to cache erase operation.
-    ptrdiff_t i = blkdev_alloc_cache(dev, block);
+    assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    ptrdiff_t i = blkdev_get_cache(ec, dev, block, false);
     if (i >= 0) {
-        if (flags[i].present) {
-            // Set flag in existing cache entry.
-            flags[i].erase = true;
-            flags[i].dirty = false;
-        } else {
-            // Set flag in new cache entry.
-            flags[i] = (blkdev_flags_t){
-                .update_time = time_us(),
-                .index       = block,
-                .present     = true,
-                .erase       = false,
-                .dirty       = true,
-            };
-        }
+        dev->cache->block_flags[i].erase = true;
+        dev->cache->block_flags[i].dirty = false;
+        mutex_release(NULL, &dev->mtx);
         badge_err_set_ok(ec);
 
     } else {
         // Uncached or out of free cache.
-        dev->vtable->erase(ec, dev, block);
+        mutex_release(NULL, &dev->mtx);
+        blkdev_erase_raw(ec, dev, block);
     }
 }
 
 // Erase if necessary and write a block.
-// This operation may be cached and therefor delayed.
-void blkdev_write(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t const *writebuf) {
-    if (!dev) {
-        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
-        return;
-    }
-    if (dev->readonly) {
-        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
-        return;
-    }
-
-    // Do some bounds checking.
-    if (block >= dev->blocks) {
-        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_RANGE);
-        return;
-    }
-
-    uint8_t        *cache = dev->cache->block_cache;
-    blkdev_flags_t *flags = dev->cache->block_flags;
-
-    // Attempt to cache write operation.
-    ptrdiff_t i = blkdev_alloc_cache(dev, block);
-    if (i >= 0) {
-        if (flags[i].present) {
-            // Set flag in existing cache entry.
-            flags[i].erase = false;
-            flags[i].dirty = true;
-        } else {
-            // Set flag in new cache entry.
-            flags[i] = (blkdev_flags_t){
-                .update_time = time_us(),
-                .index       = block,
-                .present     = true,
-                .erase       = false,
-                .dirty       = true,
-            };
-        }
-        mem_copy(cache + i * dev->block_size, writebuf, dev->block_size);
-        badge_err_set_ok(ec);
-
-    } else {
-        // Uncached or out of free cache.
-        dev->vtable->write(ec, dev, block, writebuf);
-    }
-}
-
-// Read a block.
-// This operation may be cached.
-void blkdev_read(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t *readbuf) {
+// This operation may be cached and therefor delayed.
+void blkdev_write(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t const *writebuf) {
     if (!dev) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
         return;
     }
+    if (dev->readonly) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
+        return;
+    }
 
     // Do some bounds checking.
     if (block >= dev->blocks) {
@@ -340,47 +962,32 @@ void blkdev_read(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t *readb
         return;
     }
 
-    uint8_t        *cache = dev->cache->block_cache;
-    blkdev_flags_t *flags = dev->cache->block_flags;
+    blkdev_count(dev, writes, 1);
+    blkdev_count(dev, blocks_written, 1);
 
-    // Look for the entry in the cache.
-    ptrdiff_t i = blkdev_alloc_cache(dev, block);
-    if (i >= 0 && flags[i].present) {
-        // Existing cache entry.
-        if (flags[i].erase) {
-            mem_set(readbuf, 255, dev->block_size);
-        } else {
-            if (!flags[i].dirty) {
-                flags[i].update_time = time_us();
-            }
-            mem_copy(readbuf, cache + i * dev->block_size, dev->block_size);
-        }
+    // Attempt to cache write operation.
+    assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    ptrdiff_t i = blkdev_get_cache(ec, dev, block, false);
+    if (i >= 0) {
+        dev->cache->block_flags[i].erase = false;
+        dev->cache->block_flags[i].dirty = true;
+        mem_copy(dev->cache->block_cache + i * dev->block_size, writebuf, dev->block_size);
+        mutex_release(NULL, &dev->mtx);
         badge_err_set_ok(ec);
 
-    } else if (i >= 0 && dev->cache_read) {
-        // Read caching is enabled.
-        badge_err_t ec0;
-        if (!ec)
-            ec = &ec0;
-        dev->vtable->read(ec, dev, block, cache + i * dev->block_size);
-
-        flags[i] = (blkdev_flags_t){
-            .update_time = time_us(),
-            .index       = block,
-            .present     = true,
-            .erase       = false,
-            .dirty       = false,
-        };
-
-        if (!badge_err_is_ok(ec))
-            return;
-        mem_copy(readbuf, cache + i * dev->block_size, dev->block_size);
     } else {
         // Uncached or out of free cache.
-        dev->vtable->read(ec, dev, block, readbuf);
+        mutex_release(NULL, &dev->mtx);
+        blkdev_write_raw(ec, dev, block, writebuf);
     }
 }
 
+// Read a block.
+// This operation may be cached.
+void blkdev_read(badge_err_t *ec, blkdev_t *dev, blksize_t block, uint8_t *readbuf) {
+    blkdev_read_partial(ec, dev, block, 0, readbuf, dev ? dev->block_size : 0);
+}
+
 // Partially write a block.
 // This is very likely to cause a read-modify-write operation.
 void blkdev_write_partial(
@@ -415,32 +1022,36 @@ void blkdev_write_partial(
         return;
     }
 
-    uint8_t        *cache = dev->cache->block_cache;
-    blkdev_flags_t *flags = dev->cache->block_flags;
+    blkdev_count(dev, writes, 1);
+    blkdev_count(dev, blocks_written, 1);
 
-    // Attempt to cache write operation.
-    ptrdiff_t i = blkdev_alloc_cache(dev, block);
+    // Attempt to cache write operation; a new entry needs the rest of the block before it can be written back whole.
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    ptrdiff_t i = blkdev_get_cache(ec, dev, block, true);
+    if (!badge_err_is_ok(ec)) {
+        mutex_release(NULL, &dev->mtx);
+        return;
+    }
     if (i >= 0) {
-        if (flags[i].present) {
-            // Set flag in existing cache entry.
-            flags[i].erase = false;
-            flags[i].dirty = true;
-        } else {
-            // Set flag in new cache entry.
-            flags[i] = (blkdev_flags_t){
-                .update_time = time_us(),
-                .index       = block,
-                .present     = true,
-                .erase       = false,
-                .dirty       = true,
-            };
-        }
-        mem_copy(cache + i * dev->block_size + subblock_offset, writebuf, writebuf_len);
-        badge_err_set_ok(ec);
+        if (dev->cache->block_flags[i].erase) {
+            // The rest of an erased block reads as all ones.
+            mem_set(dev->cache->block_cache + i * dev->block_size, 255, dev->block_size);
+        }
+        dev->cache->block_flags[i].erase = false;
+        dev->cache->block_flags[i].dirty = true;
+        mem_copy(dev->cache->block_cache + i * dev->block_size + subblock_offset, writebuf, writebuf_len);
+        mutex_release(NULL, &dev->mtx);
 
     } else {
         // Uncached or out of free cache.
+        mutex_release(NULL, &dev->mtx);
+        timestamp_us_t io_start = blkdev_io_begin(dev);
         dev->vtable->write_partial(ec, dev, block, subblock_offset, writebuf, writebuf_len);
+        blkdev_mark_erased(dev, block, 1, false, false);
+        blkdev_io_end(dev, io_start);
     }
 }
 
@@ -469,51 +1080,96 @@ void blkdev_read_partial(
         return;
     }
 
-    uint8_t        *cache = dev->cache->block_cache;
-    blkdev_flags_t *flags = dev->cache->block_flags;
+    blkdev_count(dev, reads, 1);
+    blkdev_count(dev, blocks_read, 1);
 
-    // Look for the entry in the cache.
-    ptrdiff_t i = blkdev_alloc_cache(dev, block);
-    if (i >= 0 && flags[i].present) {
-        // Existing cache entry.
-        if (flags[i].erase) {
-            mem_set(readbuf, 255, dev->block_size);
+    // Cache hits only need the lock shared.
+    assert_always(mutex_acquire_shared(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    ptrdiff_t i = blkdev_find_idle_cache(dev, block, true);
+    if (i >= 0) {
+        blkdev_count(dev, cache_hits, 1);
+        blkdev_touch_cache(dev, i);
+        if (dev->cache->block_flags[i].erase) {
+            mem_set(readbuf, 255, readbuf_len);
         } else {
-            if (!flags[i].dirty) {
-                flags[i].update_time = time_us();
-            }
-            mem_copy(readbuf, cache + i * dev->block_size + subblock_offset, readbuf_len);
+            mem_copy(readbuf, dev->cache->block_cache + i * dev->block_size + subblock_offset, readbuf_len);
         }
+        mutex_release_shared(NULL, &dev->mtx);
         badge_err_set_ok(ec);
+        return;
+    }
+    mutex_release_shared(NULL, &dev->mtx);
 
-    } else if (i >= 0 && dev->cache_read) {
-        // Read caching is enabled.
+    if (dev->cache && (!dev->cache_read || dev->vtable->direct_access)) {
+        // Devices kept in memory are read directly instead of being copied into the cache first.
+        blkdev_count(dev, cache_misses, 1);
+    } else if (dev->cache_read) {
+        // Read caching is enabled; another thread may have cached the block in the meantime.
         badge_err_t ec0;
         if (!ec)
             ec = &ec0;
-        dev->vtable->read(ec, dev, block, cache + i * dev->block_size);
-
-        flags[i] = (blkdev_flags_t){
-            .update_time = time_us(),
-            .index       = block,
-            .present     = true,
-            .erase       = false,
-            .dirty       = false,
-        };
-
-        if (!badge_err_is_ok(ec))
+        assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+        i = blkdev_get_cache(ec, dev, block, true);
+        if (i >= 0) {
+            if (dev->cache->block_flags[i].erase) {
+                mem_set(readbuf, 255, readbuf_len);
+            } else {
+                mem_copy(readbuf, dev->cache->block_cache + i * dev->block_size + subblock_offset, readbuf_len);
+            }
+        }
+        mutex_release(NULL, &dev->mtx);
+        if (i >= 0 || !badge_err_is_ok(ec)) {
             return;
-        mem_copy(readbuf, cache + i * dev->block_size + subblock_offset, readbuf_len);
+        }
+    }
+
+    // Uncached or out of free cache.
+    timestamp_us_t io_start = blkdev_io_begin(dev);
+    if (readbuf_len == dev->block_size) {
+        dev->vtable->read(ec, dev, block, readbuf);
     } else {
-        // Uncached or out of free cache.
         dev->vtable->read_partial(ec, dev, block, subblock_offset, readbuf, readbuf_len);
     }
+    blkdev_io_end(dev, io_start);
 }
 
+// Read consecutive blocks starting at `block` into a list of buffers.
+// The buffers must add up to a whole number of blocks.
+// Long ranges bypass the cache and are passed to the driver as one request.
+void blkdev_readv(badge_err_t *ec, blkdev_t *dev, blksize_t block, blkdev_iovec_t const *iov, size_t iovcnt) {
+    if (!dev) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
+        return;
+    }
+    blksize_t count;
+    if (!blkdev_iov_count(ec, dev, block, iov, iovcnt, &count)) {
+        return;
+    }
 
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (dev->cache && count < BLKDEV_BYPASS_BLOCKS) {
+        blkdev_iov_walk(ec, dev, block, iov, iovcnt, blkdev_chunk_read);
+    } else {
+        blkdev_count(dev, reads, 1);
+        blkdev_count(dev, blocks_read, count);
+        if (dev->cache) {
+            blkdev_count(dev, cache_misses, 1);
+        }
 
-// Flush the write cache to the block device.
-void blkdev_flush(badge_err_t *ec, blkdev_t *dev) {
+        // Write back cached changes to the range first so the device has the latest data.
+        blkdev_sync_range(ec, dev, block, count, false);
+        if (badge_err_is_ok(ec)) {
+            blkdev_readv_raw(ec, dev, block, count, iov, iovcnt);
+        }
+    }
+}
+
+// Erase if necessary and write consecutive blocks starting at `block` from a list of buffers.
+// The buffers must add up to a whole number of blocks.
+// Long ranges bypass the cache and are passed to the driver as one request.
+void blkdev_writev(badge_err_t *ec, blkdev_t *dev, blksize_t block, blkdev_iovec_t const *iov, size_t iovcnt) {
     if (!dev) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
         return;
@@ -522,22 +1178,292 @@ void blkdev_flush(badge_err_t *ec, blkdev_t *dev) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
         return;
     }
+    blksize_t count;
+    if (!blkdev_iov_count(ec, dev, block, iov, iovcnt, &count)) {
+        return;
+    }
 
-    blkdev_flags_t *flags = dev->cache->block_flags;
+    if (dev->cache && count < BLKDEV_BYPASS_BLOCKS) {
+        blkdev_iov_walk(ec, dev, block, iov, iovcnt, blkdev_chunk_write);
+    } else {
+        blkdev_count(dev, writes, 1);
+        blkdev_count(dev, blocks_written, count);
+        if (dev->cache) {
+            blkdev_count(dev, cache_misses, 1);
+        }
+
+        // Drop cached copies of the range both before, so pending writeback can't overwrite the new data, and after, in
+        // case a block was read back into the cache during the write.
+        blkdev_sync_range(NULL, dev, block, count, true);
+        blkdev_writev_raw(ec, dev, block, count, iov, iovcnt);
+        blkdev_sync_range(NULL, dev, block, count, true);
+    }
+}
+
+// Explicitly erase `count` consecutive blocks starting at `block`, if possible.
+// On devices which cannot erase blocks, this will do nothing.
+void blkdev_erase_range(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count) {
+    if (!dev) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
+        return;
+    }
+    if (dev->readonly) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
+        return;
+    }
+    if (block > dev->blocks || count > dev->blocks - block) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_RANGE);
+        return;
+    }
+
+    badge_err_set_ok(ec);
+    if (dev->cache && count < BLKDEV_BYPASS_BLOCKS) {
+        badge_err_t ec0;
+        if (!ec)
+            ec = &ec0;
+        for (blksize_t i = 0; i < count && badge_err_is_ok(ec); i++) {
+            blkdev_erase(ec, dev, block + i);
+        }
+    } else {
+        blkdev_count(dev, erases, 1);
+        blkdev_count(dev, blocks_erased, count);
+        if (dev->cache) {
+            blkdev_count(dev, cache_misses, 1);
+        }
+        blkdev_sync_range(NULL, dev, block, count, true);
+        blkdev_erase_range_raw(ec, dev, block, count);
+        blkdev_sync_range(NULL, dev, block, count, true);
+    }
+}
+
+// Hint that the contents of `count` consecutive blocks starting at `block` are no longer needed.
+// Cached changes to the blocks are dropped and their contents are undefined until they are written again.
+// Devices that support it are told right away; otherwise the blocks are erased later by `blkdev_housekeeping` so a
+// write to them won't need to erase first.
+void blkdev_discard(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count) {
+    if (!dev) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
+        return;
+    }
+    if (dev->readonly) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
+        return;
+    }
+    if (block > dev->blocks || count > dev->blocks - block) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_RANGE);
+        return;
+    }
+
+    blkdev_sync_range(NULL, dev, block, count, true);
+
+    timestamp_us_t io_start = blkdev_io_begin(dev);
+    if (dev->vtable->discard) {
+        dev->vtable->discard(ec, dev, block, count);
+        blkdev_mark_erased(dev, block, count, false, false);
+    } else {
+        for (blksize_t i = block; dev->discarded && i < block + count; i++) {
+            if (!blkdev_known_erased(dev, i)) {
+                blkdev_bit_set(dev->discarded, i, true);
+            }
+        }
+        badge_err_set_ok(ec);
+    }
+    blkdev_io_end(dev, io_start);
+}
+
+// Get a pointer to the memory holding `count` consecutive blocks starting at `block`, on devices kept in memory.
+// Cached changes to the blocks are written back first. If `write` is true, cached copies are dropped as well so the
+// memory may be modified directly; cached access to the same blocks after that may see stale data until the next call.
+// Returns NULL and raises `ECAUSE_UNSUPPORTED` if the device doesn't support direct access.
+void *blkdev_direct_access(badge_err_t *ec, blkdev_t *dev, blksize_t block, blksize_t count, bool write) {
+    if (!dev) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
+        return NULL;
+    }
+    if (write && dev->readonly) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
+        return NULL;
+    }
+    if (!dev->vtable->direct_access) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_UNSUPPORTED);
+        return NULL;
+    }
+
+    // Do some bounds checking.
+    if (block > dev->blocks || count > dev->blocks - block) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_RANGE);
+        return NULL;
+    }
 
+    // The memory must be up to date, and may not have cached copies if it is about to change.
     badge_err_t ec0;
     if (!ec)
         ec = &ec0;
+    blkdev_sync_range(ec, dev, block, count, false);
+    if (!badge_err_is_ok(ec)) {
+        return NULL;
+    }
+    if (write) {
+        blkdev_sync_range(NULL, dev, block, count, true);
+        // The caller is about to change the blocks, so their erased state and discard hints no longer hold.
+        assert_always(mutex_acquire(NULL, &dev->io_mtx, BLKDEV_MUTEX_TIMEOUT));
+        blkdev_mark_erased(dev, block, count, false, false);
+        mutex_release(NULL, &dev->io_mtx);
+    }
 
-    for (size_t i = 0; i < dev->cache->cache_depth; i++) {
-        if (flags[i].present && (flags[i].dirty || flags[i].erase)) {
-            blkdev_flush_cache(ec, dev, i);
-            if (ec)
-                return;
+    return dev->vtable->direct_access(ec, dev, block, count);
+}
+
+
+
+// Take the next batch of requests from the queue in elevator order.
+// Adjacent requests in the same direction are merged into the batch.
+// Returns the number of requests in `batch`.
+static size_t blkdev_queue_take(blkdev_t *dev, blkdev_req_t **batch) {
+    assert_always(mutex_acquire(NULL, &dev->queue_mtx, BLKDEV_MUTEX_TIMEOUT));
+
+    // Continue the sweep from the last position, or start over from the lowest block.
+    blkdev_req_t **link = &dev->queue;
+    while (*link && (*link)->block < dev->queue_pos) {
+        link = &(*link)->next;
+    }
+    if (!*link) {
+        link = &dev->queue;
+    }
+
+    size_t count = 0;
+    while (*link && count < BLKDEV_MERGE_MAX) {
+        blkdev_req_t *req = *link;
+        if (count && (req->write != batch[0]->write || req->block != dev->queue_pos)) {
+            break;
+        }
+        *link          = req->next;
+        batch[count++] = req;
+        dev->queue_pos = req->block + req->count;
+    }
+
+    mutex_release(NULL, &dev->queue_mtx);
+    return count;
+}
+
+// Report the result of a request.
+static void blkdev_req_finish(blkdev_req_t *req, badge_err_t ec) {
+    req->ec = ec;
+    if (req->callback) {
+        req->callback(req);
+    } else {
+        atomic_store_explicit(&req->done, true, memory_order_release);
+    }
+}
+
+// Dispatch queued requests until the queue is empty, unless another thread is already doing so.
+static void blkdev_dispatch(blkdev_t *dev) {
+    while (!atomic_exchange_explicit(&dev->dispatching, true, memory_order_acquire)) {
+        blkdev_req_t *batch[BLKDEV_MERGE_MAX];
+        size_t        count;
+        while ((count = blkdev_queue_take(dev, batch))) {
+            blkdev_iovec_t iov[BLKDEV_MERGE_MAX];
+            for (size_t i = 0; i < count; i++) {
+                iov[i].base = batch[i]->buf;
+                iov[i].len  = batch[i]->count * dev->block_size;
+            }
+
+            badge_err_t ec = {0};
+            if (batch[0]->write) {
+                blkdev_writev(&ec, dev, batch[0]->block, iov, count);
+            } else {
+                blkdev_readv(&ec, dev, batch[0]->block, iov, count);
+            }
+            for (size_t i = 0; i < count; i++) {
+                blkdev_req_finish(batch[i], ec);
+            }
+        }
+        atomic_store_explicit(&dev->dispatching, false, memory_order_release);
+
+        // A request may have been queued after the queue was found empty.
+        assert_always(mutex_acquire(NULL, &dev->queue_mtx, BLKDEV_MUTEX_TIMEOUT));
+        bool empty = !dev->queue;
+        mutex_release(NULL, &dev->queue_mtx);
+        if (empty) {
+            break;
+        }
+    }
+}
+
+// Queue an asynchronous read or write.
+// Queued requests are sorted by block and adjacent ones are merged into one transfer when dispatched.
+// Requests are dispatched by `blkdev_wait`, `blkdev_unplug`, `blkdev_flush` and `blkdev_housekeeping`.
+// Overlapping requests may be dispatched in any order.
+void blkdev_submit(badge_err_t *ec, blkdev_t *dev, blkdev_req_t *req) {
+    if (!dev || !req || !req->buf) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
+        return;
+    }
+    if (req->write && dev->readonly) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
+        return;
+    }
+
+    // Do some bounds checking.
+    if (req->block > dev->blocks || req->count > dev->blocks - req->block) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_RANGE);
+        return;
+    }
+
+    req->dev = dev;
+    atomic_store_explicit(&req->done, false, memory_order_relaxed);
+    badge_err_set_ok(ec);
+    if (!req->count) {
+        blkdev_req_finish(req, (badge_err_t){0});
+        return;
+    }
+
+    // Insert after requests for the same block to keep their order.
+    assert_always(mutex_acquire(NULL, &dev->queue_mtx, BLKDEV_MUTEX_TIMEOUT));
+    blkdev_req_t **link = &dev->queue;
+    while (*link && (*link)->block <= req->block) {
+        link = &(*link)->next;
+    }
+    req->next = *link;
+    *link     = req;
+    mutex_release(NULL, &dev->queue_mtx);
+}
+
+// Dispatch all queued requests of a device.
+void blkdev_unplug(blkdev_t *dev) {
+    if (dev) {
+        blkdev_dispatch(dev);
+    }
+}
+
+// Wait for a request without callback to finish, dispatching queued requests meanwhile.
+void blkdev_wait(blkdev_req_t *req) {
+    while (!atomic_load_explicit(&req->done, memory_order_acquire)) {
+        blkdev_dispatch(req->dev);
+        if (!atomic_load_explicit(&req->done, memory_order_acquire)) {
+            // Another thread is dispatching the request.
+            thread_yield();
         }
     }
 }
 
+
+
+// Flush the write cache to the block device.
+void blkdev_flush(badge_err_t *ec, blkdev_t *dev) {
+    if (!dev) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
+        return;
+    }
+    if (dev->readonly) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
+        return;
+    }
+
+    blkdev_dispatch(dev);
+    blkdev_writeback(ec, dev, INT64_MAX);
+}
+
 // Call this function occasionally per block device to do housekeeping.
 // Manages flushing of caches and erasure.
 void blkdev_housekeeping(badge_err_t *ec, blkdev_t *dev) {
@@ -545,31 +1471,25 @@ void blkdev_housekeeping(badge_err_t *ec, blkdev_t *dev) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
         return;
     }
-    timestamp_us_t now     = time_us();
-    timestamp_us_t timeout = now - BLKDEV_WRITE_CACHE_TIMEOUT;
-
-    blkdev_flags_t *flags = dev->cache->block_flags;
 
     badge_err_t ec0;
     if (!ec)
         ec = &ec0;
-
-    for (size_t i = 0; i < dev->cache->cache_depth; i++) {
-        if (blkdev_is_dirty(flags[i]) && flags[i].update_time < timeout) {
-            blkdev_flush_cache(ec, dev, i);
-            if (!badge_err_is_ok(ec))
-                return;
-        }
+    blkdev_dispatch(dev);
+    blkdev_writeback(ec, dev, time_us() - BLKDEV_WRITE_CACHE_TIMEOUT);
+    if (badge_err_is_ok(ec) && !dev->readonly) {
+        blkdev_erase_discarded(ec, dev);
     }
 }
 
 // Allocate a cache for a block device.
+// Lookups are hashed and replacement is least recently used, so large depths are cheap.
 void blkdev_create_cache(badge_err_t *ec, blkdev_t *dev, size_t cache_depth, bool cache_reads) {
-    if (!dev) {
+    if (!dev || !cache_depth) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
         return;
     }
-    if (dev->readonly && !dev->cache_read) {
+    if (dev->readonly && !cache_reads) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_READONLY);
         return;
     }
@@ -578,39 +1498,54 @@ void blkdev_create_cache(badge_err_t *ec, blkdev_t *dev, size_t cache_depth, boo
         badge_err_t ec0;
         if (!ec)
             ec = &ec0;
-        blkdev_flush(ec, dev);
+        blkdev_delete_cache(ec, dev);
         if (!badge_err_is_ok(ec))
             return;
     }
 
-    // Allocate cache info.
-    dev->cache = malloc(sizeof(blkdev_cache_t));
-    if (!dev->cache) {
-        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
-        return;
+    // Use about one hash bucket per entry.
+    size_t bucket_count = 1;
+    while (bucket_count < cache_depth) {
+        bucket_count <<= 1;
     }
-    dev->cache->cache_depth = cache_depth;
-    dev->cache_read         = cache_reads;
 
-    // Allocate block cache.
-    dev->cache->block_cache = malloc(dev->block_size * cache_depth);
-    if (!dev->cache->block_cache) {
+    // Allocate cache info, block cache, block flags, hash table and writeback scratch space.
+    blkdev_cache_t *cache = malloc(sizeof(blkdev_cache_t));
+    if (!cache) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
-        free(dev->cache);
-        dev->cache = NULL;
         return;
     }
-
-    // Allocate block flags.
-    dev->cache->block_flags = malloc(sizeof(blkdev_flags_t) * cache_depth);
-    if (!dev->cache->block_flags) {
+    cache->block_cache = malloc(dev->block_size * cache_depth);
+    cache->block_flags = malloc(sizeof(blkdev_flags_t) * cache_depth);
+    cache->buckets     = malloc(sizeof(ptrdiff_t) * bucket_count);
+    cache->writeback   = malloc(sizeof(blkdev_wb_ent_t) * cache_depth);
+    if (!cache->block_cache || !cache->block_flags || !cache->buckets || !cache->writeback) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_NOMEM);
-        free(dev->cache->block_cache);
-        free(dev->cache);
-        dev->cache = NULL;
+        free(cache->block_cache);
+        free(cache->block_flags);
+        free(cache->buckets);
+        free(cache->writeback);
+        free(cache);
         return;
     }
-    mem_set(dev->cache->block_flags, 0, sizeof(blkdev_flags_t) * cache_depth);
+    cache->cache_depth  = cache_depth;
+    cache->bucket_count = bucket_count;
+
+    // All entries start out vacant in the LRU list.
+    mem_set(cache->block_flags, 0, sizeof(blkdev_flags_t) * cache_depth);
+    for (size_t i = 0; i < bucket_count; i++) {
+        cache->buckets[i] = -1;
+    }
+    cache->lru_head = -1;
+    cache->lru_tail = -1;
+    for (size_t i = 0; i < cache_depth; i++) {
+        blkdev_lru_push_tail(cache, (ptrdiff_t)i);
+    }
+
+    assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+    dev->cache      = cache;
+    dev->cache_read = cache_reads;
+    mutex_release(NULL, &dev->mtx);
     badge_err_set_ok(ec);
 }
 
@@ -620,18 +1555,41 @@ void blkdev_delete_cache(badge_err_t *ec, blkdev_t *dev) {
         badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
         return;
     }
-    if (dev->cache) {
-        badge_err_t ec0 = {.cause = ECAUSE_OK};
-        if (!ec)
-            ec = &ec0;
-        blkdev_flush(ec, dev);
+
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    blkdev_cache_t *cache;
+    while (true) {
+        blkdev_writeback(ec, dev, INT64_MAX);
         if (!badge_err_is_ok(ec))
             return;
 
-        free(dev->cache->block_cache);
-        free(dev->cache->block_flags);
-        free(dev->cache);
-        dev->cache = NULL;
+        // Entries may have been written or loaded while writing back; only detach an idle, clean cache.
+        assert_always(mutex_acquire(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
+        cache     = dev->cache;
+        bool idle = true;
+        for (size_t i = 0; cache && i < cache->cache_depth; i++) {
+            if (cache->block_flags[i].busy || blkdev_is_dirty(cache->block_flags[i])) {
+                idle = false;
+                break;
+            }
+        }
+        if (idle) {
+            dev->cache = NULL;
+            mutex_release(NULL, &dev->mtx);
+            break;
+        }
+        mutex_release(NULL, &dev->mtx);
+        thread_yield();
+    }
+
+    if (cache) {
+        free(cache->block_cache);
+        free(cache->block_flags);
+        free(cache->buckets);
+        free(cache->writeback);
+        free(cache);
     }
     badge_err_set_ok(ec);
 }
@@ -646,8 +1604,12 @@ blkdev_t *blkdev_impl_create(badge_err_t *ec, blkdev_vtable_t const *vtable, voi
         return NULL;
     }
 
-    handle->vtable = vtable;
-    handle->cookie = cookie;
+    handle->vtable    = vtable;
+    handle->cookie    = cookie;
+    handle->mtx       = MUTEX_T_INIT_SHARED;
+    handle->io_mtx    = MUTEX_T_INIT;
+    handle->wb_mtx    = MUTEX_T_INIT;
+    handle->queue_mtx = MUTEX_T_INIT;
 
     badge_err_set_ok(ec);
     return handle;
@@ -675,12 +1637,62 @@ void blkdev_impl_set_block_size(blkdev_t *blkdev, blksize_t block_size) {
 
 
 
+// Get the I/O statistics of a block device.
+void blkdev_get_stats(badge_err_t *ec, blkdev_t *dev, blkdev_stats_t *stats_out) {
+    if (!dev || !stats_out) {
+        badge_err_set(ec, ELOC_BLKDEV, ECAUSE_PARAM);
+        return;
+    }
+    blkdev_counters_t *stats       = &dev->stats;
+    stats_out->reads               = atomic_load_explicit(&stats->reads, memory_order_relaxed);
+    stats_out->writes              = atomic_load_explicit(&stats->writes, memory_order_relaxed);
+    stats_out->erases              = atomic_load_explicit(&stats->erases, memory_order_relaxed);
+    stats_out->blocks_read         = atomic_load_explicit(&stats->blocks_read, memory_order_relaxed);
+    stats_out->blocks_written      = atomic_load_explicit(&stats->blocks_written, memory_order_relaxed);
+    stats_out->blocks_erased       = atomic_load_explicit(&stats->blocks_erased, memory_order_relaxed);
+    stats_out->cache_hits          = atomic_load_explicit(&stats->cache_hits, memory_order_relaxed);
+    stats_out->cache_misses        = atomic_load_explicit(&stats->cache_misses, memory_order_relaxed);
+    stats_out->writebacks          = atomic_load_explicit(&stats->writebacks, memory_order_relaxed);
+    stats_out->blocks_written_back = atomic_load_explicit(&stats->blocks_written_back, memory_order_relaxed);
+    stats_out->driver_calls        = atomic_load_explicit(&stats->driver_calls, memory_order_relaxed);
+    for (size_t i = 0; i < BLKDEV_LATENCY_BUCKETS; i++) {
+        stats_out->latency[i] = atomic_load_explicit(&stats->latency[i], memory_order_relaxed);
+    }
+    badge_err_set_ok(ec);
+}
+
+// Reset the I/O statistics of a block device to zero.
+void blkdev_reset_stats(blkdev_t *dev) {
+    if (!dev)
+        return;
+
+    blkdev_counters_t *stats = &dev->stats;
+    atomic_store_explicit(&stats->reads, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->writes, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->erases, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->blocks_read, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->blocks_written, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->blocks_erased, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->cache_hits, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->cache_misses, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->writebacks, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->blocks_written_back, 0, memory_order_relaxed);
+    atomic_store_explicit(&stats->driver_calls, 0, memory_order_relaxed);
+    for (size_t i = 0; i < BLKDEV_LATENCY_BUCKETS; i++) {
+        atomic_store_explicit(&stats->latency[i], 0, memory_order_relaxed);
+    }
+}
+
+
+
 // Show a summary of the cache entries.
 void blkdev_dump_cache(blkdev_t *dev) {
     if (!dev)
         return;
 
+    assert_always(mutex_acquire_shared(NULL, &dev->mtx, BLKDEV_MUTEX_TIMEOUT));
     if (!dev->cache) {
+        mutex_release_shared(NULL, &dev->mtx);
         logk(LOG_DEBUG, "BLKDEV: uncached");
         return;
     }
@@ -694,30 +1706,70 @@ void blkdev_dump_cache(blkdev_t *dev) {
 
     logkf(LOG_DEBUG, "BLKDEV: %{size;d} cache %{cs} used:", used, used == 1 ? "entry" : "entries");
 
-    for (size_t i = 0; i < dev->cache->cache_depth; i++) {
+    // Entries are listed from most to least recently used.
+    for (ptrdiff_t i = dev->cache->lru_head; i >= 0; i = dev->cache->block_flags[i].lru_next) {
         if (dev->cache->block_flags[i].present) {
             if (dev->cache->block_flags[i].dirty) {
                 logkf(
                     LOG_DEBUG,
                     "BLKDEV: Entry %{size;d}: block %{u32;d} write cache",
-                    i,
+                    (size_t)i,
                     dev->cache->block_flags[i].index
                 );
             } else if (dev->cache->block_flags[i].erase) {
                 logkf(
                     LOG_DEBUG,
                     "BLKDEV: Entry %{size;d}: block %{u32;d} erase cache",
-                    i,
+                    (size_t)i,
                     dev->cache->block_flags[i].index
                 );
             } else {
                 logkf(
                     LOG_DEBUG,
                     "BLKDEV: Entry %{size;d}: block %{u32;d} read  cache",
-                    i,
+                    (size_t)i,
                     dev->cache->block_flags[i].index
                 );
             }
         }
     }
+    mutex_release_shared(NULL, &dev->mtx);
+}
+
+// Show the I/O statistics.
+void blkdev_dump_stats(blkdev_t *dev) {
+    blkdev_stats_t stats;
+    blkdev_get_stats(NULL, dev, &stats);
+    if (!dev)
+        return;
+
+    logkf(
+        LOG_DEBUG,
+        "BLKDEV: %{size;d} reads (%{size;d} blocks), %{size;d} writes (%{size;d} blocks), %{size;d} erases (%{size;d} "
+        "blocks)",
+        (size_t)stats.reads,
+        (size_t)stats.blocks_read,
+        (size_t)stats.writes,
+        (size_t)stats.blocks_written,
+        (size_t)stats.erases,
+        (size_t)stats.blocks_erased
+    );
+    logkf(
+        LOG_DEBUG,
+        "BLKDEV: %{size;d} cache hits, %{size;d} misses, %{size;d} writebacks (%{size;d} blocks)",
+        (size_t)stats.cache_hits,
+        (size_t)stats.cache_misses,
+        (size_t)stats.writebacks,
+        (size_t)stats.blocks_written_back
+    );
+    logkf(LOG_DEBUG, "BLKDEV: %{size;d} driver calls; latency:", (size_t)stats.driver_calls);
+    for (size_t i = 0; i < BLKDEV_LATENCY_BUCKETS; i++) {
+        if (!stats.latency[i]) {
+            continue;
+        } else if (i < BLKDEV_LATENCY_BUCKETS - 1) {
+            logkf(LOG_DEBUG, "BLKDEV:   < %{size;d} us: %{size;d}", (size_t)1 << i, (size_t)stats.latency[i]);
+        } else {
+            logkf(LOG_DEBUG, "BLKDEV:  >= %{size;d} us: %{size;d}", (size_t)1 << (i - 1), (size_t)stats.latency[i]);
+        }
+    }
 }
@@ -3,117 +3,84 @@
 
 #include "badge_strings.h"
 #include "filesystem/vfs_internal.h"
+#include "filesystem/vfs_pcache.h"
 #include "filesystem/vfs_ramfs.h"
 #include "log.h"
 #include "malloc.h"
+#include "scheduler/scheduler.h"
 
 
 
-// Replace a handle with the root directory of the root filesystem.
-// If this method fails, the old value is preserved.
-static void root_reopen(badge_err_t *ec, vfs_file_handle_t *dir) {
-    badge_err_t ec0;
-    if (!ec)
-        ec = &ec0;
-    assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-
-    // Create or obtain a new shared handle.
-    ptrdiff_t          shared = vfs_shared_by_inode(&vfs_table[vfs_root_index], vfs_table[vfs_root_index].inode_root);
-    vfs_file_shared_t *shptr;
-    if (shared == -1) {
-        // Open new handle.
-        shared = vfs_file_create_shared();
-        if (shared == -1) {
-            mutex_release(NULL, &vfs_handle_mtx);
-            badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
-            return;
-        }
-        shptr = vfs_file_shared_list[shared];
+// Get a reference to the shared handle of the root directory of the root filesystem.
+static vfs_file_shared_t *root_shared(badge_err_t *ec) {
+    vfs_t             *vfs   = &vfs_table[vfs_root_index];
+    vfs_file_shared_t *shptr = vfs_shared_get(vfs, vfs->inode_root);
+    if (shptr) {
+        // Use existing handle.
+        badge_err_set_ok(ec);
+        return shptr;
+    }
 
-        // Open root directory.
-        vfs_root_open(ec, shptr);
-        if (!badge_err_is_ok(ec)) {
-            vfs_file_destroy_shared(shared);
-            mutex_release(NULL, &vfs_handle_mtx);
-            return;
-        }
-        shptr->refcount = 0;
+    // Open new handle.
+    shptr = vfs_file_create_shared(ec, vfs);
+    if (!shptr) {
+        return NULL;
+    }
+    vfs_root_open(ec, shptr);
+    if (!badge_err_is_ok(ec)) {
+        vfs_file_destroy_shared(shptr);
+        return NULL;
+    }
+    return vfs_file_register_shared(shptr);
+}
 
-    } else {
+// Get a reference to the shared handle of an entry in a directory.
+static vfs_file_shared_t *dirent_shared(badge_err_t *ec, vfs_file_shared_t *dir, dirent_t const *ent) {
+    // TODO: This is the location in which mounted filesystems are handled.
+    vfs_file_shared_t *shptr = vfs_shared_get(dir->vfs, ent->inode);
+    if (shptr) {
         // Use existing handle.
-        shptr = vfs_file_shared_list[shared];
+        badge_err_set_ok(ec);
+        return shptr;
     }
 
+    // Open new handle.
+    shptr = vfs_file_create_shared(ec, dir->vfs);
+    if (!shptr) {
+        return NULL;
+    }
+    vfs_file_open(ec, dir, shptr, ent->name, 0);
+    if (!badge_err_is_ok(ec)) {
+        vfs_file_destroy_shared(shptr);
+        return NULL;
+    }
+    return vfs_file_register_shared(shptr);
+}
+
+// Replace a handle with the root directory of the root filesystem.
+// If this method fails, the old value is preserved.
+static void root_reopen(badge_err_t *ec, vfs_file_handle_t *dir) {
+    vfs_file_shared_t *shptr = root_shared(ec);
+    if (!shptr)
+        return;
+
     // Switch to new handle.
     vfs_file_shared_t *old = dir->shared;
     dir->shared            = shptr;
-    shptr->refcount++;
-
-    // Clean up old handle.
-    old->refcount--;
-    if (old->refcount == 0) {
-        vfs_file_close(ec, old);
-        badge_err_assert_dev(ec);
-        vfs_file_destroy_shared(old->index);
-    } else {
-        badge_err_set_ok(ec);
-    }
-
-    mutex_release(NULL, &vfs_handle_mtx);
+    vfs_shared_put(old);
 }
 
 // Replace a directory handle with the handle of one of it's entries.
 // If this method fails, the old value is preserved.
 static void dir_reopen(badge_err_t *ec, vfs_file_handle_t *dir, dirent_t const *ent) {
-    badge_err_t ec0;
-    if (!ec)
-        ec = &ec0;
-    assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-
-    // TODO: This is the location in which mounted filesystems are handled.
-    // Create or obtain a new shared handle.
-    ptrdiff_t          shared = vfs_shared_by_inode(dir->shared->vfs, ent->inode);
-    vfs_file_shared_t *shptr;
-    if (shared == -1) {
-        // Open new handle.
-        shared = vfs_file_create_shared();
-        if (shared == -1) {
-            mutex_release(NULL, &vfs_handle_mtx);
-            badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
-            return;
-        }
-        shptr = vfs_file_shared_list[shared];
-
-        // Open entry.
-        vfs_file_open(ec, dir->shared, shptr, ent->name, 0);
-        if (!badge_err_is_ok(ec)) {
-            vfs_file_destroy_shared(shared);
-            mutex_release(NULL, &vfs_handle_mtx);
-            return;
-        }
-        shptr->refcount = 0;
-
-    } else {
-        // Use existing handle.
-        shptr = vfs_file_shared_list[shared];
-    }
+    vfs_file_shared_t *shptr = dirent_shared(ec, dir->shared, ent);
+    if (!shptr)
+        return;
 
     // Switch to new handle.
     vfs_file_shared_t *old = dir->shared;
     dir->shared            = shptr;
-    shptr->refcount++;
-
-    // Clean up old handle.
-    old->refcount--;
-    if (old->refcount == 0) {
-        vfs_file_close(ec, old);
-        badge_err_assert_dev(ec);
-        vfs_file_destroy_shared(old->index);
-    } else {
-        badge_err_set_ok(ec);
-    }
-
-    mutex_release(NULL, &vfs_handle_mtx);
+    vfs_shared_put(old);
 }
 
 // Walk the filesystem and locate a path relative to `dir`.
@@ -230,37 +197,22 @@ static ptrdiff_t walk(badge_err_t *ec, vfs_file_handle_t *dir, char path[FILESYS
     return begin;
 }
 
-// Open a new file handle to the root directory.
-static vfs_file_handle_t *root_open(badge_err_t *ec) {
-    badge_err_t ec0;
-    if (!ec)
-        ec = &ec0;
-    assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-
-    ptrdiff_t          existing = vfs_shared_by_inode(&vfs_table[vfs_root_index], vfs_table[vfs_root_index].inode_root);
-    ptrdiff_t          handle   = vfs_file_create_handle(existing);
-    vfs_file_handle_t *ptr      = &vfs_file_handle_list[handle];
-
-    if (existing == -1) {
-        // Open new shared handle.
-        vfs_root_open(ec, ptr->shared);
-        if (!badge_err_is_ok(ec)) {
-            vfs_file_destroy_handle(handle);
-            mutex_release(NULL, &vfs_handle_mtx);
-            return NULL;
-        }
-    }
-
-    // Create file handle.
-    ptr->offset         = 0;
-    ptr->write          = false;
-    ptr->read           = true;
-    ptr->is_dir         = true;
-    ptr->dir_cache      = NULL;
-    ptr->dir_cache_size = 0;
+// Initialize a private handle to the root directory for walking the filesystem.
+// This handle is not in the file handle table; release it with `vfs_shared_put(dir->shared)`.
+static bool root_open(badge_err_t *ec, vfs_file_handle_t *dir) {
+    vfs_file_shared_t *shptr = root_shared(ec);
+    if (!shptr)
+        return false;
 
-    mutex_release(NULL, &vfs_handle_mtx);
-    return ptr;
+    *dir = (vfs_file_handle_t){
+        .offset = 0,
+        .write  = false,
+        .read   = true,
+        .is_dir = true,
+        .shared = shptr,
+        .fileno = FILE_NONE,
+    };
+    return true;
 }
 
 
@@ -336,10 +288,16 @@ static char *check_mountpoint(badge_err_t *ec, char const *raw) {
 // Try to mount a filesystem.
 // Some filesystems (like RAMFS) do not use a block device, for which `media` must be NULL.
 // Filesystems which do use a block device can often be automatically detected.
-void fs_mount(badge_err_t *ec, fs_type_t type, blkdev_t *media, char const *mountpoint, mountflags_t flags) {
+// If `opts` is NULL, the default options are used.
+void fs_mount(
+    badge_err_t *ec, fs_type_t type, blkdev_t *media, char const *mountpoint, mountflags_t flags, mountopts_t const *opts
+) {
     badge_err_t ec0;
     if (!ec)
         ec = &ec0;
+    mountopts_t const default_opts = {0};
+    if (!opts)
+        opts = &default_opts;
 
     // Take the filesystem mounting mutex.
     assert_always(mutex_acquire(NULL, &vfs_mount_mtx, VFS_MUTEX_TIMEOUT));
@@ -402,7 +360,7 @@ void fs_mount(badge_err_t *ec, fs_type_t type, blkdev_t *media, char const *moun
     // Delegate to filesystem-specific mount.
     switch (type) {
         // case FS_TYPE_FAT: vfs_fat_mount(ec, &vfs_table[vfs_index]); break;
-        case FS_TYPE_RAMFS: vfs_ramfs_mount(ec, &vfs_table[vfs_index]); break;
+        case FS_TYPE_RAMFS: vfs_ramfs_mount(ec, &vfs_table[vfs_index], opts); break;
         default: badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM); break;
     }
     if (!badge_err_is_ok(ec)) {
@@ -426,8 +384,11 @@ error_cleanup:
 }
 
 // Unmount a filesystem.
-// Only raises an error if there isn't a valid filesystem to unmount.
+// Raises an error if there isn't a valid filesystem to unmount.
+// Files that are still open on the filesystem are closed, and opening new files on it fails while it is unmounted.
 void fs_umount(badge_err_t *ec, char const *mountpoint) {
+    assert_always(mutex_acquire(NULL, &vfs_mount_mtx, VFS_MUTEX_TIMEOUT));
+
     // TODO: Remove redundant slashes from path.
     size_t vfs_index;
     for (vfs_index = 0; vfs_index < FILESYSTEM_MOUNT_MAX; vfs_index++) {
@@ -438,28 +399,54 @@ void fs_umount(badge_err_t *ec, char const *mountpoint) {
     if (vfs_index == FILESYSTEM_MOUNT_MAX) {
         logkf(LOG_ERROR, "fs_umount: %{cs}: Not mounted.", mountpoint);
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOTFOUND);
+        mutex_release(NULL, &vfs_mount_mtx);
         return;
     }
-
-    // Close file handles.
-    for (size_t i = 0; i < vfs_file_handle_list_len; i++) {
-        if (vfs_file_handle_list[i].shared->vfs == &vfs_table[vfs_index]) {
-            fs_close(NULL, vfs_file_handle_list[i].fileno);
+    vfs_t *vfs = &vfs_table[vfs_index];
+
+    // Stop new files from being opened on the filesystem.
+    vfs_set_unmounting(vfs, true);
+
+    // Close file handles until operations that got a file before it was closed are done with the filesystem.
+    while (true) {
+        assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+        for (size_t i = 0; i < vfs_file_handle_list_cap; i++) {
+            vfs_file_handle_t *handle = vfs_file_handle_list[i].handle;
+            if (!handle || handle->shared->vfs != vfs) {
+                continue;
+            }
+            file_t fileno = handle->fileno;
+            mutex_release_shared(NULL, &vfs_handle_mtx);
+            fs_close(NULL, fileno);
+            assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
         }
+        mutex_release_shared(NULL, &vfs_handle_mtx);
+        if (!atomic_load_explicit(&vfs->shared_count, memory_order_acquire)) {
+            break;
+        }
+        thread_yield();
     }
 
+    // Forget cached pages; the VFS entry may be reused by another filesystem.
+    vfs_pcache_drop_vfs(vfs);
+
     // Delegate to filesystem-specific mount.
-    switch (vfs_table[vfs_index].type) {
-        // case FS_TYPE_FAT: vfs_fat_umount(&vfs_table[vfs_index]); break;
-        case FS_TYPE_RAMFS: vfs_ramfs_umount(&vfs_table[vfs_index]); break;
+    switch (vfs->type) {
+        // case FS_TYPE_FAT: vfs_fat_umount(vfs); break;
+        case FS_TYPE_RAMFS: vfs_ramfs_umount(vfs); break;
         default: __builtin_unreachable();
     }
 
     // Release memory.
-    free(vfs_table[vfs_index].mountpoint);
-    vfs_table[vfs_index].mountpoint = NULL;
+    free(vfs->mountpoint);
+    vfs->mountpoint = NULL;
+    vfs_set_unmounting(vfs, false);
+    mutex_release(NULL, &vfs_mount_mtx);
+    badge_err_set_ok(ec);
 }
 
+
+
 // Try to identify the filesystem stored in the block device
 // Returns `FS_TYPE_UNKNOWN` on error or if the filesystem is unknown.
 fs_type_t fs_detect(badge_err_t *ec, blkdev_t *media) {
@@ -502,24 +489,21 @@ bool fs_is_canonical_path(char const *path) {
 
 // Test that the handle exists and is a directory handle.
 static bool is_dir_handle(badge_err_t *ec, file_t dir) {
-    assert_always(mutex_acquire_shared(ec, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-
     // Check the handle exists.
-    ptrdiff_t index = vfs_file_by_handle(dir);
-    if (index < 0) {
+    vfs_file_handle_t *handle = vfs_file_get(dir);
+    if (!handle) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
-        mutex_release_shared(ec, &vfs_handle_mtx);
         return false;
     }
     // Check the handle is that of a directory.
-    vfs_file_handle_t *handle = &vfs_file_handle_list[index];
-    if (!handle->is_dir) {
+    bool is_dir = handle->is_dir;
+    vfs_file_put(handle);
+    if (!is_dir) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_FILE);
-        mutex_release_shared(ec, &vfs_handle_mtx);
         return false;
     }
 
-    mutex_release_shared(ec, &vfs_handle_mtx);
+    badge_err_set_ok(ec);
     return true;
 }
 
@@ -551,49 +535,28 @@ void fs_dir_close(badge_err_t *ec, file_t dir) {
 // Read the current directory entry.
 // See also: `fs_dir_read_name`.
 bool fs_dir_read(badge_err_t *ec, dirent_t *dirent_out, file_t dir) {
-    if (!is_dir_handle(ec, dir))
-        return false;
-    badge_err_t ec0 = {.cause = ECAUSE_OK};
-    if (!ec)
-        ec = &ec0;
-
-    // Read the entry but not the name.
-    fileoff_t pos = fs_tell(ec, dir);
-    if (!badge_err_is_ok(ec))
-        return false;
-    fileoff_t read_len = sizeof(dirent_t) - FILESYSTEM_NAME_MAX - 1;
-    fileoff_t len      = fs_read(ec, dir, dirent_out, read_len);
-    if (len == 0 && badge_err_is_ok(ec)) {
-        return false;
-    }
-    if (!badge_err_is_ok(ec)) {
+    // Look up the handle.
+    vfs_file_handle_t *ptr = vfs_file_get(dir);
+    if (!ptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
         return false;
-    }
-    // Bounds check read, name and record length.
-    if (dirent_out->name_len > FILESYSTEM_NAME_MAX || dirent_out->record_len < read_len + dirent_out->name_len) {
-        // Revert position, report error.
-        fs_seek(NULL, dir, pos, SEEK_ABS);
-        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_UNKNOWN);
+    } else if (!ptr->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_FILE);
+        vfs_file_put(ptr);
         return false;
     }
 
-    // Read the name.
-    fileoff_t name_len = fs_read(ec, dir, dirent_out->name, dirent_out->name_len);
-    // Bounds check read, test name validity.
-    if (!badge_err_is_ok(ec) || name_len != dirent_out->name_len || mem_index(dirent_out->name, name_len, '/') != -1 ||
-        mem_index(dirent_out->name, name_len, 0) != -1) {
-        // Revert position, report error.
-        fs_seek(NULL, dir, pos, SEEK_ABS);
-        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_UNKNOWN);
-        return false;
+    // Read one entry and advance to the next.
+    assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
+    fileoff_t cookie = ptr->offset;
+    bool      found  = vfs_dir_read(ec, ptr->shared, &cookie, dirent_out);
+    if (found) {
+        ptr->offset = cookie;
     }
+    mutex_release(NULL, &ptr->mutex);
 
-    // Seek to next dirent.
-    fs_seek(ec, dir, pos + dirent_out->record_len, SEEK_ABS);
-
-    // Null-terminate name.
-    dirent_out->name[name_len] = 0;
-    return true;
+    vfs_file_put(ptr);
+    return found;
 }
 
 
@@ -629,15 +592,15 @@ file_t fs_open(badge_err_t *ec, char const *path, oflags_t oflags) {
     }
 
     // Locate the file.
-    vfs_file_handle_t *parent = root_open(ec);
-    if (!badge_err_is_ok(ec)) {
+    vfs_file_handle_t parent;
+    if (!root_open(ec, &parent)) {
         return FILE_NONE;
     }
     dirent_t  ent   = {0};
-    ptrdiff_t slash = walk(ec, parent, canon_path, &ent);
+    ptrdiff_t slash = walk(ec, &parent, canon_path, &ent);
     bool      found = ent.inode;
     if (!badge_err_is_ok(ec)) {
-        return FILE_NONE;
+        goto error;
     }
     // Get the filename from canonical path.
     char *filename;
@@ -649,9 +612,8 @@ file_t fs_open(badge_err_t *ec, char const *path, oflags_t oflags) {
         filename = canon_path + slash;
     }
 
-    assert_always(mutex_acquire(ec, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-    ptrdiff_t existing = -1;
-    bool      is_dir;
+    vfs_file_shared_t *shared = NULL;
+    bool               is_dir;
     if (found) {
         // File exists.
         is_dir = ent.is_dir;
@@ -659,219 +621,533 @@ file_t fs_open(badge_err_t *ec, char const *path, oflags_t oflags) {
         // Check file type.
         if (ent.is_dir && !(oflags & OFLAGS_DIRECTORY)) {
             badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_DIR);
-            mutex_release(NULL, &vfs_handle_mtx);
             goto error;
         } else if (!ent.is_dir && (oflags & OFLAGS_DIRECTORY)) {
             badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_FILE);
-            mutex_release(NULL, &vfs_handle_mtx);
             goto error;
         }
 
         // Check for existing shared handles.
-        existing = vfs_shared_by_inode(parent->shared->vfs, ent.inode);
+        shared = vfs_shared_get(parent.shared->vfs, ent.inode);
 
     } else {
         // File does not exist.
-        is_dir   = (oflags & OFLAGS_DIRECTORY);
-        existing = -1;
+        is_dir = (oflags & OFLAGS_DIRECTORY);
     }
 
-    // Create a new handle from existing shared handle.
-    ptrdiff_t handle = vfs_file_create_handle(existing);
-    if (handle == -1) {
-        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
-        mutex_release(NULL, &vfs_handle_mtx);
-        goto error;
-    }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[handle];
-
-    // Apply opening flags.
-    ptr->read   = oflags & OFLAGS_READONLY;
-    ptr->write  = oflags & OFLAGS_WRITEONLY;
-    ptr->is_dir = is_dir;
-
-    if (existing == -1) {
+    if (!shared) {
         // Create new shared file handle.
-        vfs_file_shared_t *shared = ptr->shared;
-        vfs_file_open(ec, parent->shared, shared, filename, oflags);
+        shared = vfs_file_create_shared(ec, parent.shared->vfs);
+        if (!shared) {
+            goto error;
+        }
+        vfs_file_open(ec, parent.shared, shared, filename, oflags);
         if (!badge_err_is_ok(ec)) {
-            vfs_file_destroy_handle(handle);
-            mutex_release(NULL, &vfs_handle_mtx);
+            vfs_file_destroy_shared(shared);
             goto error;
         }
-        shared->refcount = 1;
+        shared = vfs_file_register_shared(shared);
     }
 
-    // Successful opening of new handle.
-    mutex_release(NULL, &vfs_handle_mtx);
+    // Create a new handle from the shared handle.
+    file_t fileno = vfs_file_create_handle(shared, oflags & OFLAGS_READONLY, oflags & OFLAGS_WRITEONLY, is_dir);
+    if (fileno == FILE_NONE) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+        vfs_shared_put(shared);
+        goto error;
+    }
 
-    return ptr->fileno;
+    // Successful opening of new handle; the directory handle is no longer needed.
+    vfs_shared_put(parent.shared);
+    return fileno;
 
 error:
-    // Destroy directory handle.
-    assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-    ptrdiff_t index = vfs_file_by_handle(parent->fileno);
-    vfs_file_destroy_handle(index);
-    mutex_release(NULL, &vfs_handle_mtx);
+    // Release directory handle.
+    vfs_shared_put(parent.shared);
     return FILE_NONE;
 }
 
 // Close a file opened by `fs_open`.
-// Only raises an error if `file` is an invalid file descriptor.
+// Raises an error if `file` is an invalid file descriptor or if its cached data could not be written back.
+// The file is closed even if writing back failed.
 void fs_close(badge_err_t *ec, file_t file) {
-    assert_always(mutex_acquire(ec, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+    // Write back dirty pages while the error can still be reported to the caller.
+    badge_err_t        ec0 = {0};
+    vfs_file_handle_t *ptr = vfs_file_get(file);
+    if (ptr && atomic_load(&ptr->shared->pcache_dirty)) {
+        assert_always(mutex_acquire_shared(NULL, &ptr->shared->mutex, VFS_MUTEX_TIMEOUT));
+        vfs_pcache_flush(&ec0, ptr->shared);
+        mutex_release_shared(NULL, &ptr->shared->mutex);
+    }
+    if (ptr) {
+        vfs_file_put(ptr);
+    }
 
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+    if (!vfs_file_destroy_handle(file)) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+    } else if (!badge_err_is_ok(&ec0) && ec) {
+        *ec = ec0;
     } else {
         badge_err_set_ok(ec);
-        vfs_file_destroy_handle(index);
     }
+}
 
-    mutex_release(NULL, &vfs_handle_mtx);
+// Look up a handle for reading or writing and check that it has the required permission.
+// Returns a reference to the handle, or NULL on error.
+static vfs_file_handle_t *rw_handle_get(badge_err_t *ec, file_t file, bool write) {
+    vfs_file_handle_t *ptr = vfs_file_get(file);
+    if (!ptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return NULL;
+    }
+    if (write ? !ptr->write : !ptr->read) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PERM);
+        vfs_file_put(ptr);
+        return NULL;
+    }
+    return ptr;
 }
 
-// Read bytes from a file.
+// Read bytes from a file at an absolute offset.
+// Takes the shared handle's lock but not that of the handle itself.
 // Returns the amount of data successfully read.
-fileoff_t fs_read(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen) {
-    if (readlen < 0) {
+static fileoff_t
+    file_read_at(badge_err_t *ec, vfs_file_handle_t *ptr, fileoff_t offset, void *readbuf, fileoff_t readlen) {
+    assert_always(mutex_acquire_shared(NULL, &ptr->shared->mutex, VFS_MUTEX_TIMEOUT));
+    if (offset >= ptr->shared->size) {
+        readlen = 0;
+    } else if (readlen + offset < 0 || readlen + offset > ptr->shared->size) {
+        readlen = ptr->shared->size - offset;
+    }
+    badge_err_set_ok(ec);
+    if (readlen) {
+        vfs_file_read(ec, ptr->shared, offset, readbuf, readlen);
+    }
+    mutex_release_shared(NULL, &ptr->shared->mutex);
+    return badge_err_is_ok(ec) ? readlen : 0;
+}
+
+// Write bytes to a file at an absolute offset, growing it if necessary.
+// Takes the shared handle's lock but not that of the handle itself.
+// Returns the amount of data successfully written.
+static fileoff_t
+    file_write_at(badge_err_t *ec, vfs_file_handle_t *ptr, fileoff_t offset, void const *writebuf, fileoff_t writelen) {
+    if (writelen + offset < 0) {
+        // Integer overflow: Assume no space.
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOSPACE);
+        return 0;
+    }
+    assert_always(mutex_acquire(NULL, &ptr->shared->mutex, VFS_MUTEX_TIMEOUT));
+    badge_err_set_ok(ec);
+    if (offset + writelen > ptr->shared->size) {
+        vfs_file_resize(ec, ptr->shared, offset + writelen);
+    }
+    if (badge_err_is_ok(ec) && writelen) {
+        vfs_file_write(ec, ptr->shared, offset, writebuf, writelen);
+    }
+    mutex_release(NULL, &ptr->shared->mutex);
+    return badge_err_is_ok(ec) ? writelen : 0;
+}
+
+// Copy bytes between files at absolute offsets, writing straight from the source file's cached pages.
+// Takes the shared handles' locks but not those of the handles themselves.
+// Returns the amount of data successfully copied.
+static fileoff_t file_copy_at(
+    badge_err_t *ec, vfs_file_handle_t *in, fileoff_t src_off, vfs_file_handle_t *out, fileoff_t dst_off, fileoff_t len
+) {
+    if (in->shared == out->shared && src_off < dst_off + len && dst_off < src_off + len) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+    fileoff_t copied = 0;
+    badge_err_set_ok(ec);
+    while (copied < len) {
+        fileoff_t pageoff = src_off % VFS_PCACHE_PAGE_SIZE;
+        fileoff_t count   = VFS_PCACHE_PAGE_SIZE - pageoff;
+        if (count > len - copied) {
+            count = len - copied;
+        }
 
-    // Look up the handle.
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+        // Pin the source page so it stays put while the destination is written.
+        vfs_page_t *page = NULL;
+        assert_always(mutex_acquire_shared(NULL, &in->shared->mutex, VFS_MUTEX_TIMEOUT));
+        if (count > in->shared->size - src_off) {
+            count = in->shared->size - src_off;
+        }
+        if (count > 0) {
+            page = vfs_pcache_pin(ec, in->shared, src_off / VFS_PCACHE_PAGE_SIZE);
+        }
+        mutex_release_shared(NULL, &in->shared->mutex);
+        if (!page) {
+            break;
+        }
+
+        count = file_write_at(ec, out, dst_off, vfs_pcache_page_mem(page) + pageoff, count);
+        vfs_pcache_unpin(page);
+        if (!badge_err_is_ok(ec)) {
+            break;
+        }
+        src_off += count;
+        dst_off += count;
+        copied  += count;
+    }
+    return copied;
+}
+
+// Read as many whole directory entries as fit in the buffer, resuming from the handle's cookie.
+// The caller must hold `dir->mutex`.
+// Returns the amount of data successfully read, which is 0 at the end of the directory.
+static fileoff_t dir_read_records(badge_err_t *ec, vfs_file_handle_t *dir, void *readbuf, fileoff_t readlen) {
+    fileoff_t total = 0;
+    badge_err_set_ok(ec);
+    while (true) {
+        // Convert directly into the buffer if a record of any length fits there.
+        char     *pos    = (char *)readbuf + total;
+        dirent_t  tmp;
+        dirent_t *out    = &tmp;
+        fileoff_t cookie = dir->offset;
+        if (readlen - total >= (fileoff_t)sizeof(dirent_t) && (size_t)pos % _Alignof(dirent_t) == 0) {
+            out = (dirent_t *)pos;
+        }
+        if (!vfs_dir_read(ec, dir->shared, &cookie, out)) {
+            break;
+        }
+
+        // Only advance past entries that fit entirely.
+        if (out->record_len > readlen - total) {
+            if (!total) {
+                badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_TOOLONG);
+            }
+            break;
+        }
+        if (out == &tmp) {
+            mem_copy(pos, &tmp, tmp.record_len);
+        }
+        total       += out->record_len;
+        dir->offset  = cookie;
+    }
+    return total;
+}
+
+// Read bytes from a file.
+// Returns the amount of data successfully read.
+fileoff_t fs_read(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (readlen < 0) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[index];
 
-    // Check permission.
-    if (!ptr->read) {
-        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PERM);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
+    // Look up the handle.
+    vfs_file_handle_t *ptr = rw_handle_get(ec, file, false);
+    if (!ptr) {
         return 0;
     }
 
     // Read data from the handle.
     assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
     if (ptr->is_dir) {
-        // Directory reads go through cache.
-        if (ptr->offset == 0) {
-            vfs_dir_read(ec, ptr);
-        }
-        if (ptr->offset != 0 || badge_err_is_ok(ec)) {
-            if (readlen + ptr->offset < 0 || readlen + ptr->offset > ptr->dir_cache_size) {
-                readlen = ptr->dir_cache_size - ptr->offset;
-            }
-            mem_copy(readbuf, ptr->dir_cache + ptr->offset, readlen);
-            ptr->offset += readlen;
-        }
+        // Directory reads produce whole `dirent_t` records.
+        readlen = dir_read_records(ec, ptr, readbuf, readlen);
 
     } else {
         // File reads go through VFS.
-        if (readlen + ptr->offset < 0 || readlen + ptr->offset > ptr->shared->size) {
-            readlen = ptr->shared->size - ptr->offset;
-        }
-        vfs_file_read(ec, ptr->shared, ptr->offset, readbuf, readlen);
+        readlen      = file_read_at(ec, ptr, ptr->offset, readbuf, readlen);
         ptr->offset += readlen;
     }
     mutex_release(NULL, &ptr->mutex);
 
-    mutex_release_shared(NULL, &vfs_handle_mtx);
+    vfs_file_put(ptr);
     return readlen;
 }
 
 // Write bytes to a file.
 // Returns the amount of data successfully written.
 fileoff_t fs_write(badge_err_t *ec, file_t file, void const *writebuf, fileoff_t writelen) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
     if (writelen < 0) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
 
     // Look up the handle.
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+    vfs_file_handle_t *ptr = rw_handle_get(ec, file, true);
+    if (!ptr) {
+        return 0;
+    }
+
+    // Write data to the handle.
+    assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
+    // File writes go through VFS.
+    writelen      = file_write_at(ec, ptr, ptr->offset, writebuf, writelen);
+    ptr->offset  += writelen;
+    mutex_release(NULL, &ptr->mutex);
+
+    vfs_file_put(ptr);
+    return writelen;
+}
+
+// Read bytes from a file at a given offset.
+// Does not use or change the file's current offset.
+// Returns the amount of data successfully read.
+fileoff_t fs_pread(badge_err_t *ec, file_t file, void *readbuf, fileoff_t readlen, fileoff_t offset) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (readlen < 0 || offset < 0) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[index];
 
-    // Check permission.
-    if (!ptr->write) {
-        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PERM);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
+    // Look up the handle.
+    vfs_file_handle_t *ptr = rw_handle_get(ec, file, false);
+    if (!ptr) {
+        return 0;
+    }
+    if (ptr->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_DIR);
+        vfs_file_put(ptr);
         return 0;
     }
 
-    // Read data from the handle.
+    // The offset is not touched, so the handle's own lock is not needed.
+    readlen = file_read_at(ec, ptr, offset, readbuf, readlen);
+
+    vfs_file_put(ptr);
+    return readlen;
+}
+
+// Write bytes to a file at a given offset.
+// Does not use or change the file's current offset.
+// Returns the amount of data successfully written.
+fileoff_t fs_pwrite(badge_err_t *ec, file_t file, void const *writebuf, fileoff_t writelen, fileoff_t offset) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (writelen < 0 || offset < 0) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
+
+    // Look up the handle.
+    vfs_file_handle_t *ptr = rw_handle_get(ec, file, true);
+    if (!ptr) {
+        return 0;
+    }
+
+    // The offset is not touched, so the handle's own lock is not needed.
+    writelen = file_write_at(ec, ptr, offset, writebuf, writelen);
+
+    vfs_file_put(ptr);
+    return writelen;
+}
+
+// Check an I/O vector for validity.
+// Returns whether all buffers are valid and their total length fits in a `fileoff_t`.
+static bool iov_valid(iovec_t const *iov, int iovcnt) {
+    if (iovcnt < 0 || iovcnt > FILESYSTEM_IOV_MAX || (iovcnt && !iov)) {
+        return false;
+    }
+    fileoff_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].len < 0 || total + iov[i].len < 0) {
+            return false;
+        }
+        total += iov[i].len;
+    }
+    return true;
+}
+
+// Read bytes from a file into multiple buffers.
+// The buffers are filled in order as if by a single `fs_read` and the offset is advanced by the total read.
+// Returns the amount of data successfully read.
+fileoff_t fs_readv(badge_err_t *ec, file_t file, iovec_t const *iov, int iovcnt) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (!iov_valid(iov, iovcnt)) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
+
+    // Look up the handle.
+    vfs_file_handle_t *ptr = rw_handle_get(ec, file, false);
+    if (!ptr) {
+        return 0;
+    }
+    if (ptr->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_DIR);
+        vfs_file_put(ptr);
+        return 0;
+    }
+
+    // Hold the handle's lock for the entire operation so the buffers are read contiguously.
     assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
-    // File writes go through VFS.
-    if (writelen + ptr->offset < 0) {
-        // Integer overflow: Assume no space.
-        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOSPACE);
-        mutex_release(NULL, &ptr->mutex);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
+    badge_err_set_ok(ec);
+    fileoff_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        fileoff_t count  = file_read_at(ec, ptr, ptr->offset, iov[i].base, iov[i].len);
+        ptr->offset     += count;
+        total           += count;
+        if (!badge_err_is_ok(ec) || count < iov[i].len) {
+            break;
+        }
+    }
+    mutex_release(NULL, &ptr->mutex);
+
+    vfs_file_put(ptr);
+    return total;
+}
+
+// Write bytes to a file from multiple buffers.
+// The buffers are written in order as if by a single `fs_write` and the offset is advanced by the total written.
+// Returns the amount of data successfully written.
+fileoff_t fs_writev(badge_err_t *ec, file_t file, iovec_t const *iov, int iovcnt) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (!iov_valid(iov, iovcnt)) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
+
+    // Look up the handle.
+    vfs_file_handle_t *ptr = rw_handle_get(ec, file, true);
+    if (!ptr) {
         return 0;
     }
-    if (ptr->offset + writelen > ptr->shared->size) {
-        vfs_file_resize(ec, ptr->shared, ptr->offset + writelen);
+
+    // Hold the handle's lock for the entire operation so the buffers are written contiguously.
+    assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
+    badge_err_set_ok(ec);
+    fileoff_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        fileoff_t count  = file_write_at(ec, ptr, ptr->offset, iov[i].base, iov[i].len);
+        ptr->offset     += count;
+        total           += count;
+        if (!badge_err_is_ok(ec)) {
+            break;
+        }
     }
-    vfs_file_write(ec, ptr->shared, ptr->offset, writebuf, writelen);
     mutex_release(NULL, &ptr->mutex);
 
-    mutex_release_shared(NULL, &vfs_handle_mtx);
-    return writelen;
+    vfs_file_put(ptr);
+    return total;
+}
+
+// Copy bytes from one file to another without going through a caller-supplied buffer.
+// A NULL `src_offset` or `dst_offset` uses and advances that file's current offset, otherwise `*offset` is.
+// Copying a range of a file onto an overlapping range of the same file is not allowed.
+// Returns the amount of data successfully copied, which is less than `len` at the end of the source file.
+fileoff_t fs_copy_range(
+    badge_err_t *ec, file_t src, fileoff_t *src_offset, file_t dst, fileoff_t *dst_offset, fileoff_t len
+) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (len < 0 || (src_offset && *src_offset < 0) || (dst_offset && *dst_offset < 0)) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
+
+    // Look up the handles.
+    vfs_file_handle_t *in = rw_handle_get(ec, src, false);
+    if (!in) {
+        return 0;
+    }
+    vfs_file_handle_t *out = rw_handle_get(ec, dst, true);
+    if (!out) {
+        vfs_file_put(in);
+        return 0;
+    }
+    if (in->is_dir || out->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_DIR);
+        vfs_file_put(out);
+        vfs_file_put(in);
+        return 0;
+    }
+
+    // Lock the handles whose offsets are used, in address order so opposite copies cannot deadlock.
+    vfs_file_handle_t *lock_a = src_offset ? NULL : in;
+    vfs_file_handle_t *lock_b = dst_offset ? NULL : out;
+    if (lock_a == lock_b) {
+        lock_b = NULL;
+    } else if (lock_a && lock_b && (size_t)lock_a > (size_t)lock_b) {
+        vfs_file_handle_t *tmp = lock_a;
+        lock_a                 = lock_b;
+        lock_b                 = tmp;
+    }
+    if (lock_a) {
+        assert_always(mutex_acquire(NULL, &lock_a->mutex, VFS_MUTEX_TIMEOUT));
+    }
+    if (lock_b) {
+        assert_always(mutex_acquire(NULL, &lock_b->mutex, VFS_MUTEX_TIMEOUT));
+    }
+
+    fileoff_t *src_pos = src_offset ? src_offset : &in->offset;
+    fileoff_t *dst_pos = dst_offset ? dst_offset : &out->offset;
+    fileoff_t  copied  = file_copy_at(ec, in, *src_pos, out, *dst_pos, len);
+    *src_pos          += copied;
+    *dst_pos          += copied;
+
+    if (lock_b) {
+        mutex_release(NULL, &lock_b->mutex);
+    }
+    if (lock_a) {
+        mutex_release(NULL, &lock_a->mutex);
+    }
+    vfs_file_put(out);
+    vfs_file_put(in);
+    return copied;
 }
 
 // Get the current offset in the file.
 fileoff_t fs_tell(badge_err_t *ec, file_t file) {
-    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-
     // Look up the handle.
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+    vfs_file_handle_t *ptr = vfs_file_get(file);
+    if (!ptr) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[index];
 
     // Get the position atomically.
     assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
     fileoff_t ret = ptr->offset;
     mutex_release(NULL, &ptr->mutex);
 
-    mutex_release_shared(NULL, &vfs_handle_mtx);
+    vfs_file_put(ptr);
     return ret;
 }
 
 // Set the current offset in the file.
 // Returns the new offset in the file.
 fileoff_t fs_seek(badge_err_t *ec, file_t file, fileoff_t off, fs_seek_t seekmode) {
-    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
-
     // Look up the handle.
-    ptrdiff_t index = vfs_file_by_handle(file);
-    if (index == -1) {
+    vfs_file_handle_t *ptr = vfs_file_get(file);
+    if (!ptr) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
-        mutex_release_shared(NULL, &vfs_handle_mtx);
         return 0;
     }
-    vfs_file_handle_t *ptr = &vfs_file_handle_list[index];
 
     // Update the position atomically.
     assert_always(mutex_acquire(NULL, &ptr->mutex, VFS_MUTEX_TIMEOUT));
     badge_err_set_ok(ec);
+    if (ptr->is_dir) {
+        // Directory offsets are cookies that are only meaningful to the filesystem; they can only be rewound.
+        if (seekmode == SEEK_ABS && off == 0) {
+            ptr->offset = 0;
+        } else if (seekmode != SEEK_CUR || off != 0) {
+            badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        }
+        fileoff_t ret = ptr->offset;
+        mutex_release(NULL, &ptr->mutex);
+        vfs_file_put(ptr);
+        return ret;
+    }
     switch (seekmode) {
         case SEEK_ABS: ptr->offset = off; break;
         case SEEK_CUR: ptr->offset += off; break;
@@ -881,20 +1157,117 @@ fileoff_t fs_seek(badge_err_t *ec, file_t file, fileoff_t off, fs_seek_t seekmod
     // Clamp offset.
     if (ptr->offset < 0) {
         ptr->offset = 0;
-    } else if (!ptr->is_dir && ptr->offset > ptr->shared->size) {
+    } else if (ptr->offset > ptr->shared->size) {
         ptr->offset = ptr->shared->size;
-    } else if (ptr->is_dir && ptr->offset > ptr->dir_cache_size) {
-        ptr->offset = ptr->dir_cache_size;
     }
+    fileoff_t ret = ptr->offset;
     mutex_release(NULL, &ptr->mutex);
 
-    mutex_release_shared(NULL, &vfs_handle_mtx);
-    return ptr->offset;
+    vfs_file_put(ptr);
+    return ret;
 }
 
 // Force any write caches to be flushed for a given file.
 // If the file is `FILE_NONE`, all open files are flushed.
 void fs_flush(badge_err_t *ec, file_t file) {
-    (void)file;
-    badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_UNSUPPORTED);
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+
+    if (file == FILE_NONE) {
+        // Write back all dirty pages, then let every filesystem sync.
+        vfs_pcache_flush_all(ec);
+        assert_always(mutex_acquire_shared(NULL, &vfs_mount_mtx, VFS_MUTEX_TIMEOUT));
+        for (size_t i = 0; i < FILESYSTEM_MOUNT_MAX; i++) {
+            if (vfs_table[i].mountpoint) {
+                badge_err_t ec1;
+                vfs_flush(&ec1, &vfs_table[i]);
+                if (!badge_err_is_ok(&ec1)) {
+                    *ec = ec1;
+                }
+            }
+        }
+        mutex_release_shared(NULL, &vfs_mount_mtx);
+        return;
+    }
+
+    // Look up the handle.
+    vfs_file_handle_t *ptr = vfs_file_get(file);
+    if (!ptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return;
+    }
+
+    // Write back the file's dirty pages, then let the filesystem sync.
+    assert_always(mutex_acquire_shared(NULL, &ptr->shared->mutex, VFS_MUTEX_TIMEOUT));
+    vfs_pcache_flush(ec, ptr->shared);
+    mutex_release_shared(NULL, &ptr->shared->mutex);
+    if (badge_err_is_ok(ec)) {
+        vfs_flush(ec, ptr->shared->vfs);
+    }
+
+    vfs_file_put(ptr);
+}
+
+// Pin the page of a file's contents at `offset` in the page cache so it can be mapped into a process.
+// `offset` must be page-aligned and within the file; the part of the last page past the end of the file reads as zero.
+// Writes to the file show up in the page as soon as they are made.
+// Returns the physical page number on success, 0 on failure, and stores the handle for `fs_unpin_page` in `*pin_out`.
+size_t fs_pin_page(badge_err_t *ec, file_t file, fileoff_t offset, void **pin_out) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    if (offset < 0 || offset % VFS_PCACHE_PAGE_SIZE) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return 0;
+    }
+
+    // Look up the handle.
+    vfs_file_handle_t *ptr = rw_handle_get(ec, file, false);
+    if (!ptr) {
+        return 0;
+    }
+    if (ptr->is_dir) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_IS_DIR);
+        vfs_file_put(ptr);
+        return 0;
+    }
+
+    size_t ppn = 0;
+    assert_always(mutex_acquire_shared(NULL, &ptr->shared->mutex, VFS_MUTEX_TIMEOUT));
+    if (offset >= ptr->shared->size) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_RANGE);
+    } else {
+        vfs_page_t *page = vfs_pcache_pin(ec, ptr->shared, offset / VFS_PCACHE_PAGE_SIZE);
+        if (page) {
+            ppn      = page->ppn;
+            *pin_out = page;
+        }
+    }
+    mutex_release_shared(NULL, &ptr->shared->mutex);
+
+    vfs_file_put(ptr);
+    return ppn;
+}
+
+// Release a page pinned by `fs_pin_page`.
+void fs_unpin_page(void *pin) {
+    vfs_pcache_unpin(pin);
+}
+
+// Get the I/O statistics of the block device that holds the filesystem of an open file.
+// Raises `ECAUSE_UNSUPPORTED` if the filesystem isn't stored on a block device.
+void fs_blkdev_stats(badge_err_t *ec, file_t file, blkdev_stats_t *stats_out) {
+    vfs_file_handle_t *ptr = vfs_file_get(file);
+    if (!ptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return;
+    }
+    blkdev_t *media = ptr->shared->vfs->media;
+    if (media) {
+        blkdev_get_stats(ec, media, stats_out);
+    } else {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_UNSUPPORTED);
+    }
+    vfs_file_put(ptr);
 }
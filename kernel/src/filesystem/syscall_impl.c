@@ -4,7 +4,11 @@
 #include "filesystem/syscall_impl.h"
 
 #include "filesystem.h"
+#include "malloc.h"
 #include "process/internal.h"
+#include "process/sighandler.h"
+#include "syscall_util.h"
+#include "usercopy.h"
 
 
 
@@ -17,7 +21,7 @@ int syscall_fs_open(char const *path, int relative_to, int oflags) {
     int              virt = -1;
     if (fd >= 0) {
         badge_err_t ec;
-        virt = proc_add_fd_raw(&ec, proc, fd);
+        virt = proc_add_fd(&ec, proc, fd);
         if (!badge_err_is_ok(&ec)) {
             fs_close(NULL, fd);
             virt = -1;
@@ -28,10 +32,8 @@ int syscall_fs_open(char const *path, int relative_to, int oflags) {
 
 // Flush and close a file.
 bool syscall_fs_close(int virt) {
-    process_t *const proc = proc_current();
-    badge_err_t      ec;
-    file_t           fd = proc_find_fd_raw(NULL, proc_current(), virt);
-    proc_remove_fd_raw(&ec, proc, virt);
+    badge_err_t ec;
+    file_t      fd = proc_remove_fd(&ec, proc_current(), virt);
     if (!badge_err_is_ok(&ec)) {
         return false;
     } else {
@@ -43,7 +45,7 @@ bool syscall_fs_close(int virt) {
 // Read bytes from a file.
 // Returns -1 on EOF, <= -2 on error, read count on success.
 long syscall_fs_read(int virt, void *read_buf, long read_len) {
-    file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
+    file_t fd = proc_find_fd(NULL, proc_current(), virt);
     if (fd != -1) {
         return fs_read(NULL, fd, read_buf, read_len);
     }
@@ -53,7 +55,7 @@ long syscall_fs_read(int virt, void *read_buf, long read_len) {
 // Write bytes to a file.
 // Returns <= -1 on error, write count on success.
 long syscall_fs_write(int virt, void const *write_buf, long write_len) {
-    file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
+    file_t fd = proc_find_fd(NULL, proc_current(), virt);
     if (fd != -1) {
         return fs_write(NULL, fd, write_buf, write_len);
     }
@@ -63,8 +65,166 @@ long syscall_fs_write(int virt, void const *write_buf, long write_len) {
 // Read directory entries from a directory handle.
 // See `dirent_t` for the format.
 // Returns <= -1 on error, read count on success.
+// Each call continues after the last entry returned by the previous call; 0 is returned at the end of the directory.
 long syscall_fs_getdents(int virt, void *read_buf, long read_len) {
-    file_t fd = proc_find_fd_raw(NULL, proc_current(), virt);
-    fs_seek(NULL, fd, 0, SEEK_ABS);
-    return fs_read(NULL, fd, read_buf, read_len);
+    file_t fd = proc_find_fd(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    }
+    badge_err_t ec;
+    fileoff_t   count = fs_read(&ec, fd, read_buf, read_len);
+    return badge_err_is_ok(&ec) ? count : -1;
+}
+
+// Read bytes from a file at a given offset without using or changing the current offset.
+// Returns <= -1 on error, read count on success.
+long syscall_fs_pread(int virt, void *read_buf, long read_len, long offset) {
+    if (read_len > 0) {
+        sysutil_memassert_rw(read_buf, read_len);
+    }
+    file_t fd = proc_find_fd(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    }
+    badge_err_t ec;
+    fileoff_t   count = fs_pread(&ec, fd, read_buf, read_len, offset);
+    return badge_err_is_ok(&ec) ? count : -1;
+}
+
+// Write bytes to a file at a given offset without using or changing the current offset.
+// Returns <= -1 on error, write count on success.
+long syscall_fs_pwrite(int virt, void const *write_buf, long write_len, long offset) {
+    if (write_len > 0) {
+        sysutil_memassert_r(write_buf, write_len);
+    }
+    file_t fd = proc_find_fd(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    }
+    badge_err_t ec;
+    fileoff_t   count = fs_pwrite(&ec, fd, write_buf, write_len, offset);
+    return badge_err_is_ok(&ec) ? count : -1;
+}
+
+// Copy an I/O vector from user memory and check access to the buffers it describes.
+// Returns a kernel copy that must be freed by the caller, or NULL if `iovcnt` is invalid or out of memory.
+// Raises SIGSEGV if the user doesn't have access to the vector or the buffers.
+static iovec_t *copy_iov_from_user(iovec_t const *iov, int iovcnt, bool write) {
+    if (iovcnt <= 0 || iovcnt > FILESYSTEM_IOV_MAX) {
+        return NULL;
+    }
+    iovec_t *tmp = malloc(sizeof(iovec_t) * iovcnt);
+    if (!tmp) {
+        return NULL;
+    }
+    if (!copy_from_user_raw(proc_current(), tmp, (size_t)iov, sizeof(iovec_t) * iovcnt)) {
+        free(tmp);
+        proc_sigsegv_handler((size_t)iov);
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (tmp[i].len <= 0) {
+            continue;
+        }
+        if (write) {
+            sysutil_memassert_rw(tmp[i].base, tmp[i].len);
+        } else {
+            sysutil_memassert_r(tmp[i].base, tmp[i].len);
+        }
+    }
+    return tmp;
+}
+
+// Read bytes from a file into `iovcnt` buffers described by `iov`.
+// Returns <= -1 on error, total read count on success.
+long syscall_fs_readv(int virt, iovec_t const *iov, int iovcnt) {
+    file_t fd = proc_find_fd(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    } else if (iovcnt == 0) {
+        return 0;
+    }
+    iovec_t *tmp = copy_iov_from_user(iov, iovcnt, true);
+    if (!tmp) {
+        return -1;
+    }
+    badge_err_t ec;
+    fileoff_t   count = fs_readv(&ec, fd, tmp, iovcnt);
+    free(tmp);
+    return badge_err_is_ok(&ec) ? count : -1;
+}
+
+// Write bytes to a file from `iovcnt` buffers described by `iov`.
+// Returns <= -1 on error, total write count on success.
+long syscall_fs_writev(int virt, iovec_t const *iov, int iovcnt) {
+    file_t fd = proc_find_fd(NULL, proc_current(), virt);
+    if (fd == -1) {
+        return -1;
+    } else if (iovcnt == 0) {
+        return 0;
+    }
+    iovec_t *tmp = copy_iov_from_user(iov, iovcnt, false);
+    if (!tmp) {
+        return -1;
+    }
+    badge_err_t ec;
+    fileoff_t   count = fs_writev(&ec, fd, tmp, iovcnt);
+    free(tmp);
+    return badge_err_is_ok(&ec) ? count : -1;
+}
+
+// Copy bytes from one file to another inside the kernel.
+// A NULL `src_offset` or `dst_offset` uses and advances that file's current offset, otherwise `*offset` is.
+// Returns <= -1 on error, copy count on success; less than `len` is copied at the end of the source file.
+long syscall_fs_copy_range(int src_virt, long *src_offset, int dst_virt, long *dst_offset, long len) {
+    process_t *const proc = proc_current();
+    file_t           src  = proc_find_fd(NULL, proc, src_virt);
+    file_t           dst  = proc_find_fd(NULL, proc, dst_virt);
+    if (src == -1 || dst == -1) {
+        return -1;
+    }
+
+    // Copy the offsets in and back out so the user can't change them halfway through.
+    fileoff_t src_tmp, dst_tmp;
+    if (src_offset && !copy_from_user_raw(proc, &src_tmp, (size_t)src_offset, sizeof(fileoff_t))) {
+        proc_sigsegv_handler((size_t)src_offset);
+    }
+    if (dst_offset && !copy_from_user_raw(proc, &dst_tmp, (size_t)dst_offset, sizeof(fileoff_t))) {
+        proc_sigsegv_handler((size_t)dst_offset);
+    }
+    badge_err_t ec;
+    fileoff_t  *src_pos = src_offset ? &src_tmp : NULL;
+    fileoff_t  *dst_pos = dst_offset ? &dst_tmp : NULL;
+    fileoff_t   count   = fs_copy_range(&ec, src, src_pos, dst, dst_pos, len);
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    bool src_ok = !src_offset || copy_to_user_raw(proc, (size_t)src_offset, &src_tmp, sizeof(fileoff_t));
+    bool dst_ok = !dst_offset || copy_to_user_raw(proc, (size_t)dst_offset, &dst_tmp, sizeof(fileoff_t));
+    mutex_release(NULL, &proc->mtx);
+    if (!src_ok) {
+        proc_sigsegv_handler((size_t)src_offset);
+    }
+    if (!dst_ok) {
+        proc_sigsegv_handler((size_t)dst_offset);
+    }
+    return badge_err_is_ok(&ec) ? count : -1;
+}
+
+// Get the I/O statistics of the block device that holds the filesystem of an open file.
+// Returns <= -1 on error, 0 on success.
+long syscall_fs_blkdev_stats(int virt, blkdev_stats_t *stats) {
+    process_t *const proc = proc_current();
+    file_t           fd   = proc_find_fd(NULL, proc, virt);
+    if (fd == -1) {
+        return -1;
+    }
+    badge_err_t    ec;
+    blkdev_stats_t tmp;
+    fs_blkdev_stats(&ec, fd, &tmp);
+    if (!badge_err_is_ok(&ec)) {
+        return -1;
+    }
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    bool copy_ok = copy_to_user_raw(proc, (size_t)stats, &tmp, sizeof(blkdev_stats_t));
+    mutex_release(NULL, &proc->mtx);
+    sigsegv_assert(copy_ok, (size_t)stats);
+    return 0;
 }
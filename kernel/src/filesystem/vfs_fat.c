@@ -46,9 +46,9 @@ bool vfs_fat_detect(badge_err_t *ec, blkdev_t *dev) {
 
 
 
-// Atomically read all directory entries and cache them into the directory handle.
-// Refer to `dirent_t` for the structure of the cache.
-void vfs_fat_dir_read(badge_err_t *ec, vfs_file_handle_t *dir);
+// Read the directory entry at `*cookie` and advance `*cookie` to the next entry.
+// Returns false without error at the end of the directory.
+bool vfs_fat_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, fileoff_t *cookie, dirent_t *out);
 // Open a file for reading and/or writing.
 void vfs_fat_file_open(badge_err_t *ec, vfs_file_shared_t *file, char const *path, oflags_t oflags);
 // Clone a file opened by `vfs_fat_file_open`.
@@ -5,6 +5,7 @@
 
 #include "assertions.h"
 #include "badge_strings.h"
+#include "filesystem/vfs_pcache.h"
 #include "filesystem/vfs_ramfs.h"
 #include "log.h"
 #include "malloc.h"
@@ -21,27 +22,32 @@ vfs_t     vfs_table[FILESYSTEM_MOUNT_MAX] = {0};
 // Taken exclusively during mount / unmount operations.
 // Taken shared during filesystem access.
 mutex_t   vfs_mount_mtx                   = MUTEX_T_INIT_SHARED;
-// Mutex for creating and destroying directory and file handles.
-// Taken exclusively when a handle is created or destroyed.
-// Taken shared when a handle is used.
+// Mutex for the file handle table.
+// Taken exclusively while a handle is inserted or removed.
+// Taken shared while a handle is looked up.
 mutex_t   vfs_handle_mtx                  = MUTEX_T_INIT_SHARED;
-
-// List of open shared file handles.
-vfs_file_shared_t **vfs_file_shared_list;
+// Mutex for the shared file handle table.
+// Taken exclusively while a shared handle is inserted or removed.
+// Taken shared while a shared handle is looked up.
+mutex_t   vfs_shared_mtx                  = MUTEX_T_INIT_SHARED;
+
+// Hash table of open shared file handles, keyed by VFS and inode.
+static vfs_file_shared_t **vfs_file_shared_buckets;
+// Number of buckets in the shared file handle hash table; always a power of two.
+static size_t              vfs_file_shared_buckets_len;
 // Number of open shared file handles.
-size_t              vfs_file_shared_list_len;
-// Capacity of open shared file handles list.
-size_t              vfs_file_shared_list_cap;
+atomic_size_t              vfs_file_shared_list_len;
 
-// List of open file handles.
-vfs_file_handle_t *vfs_file_handle_list;
+// Table of open file handles, indexed by the slot number in `file_t`.
+vfs_file_slot_t *vfs_file_handle_list;
 // Number of open file handles.
-size_t             vfs_file_handle_list_len;
-// Capacity of open file handles list.
-size_t             vfs_file_handle_list_cap;
-
-// Next file / directory handle number.
-static atomic_int vfs_handle_no = 0;
+size_t           vfs_file_handle_list_len;
+// Capacity of open file handles table.
+size_t           vfs_file_handle_list_cap;
+// Stack of vacant slots in the file handle table.
+static size_t   *vfs_file_handle_vacant;
+// Number of vacant slots in the file handle table.
+static size_t    vfs_file_handle_vacant_len;
 
 // Abstraction for return thing from VFS.
 #define vfs_impl_return(type, method, ...)                                                                             \
@@ -74,177 +80,310 @@ static atomic_int vfs_handle_no = 0;
 
 
 
-// Create a new file_t number.
-static file_t next_fileno() {
-    return atomic_fetch_add(&vfs_handle_no, 1);
+// Hash a VFS and inode pair for the shared file handle table.
+static inline size_t shared_hash(vfs_t const *vfs, inode_t inode) {
+    size_t hash = (size_t)inode * 0x9e3779b1u;
+    return hash ^ ((size_t)vfs >> 4);
 }
 
 
 
-/* ==== Thread-unsafe functions ==== */
+/* ==== Handle tables ==== */
 
-// Look up shared file handle by pointer.
-static ptrdiff_t vfs_file_by_ptr(vfs_file_shared_t *ptr) {
-    for (size_t i = 0; i < vfs_file_shared_list_len; i++) {
-        if (vfs_file_shared_list[i] == ptr) {
-            return (ptrdiff_t)i;
+// Try to grow the shared file handle hash table.
+// If this fails, the table keeps working with longer chains.
+// Must be called with `vfs_shared_mtx` held exclusively.
+static void vfs_file_shared_rehash() {
+    size_t              new_len = vfs_file_shared_buckets_len ? vfs_file_shared_buckets_len * 2 : 16;
+    vfs_file_shared_t **buckets = calloc(new_len, sizeof(vfs_file_shared_t *));
+    if (!buckets)
+        return;
+
+    // Move all shared handles to the new table.
+    for (size_t i = 0; i < vfs_file_shared_buckets_len; i++) {
+        vfs_file_shared_t *cur = vfs_file_shared_buckets[i];
+        while (cur) {
+            vfs_file_shared_t *next = cur->hash_next;
+            size_t             slot = shared_hash(cur->vfs, cur->inode) & (new_len - 1);
+            cur->hash_next          = buckets[slot];
+            buckets[slot]           = cur;
+            cur                     = next;
         }
     }
-    return -1;
-}
 
-// Splice a shared file handle out of the list.
-static void vfs_file_shared_splice(ptrdiff_t i) {
-    // Remove an entry.
-    vfs_file_shared_list_len--;
-    if (vfs_file_shared_list_len) {
-        vfs_file_shared_list[i] = vfs_file_shared_list[vfs_file_shared_list_len];
-    }
+    free(vfs_file_shared_buckets);
+    vfs_file_shared_buckets     = buckets;
+    vfs_file_shared_buckets_len = new_len;
+}
 
-    if (vfs_file_shared_list_cap > vfs_file_shared_list_len * 2) {
-        // Shrink the array.
-        size_t new_cap = vfs_file_shared_list_cap / 2;
-        if (new_cap < 2)
-            new_cap = 2;
-        void *mem = realloc(vfs_file_shared_list, sizeof(vfs_file_shared_t *) * new_cap);
-        if (!mem)
-            return;
-        vfs_file_shared_list     = mem;
-        vfs_file_shared_list_cap = new_cap;
+// Find a shared file handle by inode without taking a reference.
+// Must be called with `vfs_shared_mtx` held.
+static vfs_file_shared_t *vfs_shared_find(vfs_t *vfs, inode_t inode) {
+    if (!vfs_file_shared_buckets_len)
+        return NULL;
+    vfs_file_shared_t *cur = vfs_file_shared_buckets[shared_hash(vfs, inode) & (vfs_file_shared_buckets_len - 1)];
+    while (cur) {
+        if (cur->vfs == vfs && cur->inode == inode) {
+            return cur;
+        }
+        cur = cur->hash_next;
     }
+    return NULL;
 }
 
-// Splice a file handle out of the list.
-static void vfs_file_handle_splice(ptrdiff_t i) {
-    // Remove an entry.
-    vfs_file_handle_list_len--;
-    if (vfs_file_handle_list_len) {
-        vfs_file_handle_list[i] = vfs_file_handle_list[vfs_file_handle_list_len];
+// Try to grow the file handle table.
+// Must be called with `vfs_handle_mtx` held exclusively.
+static bool vfs_file_handle_grow() {
+    size_t old_cap = vfs_file_handle_list_cap;
+    size_t new_cap = old_cap ? old_cap * 2 : 16;
+    if (new_cap > VFS_FILE_SLOT_MAX)
+        new_cap = VFS_FILE_SLOT_MAX;
+    if (new_cap <= old_cap)
+        return false;
+
+    void *mem = realloc(vfs_file_handle_vacant, sizeof(size_t) * new_cap);
+    if (!mem)
+        return false;
+    vfs_file_handle_vacant = mem;
+    mem                    = realloc(vfs_file_handle_list, sizeof(vfs_file_slot_t) * new_cap);
+    if (!mem)
+        return false;
+    vfs_file_handle_list     = mem;
+    vfs_file_handle_list_cap = new_cap;
+
+    // Add the new slots to the vacant stack with the lowest slot on top.
+    mem_set(vfs_file_handle_list + old_cap, 0, sizeof(vfs_file_slot_t) * (new_cap - old_cap));
+    for (size_t i = new_cap; i > old_cap; i--) {
+        vfs_file_handle_vacant[vfs_file_handle_vacant_len++] = i - 1;
     }
 
-    if (vfs_file_handle_list_cap > vfs_file_handle_list_len * 2) {
-        // Shrink the array.
-        size_t new_cap = vfs_file_handle_list_cap / 2;
-        if (new_cap < 2)
-            new_cap = 2;
-        void *mem = realloc(vfs_file_handle_list, sizeof(*vfs_file_handle_list) * new_cap);
-        if (!mem)
-            return;
-        vfs_file_handle_list     = mem;
-        vfs_file_handle_list_cap = new_cap;
-    }
+    return true;
 }
 
-// Find a shared file handle by inode, if any.
-ptrdiff_t vfs_shared_by_inode(vfs_t *vfs, inode_t inode) {
-    for (size_t i = 0; i < vfs_file_shared_list_len; i++) {
-        if (vfs_file_shared_list[i]->vfs == vfs && vfs_file_shared_list[i]->inode == inode) {
-            return (ptrdiff_t)i;
-        }
+// Find a shared file handle by inode and take a reference to it, if any.
+vfs_file_shared_t *vfs_shared_get(vfs_t *vfs, inode_t inode) {
+    assert_always(mutex_acquire_shared(NULL, &vfs_shared_mtx, VFS_MUTEX_TIMEOUT));
+    vfs_file_shared_t *shared = vfs->unmounting ? NULL : vfs_shared_find(vfs, inode);
+    if (shared) {
+        atomic_fetch_add_explicit(&shared->refcount, 1, memory_order_relaxed);
     }
-    return -1;
+    mutex_release_shared(NULL, &vfs_shared_mtx);
+    return shared;
 }
 
-// Get a file handle by number.
-ptrdiff_t vfs_file_by_handle(file_t fileno) {
-    for (size_t i = 0; i < vfs_file_handle_list_len; i++) {
-        if (vfs_file_handle_list[i].fileno == fileno) {
-            return (ptrdiff_t)i;
+// Drop a reference to a shared file handle.
+// If this was the last reference, the file is closed and the shared handle destroyed.
+void vfs_shared_put(vfs_file_shared_t *shared) {
+    // The decrement to zero and removal from the table happen atomically with respect to `vfs_shared_get`.
+    assert_always(mutex_acquire(NULL, &vfs_shared_mtx, VFS_MUTEX_TIMEOUT));
+    if (atomic_fetch_sub_explicit(&shared->refcount, 1, memory_order_acq_rel) != 1) {
+        mutex_release(NULL, &vfs_shared_mtx);
+        return;
+    }
+    if (shared->hashed) {
+        // Unlink from the hash table.
+        vfs_file_shared_t **cur
+            = &vfs_file_shared_buckets[shared_hash(shared->vfs, shared->inode) & (vfs_file_shared_buckets_len - 1)];
+        while (*cur != shared) {
+            cur = &(*cur)->hash_next;
         }
+        *cur = shared->hash_next;
     }
-    return -1;
+    mutex_release(NULL, &vfs_shared_mtx);
+
+    // Write back cached pages and close the file outside of the table lock.
+    vfs_pcache_flush(NULL, shared);
+    if (shared->pcache_dirty) {
+        // Dirty pages must not outlive the shared handle they are written back through.
+        logkf(LOG_ERROR, "Discarding unwritten pages of inode %{d}", (int)shared->inode);
+        vfs_pcache_drop_inode(shared->vfs, shared->inode);
+    }
+    vfs_file_close(NULL, shared);
+    vfs_file_destroy_shared(shared);
 }
 
-// Create a new empty shared file handle.
-ptrdiff_t vfs_file_create_shared() {
-    if (vfs_file_shared_list_len >= vfs_file_shared_list_cap) {
-        // Expand list.
-        size_t new_cap = vfs_file_shared_list_cap * 2;
-        if (new_cap < 2)
-            new_cap = 2;
-        void *mem = realloc(vfs_file_shared_list, sizeof(vfs_file_shared_t *) * new_cap);
-        if (!mem)
-            return -1;
-        vfs_file_shared_list     = mem;
-        vfs_file_shared_list_cap = new_cap;
+// Create a new empty shared file handle for a file on `vfs` with one reference.
+// Fails with `ECAUSE_INUSE` if the filesystem is being unmounted.
+vfs_file_shared_t *vfs_file_create_shared(badge_err_t *ec, vfs_t *vfs) {
+    // Allocate new shared handle.
+    vfs_file_shared_t *shptr = malloc(sizeof(vfs_file_shared_t));
+    if (!shptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+        return NULL;
     }
 
-    // Allocate new shared handle.
-    ptrdiff_t          shared = (ptrdiff_t)vfs_file_shared_list_len;
-    vfs_file_shared_t *shptr  = malloc(sizeof(vfs_file_shared_t));
-    if (!shptr)
-        return -1;
+    // Count the handle before the filesystem opens anything so unmounting waits for it.
+    assert_always(mutex_acquire_shared(NULL, &vfs_shared_mtx, VFS_MUTEX_TIMEOUT));
+    bool unmounting = vfs->unmounting;
+    if (!unmounting) {
+        atomic_fetch_add_explicit(&vfs->shared_count, 1, memory_order_relaxed);
+    }
+    mutex_release_shared(NULL, &vfs_shared_mtx);
+    if (unmounting) {
+        free(shptr);
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_INUSE);
+        return NULL;
+    }
     *shptr = (vfs_file_shared_t){
-        .refcount = 0,
-        .index    = shared,
-        .size     = 0,
-        .inode    = 0,
-        .vfs      = NULL,
+        .refcount     = 1,
+        .mutex        = MUTEX_T_INIT_SHARED,
+        .hash_next    = NULL,
+        .hashed       = false,
+        .size         = 0,
+        .pcache_dirty = 0,
+        .inode        = 0,
+        .vfs          = vfs,
     };
-    vfs_file_shared_list[vfs_file_shared_list_len] = shptr;
-    vfs_file_shared_list_len++;
+    atomic_fetch_add_explicit(&vfs_file_shared_list_len, 1, memory_order_relaxed);
+    badge_err_set_ok(ec);
+
+    return shptr;
+}
+
+// Set whether a filesystem is being unmounted; no shared handles are created or looked up for it while it is.
+void vfs_set_unmounting(vfs_t *vfs, bool unmounting) {
+    assert_always(mutex_acquire(NULL, &vfs_shared_mtx, VFS_MUTEX_TIMEOUT));
+    vfs->unmounting = unmounting;
+    mutex_release(NULL, &vfs_shared_mtx);
+}
 
+// Add a shared file handle to the lookup table once its `vfs` and `inode` are set.
+// If another shared handle for the same file was added concurrently, `shared` is closed and destroyed,
+// and a reference to the existing shared handle is returned instead.
+vfs_file_shared_t *vfs_file_register_shared(vfs_file_shared_t *shared) {
+    assert_dev_drop(!shared->hashed);
+    assert_always(mutex_acquire(NULL, &vfs_shared_mtx, VFS_MUTEX_TIMEOUT));
+
+    // Check for a shared handle opened concurrently.
+    vfs_file_shared_t *existing = vfs_shared_find(shared->vfs, shared->inode);
+    if (existing) {
+        atomic_fetch_add_explicit(&existing->refcount, 1, memory_order_relaxed);
+        mutex_release(NULL, &vfs_shared_mtx);
+        vfs_file_close(NULL, shared);
+        vfs_file_destroy_shared(shared);
+        return existing;
+    }
+
+    if (vfs_file_shared_list_len > vfs_file_shared_buckets_len) {
+        vfs_file_shared_rehash();
+    }
+    if (vfs_file_shared_buckets_len) {
+        size_t slot                   = shared_hash(shared->vfs, shared->inode) & (vfs_file_shared_buckets_len - 1);
+        shared->hash_next             = vfs_file_shared_buckets[slot];
+        shared->hashed                = true;
+        vfs_file_shared_buckets[slot] = shared;
+    }
+    // Without buckets, the handle is still usable but cannot be found by inode.
+
+    mutex_release(NULL, &vfs_shared_mtx);
     return shared;
 }
 
-// Create a new file handle.
-// If `shared` is -1, a new empty shared handle is created.
-ptrdiff_t vfs_file_create_handle(ptrdiff_t shared) {
-    if (shared == -1) {
-        // Allocate new shared handle.
-        shared = vfs_file_create_shared();
+// Destroy a shared file handle that is not in the lookup table, assuming the underlying file is already closed.
+void vfs_file_destroy_shared(vfs_file_shared_t *shared) {
+    atomic_fetch_sub_explicit(&vfs_file_shared_list_len, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&shared->vfs->shared_count, 1, memory_order_release);
+    mutex_destroy(NULL, &shared->mutex);
+    free(shared);
+}
+
+// Get a file handle by number and take a reference to it.
+vfs_file_handle_t *vfs_file_get(file_t fileno) {
+    if (fileno < 0)
+        return NULL;
+    size_t slot = (size_t)fileno & VFS_FILE_SLOT_MASK;
+
+    assert_always(mutex_acquire_shared(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+    vfs_file_handle_t *handle = NULL;
+    if (slot < vfs_file_handle_list_cap) {
+        handle = vfs_file_handle_list[slot].handle;
     }
-    if (shared < 0) {
-        // Failed to allocate or illegal argument.
-        return -1;
+    if (handle && handle->fileno == fileno) {
+        atomic_fetch_add_explicit(&handle->refcount, 1, memory_order_relaxed);
+    } else {
+        handle = NULL;
     }
+    mutex_release_shared(NULL, &vfs_handle_mtx);
 
-    if (vfs_file_handle_list_len >= vfs_file_handle_list_cap) {
-        // Expand list.
-        size_t new_cap = vfs_file_handle_list_cap * 2;
-        if (new_cap < 2)
-            new_cap = 2;
-        void *mem = realloc(vfs_file_handle_list, sizeof(*vfs_file_handle_list) * new_cap);
-        if (!mem)
-            return -1;
-        vfs_file_handle_list     = mem;
-        vfs_file_handle_list_cap = new_cap;
+    return handle;
+}
+
+// Drop a reference to a file handle.
+// If this was the last reference, the handle is freed and its shared handle released.
+void vfs_file_put(vfs_file_handle_t *handle) {
+    if (atomic_fetch_sub_explicit(&handle->refcount, 1, memory_order_acq_rel) != 1) {
+        return;
     }
+    vfs_shared_put(handle->shared);
+    mutex_destroy(NULL, &handle->mutex);
+    free(handle);
+}
 
+// Create a new file handle and add it to the file handle table.
+// On success, the caller's reference to `shared` is transferred to the new handle.
+// Returns the new handle number, or `FILE_NONE` if out of memory or handles.
+file_t vfs_file_create_handle(vfs_file_shared_t *shared, bool read, bool write, bool is_dir) {
     // Allocate new handle.
-    ptrdiff_t handle = (ptrdiff_t)vfs_file_handle_list_len;
-    vfs_file_handle_list_len++;
-    vfs_file_handle_list[handle] = (vfs_file_handle_t){
-        .offset = 0,
-        .shared = vfs_file_shared_list[shared],
-        .fileno = next_fileno(),
-        .mutex  = MUTEX_T_INIT,
+    vfs_file_handle_t *handle = malloc(sizeof(vfs_file_handle_t));
+    if (!handle)
+        return FILE_NONE;
+    *handle = (vfs_file_handle_t){
+        .refcount = 1,
+        .offset   = 0,
+        .read     = read,
+        .write    = write,
+        .is_dir   = is_dir,
+        .mutex    = MUTEX_T_INIT,
+        .shared   = shared,
     };
 
-    return handle;
-}
+    // Find a vacant slot.
+    assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+    if (!vfs_file_handle_vacant_len && !vfs_file_handle_grow()) {
+        mutex_release(NULL, &vfs_handle_mtx);
+        free(handle);
+        return FILE_NONE;
+    }
 
-// Destroy a shared file handle assuming the underlying file is already closed.
-void vfs_file_destroy_shared(ptrdiff_t shared) {
-    vfs_file_shared_splice(shared);
+    // Install in the handle table.
+    size_t slot = vfs_file_handle_vacant[--vfs_file_handle_vacant_len];
+    handle->fileno
+        = (file_t)(((vfs_file_handle_list[slot].gen & VFS_FILE_GEN_MASK) << VFS_FILE_SLOT_BITS) | (uint32_t)slot);
+    vfs_file_handle_list[slot].handle = handle;
+    vfs_file_handle_list_len++;
+    file_t fileno = handle->fileno;
+    mutex_release(NULL, &vfs_handle_mtx);
+
+    return fileno;
 }
 
-// Delete a file handle.
-// If this is the last handle referring to one file, the shared handle is closed too.
-void vfs_file_destroy_handle(ptrdiff_t handle) {
-    assert_dev_drop(handle >= 0 && handle < (ptrdiff_t)vfs_file_handle_list_len);
-
-    // Drop refcount.
-    vfs_file_handle_list[handle].shared->refcount--;
-    if (vfs_file_handle_list[handle].shared->refcount == 0) {
-        // Close shared handle.
-        vfs_file_close(NULL, vfs_file_handle_list[handle].shared);
-        ptrdiff_t shared = vfs_file_by_ptr(vfs_file_handle_list[handle].shared);
-        vfs_file_shared_splice(shared);
+// Remove a file handle from the file handle table and drop the table's reference to it.
+// Returns false if there is no such handle.
+bool vfs_file_destroy_handle(file_t fileno) {
+    if (fileno < 0)
+        return false;
+    size_t slot = (size_t)fileno & VFS_FILE_SLOT_MASK;
+
+    assert_always(mutex_acquire(NULL, &vfs_handle_mtx, VFS_MUTEX_TIMEOUT));
+    vfs_file_handle_t *handle = NULL;
+    if (slot < vfs_file_handle_list_cap) {
+        handle = vfs_file_handle_list[slot].handle;
     }
+    if (!handle || handle->fileno != fileno) {
+        mutex_release(NULL, &vfs_handle_mtx);
+        return false;
+    }
+
+    // Vacate the slot; the new generation invalidates stale handle numbers.
+    vfs_file_handle_list[slot].handle = NULL;
+    vfs_file_handle_list[slot].gen++;
+    vfs_file_handle_vacant[vfs_file_handle_vacant_len++] = slot;
+    vfs_file_handle_list_len--;
+    mutex_release(NULL, &vfs_handle_mtx);
 
-    // Splice the handle out of the list.
-    vfs_file_handle_splice(handle);
+    // Ongoing operations keep the handle alive until they finish.
+    vfs_file_put(handle);
+    return true;
 }
 
 
@@ -261,14 +400,24 @@ void vfs_root_open(badge_err_t *ec, vfs_file_shared_t *dir) {
 
 // Insert a new file into the given directory.
 // If the file already exists, does nothing.
-// If `open` is true, a new handle to the file is opened.
 void vfs_create_file(badge_err_t *ec, vfs_file_shared_t *dir, char const *name) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
     vfs_impl_call_void(dir->vfs->type, create_file, ec, dir->vfs, dir, name);
+    if (!badge_err_is_ok(ec)) {
+        return;
+    }
+
+    // The inode number may have belonged to a deleted file that still has cached pages.
+    dirent_t ent;
+    if (vfs_dir_find_ent(NULL, dir, &ent, name)) {
+        vfs_pcache_drop_inode(dir->vfs, ent.inode);
+    }
 }
 
 // Insert a new directory into the given directory.
 // If the file already exists, does nothing.
-// If `open` is true, a new handle to the directory is opened.
 void vfs_create_dir(badge_err_t *ec, vfs_file_shared_t *dir, char const *name) {
     vfs_impl_call_void(dir->vfs->type, create_dir, ec, dir->vfs, dir, name);
 }
@@ -281,10 +430,11 @@ void vfs_unlink(badge_err_t *ec, vfs_file_shared_t *dir, char const *name) {
 
 
 
-// Atomically read all directory entries and cache them into the directory handle.
-// Refer to `dirent_t` for the structure of the cache.
-void vfs_dir_read(badge_err_t *ec, vfs_file_handle_t *dir) {
-    vfs_impl_call_void(dir->shared->vfs->type, dir_read, ec, dir->shared->vfs, dir);
+// Read the directory entry at `*cookie` and advance `*cookie` to the next entry.
+// A cookie of 0 refers to the first entry; cookies stay valid while entries are added or removed.
+// Returns false without error at the end of the directory.
+bool vfs_dir_read(badge_err_t *ec, vfs_file_shared_t *dir, fileoff_t *cookie, dirent_t *out) {
+    vfs_impl_return(dir->vfs->type, dir_read, ec, dir->vfs, dir, cookie, out);
 }
 
 // Atomically read the directory entry with the matching name.
@@ -319,9 +469,19 @@ void vfs_file_open(
             // Create directory as requested.
             vfs_impl_call_void(vfs->type, create_dir, ec, vfs, dir, name);
 
-        } else {
+        } else if (!exists) {
             // Create file as requested.
             vfs_impl_call_void(vfs->type, create_file, ec, vfs, dir, name);
+            if (!badge_err_is_ok(ec)) {
+                return;
+            }
+
+            // Open the new file, then forget pages cached for a deleted file with the same inode number.
+            vfs_impl_call_void(vfs->type, file_open, ec, vfs, dir, file, name);
+            if (badge_err_is_ok(ec)) {
+                vfs_pcache_drop_inode(vfs, file->inode);
+            }
+            return;
         }
     }
 
@@ -338,18 +498,37 @@ void vfs_file_close(badge_err_t *ec, vfs_file_shared_t *file) {
 
 // Read bytes from a file.
 void vfs_file_read(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen) {
-    vfs_impl_call_void(file->vfs->type, file_read, ec, file->vfs, file, offset, readbuf, readlen);
+    vfs_pcache_read(ec, file, offset, readbuf, readlen);
 }
 
 // Write bytes to a file.
 void vfs_file_write(
     badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
 ) {
-    vfs_impl_call_void(file->vfs->type, file_write, ec, file->vfs, file, offset, writebuf, writelen);
+    vfs_pcache_write(ec, file, offset, writebuf, writelen);
 }
 
 // Change the length of a file opened by `vfs_file_open`.
 void vfs_file_resize(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t new_size) {
+    vfs_pcache_resize(ec, file, new_size);
+}
+
+// Read bytes from a file, bypassing the page cache.
+void vfs_file_read_direct(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen
+) {
+    vfs_impl_call_void(file->vfs->type, file_read, ec, file->vfs, file, offset, readbuf, readlen);
+}
+
+// Write bytes to a file, bypassing the page cache.
+void vfs_file_write_direct(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
+) {
+    vfs_impl_call_void(file->vfs->type, file_write, ec, file->vfs, file, offset, writebuf, writelen);
+}
+
+// Change the length of a file, bypassing the page cache.
+void vfs_file_resize_direct(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t new_size) {
     vfs_impl_call_void(file->vfs->type, file_resize, ec, file->vfs, file, new_size);
 }
 
@@ -360,3 +539,4 @@ void vfs_file_resize(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t new_siz
 void vfs_flush(badge_err_t *ec, vfs_t *vfs) {
     vfs_impl_call_void(vfs->type, flush, ec, vfs);
 }
+
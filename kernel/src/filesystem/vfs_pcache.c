@@ -0,0 +1,602 @@
+
+// SPDX-License-Identifier: MIT
+
+#include "filesystem/vfs_pcache.h"
+
+#include "assertions.h"
+#include "badge_strings.h"
+#include "filesystem/vfs_internal.h"
+#include "housekeeping.h"
+#include "log.h"
+#include "malloc.h"
+#include "page_alloc.h"
+#include "scheduler/scheduler.h"
+#if MEMMAP_VMEM
+#include "cpu/mmu.h"
+#endif
+
+// Bucket of the page cache hash table.
+typedef struct {
+    // Guards the pages in this bucket; shared to read cached data, exclusive to change pages.
+    mutex_t     mtx;
+    // First page in this bucket.
+    vfs_page_t *head;
+} pcache_bucket_t;
+
+// Hash table of cached pages, keyed by VFS, inode and page index.
+static pcache_bucket_t pcache_buckets[VFS_PCACHE_BUCKETS];
+// Mutex for the LRU list.
+// May be taken while holding a bucket mutex, but bucket mutexes may only be tried while holding this.
+static mutex_t         pcache_lru_mtx = MUTEX_T_INIT;
+// Most recently used page.
+static vfs_page_t     *pcache_lru_head;
+// Least recently used page.
+static vfs_page_t     *pcache_lru_tail;
+// Number of cached pages.
+static atomic_size_t   pcache_len;
+// Number of cached pages that are pinned.
+static atomic_size_t   pcache_pinned;
+
+
+
+// Hash function for the page cache.
+static size_t page_hash(vfs_t const *vfs, inode_t inode, fileoff_t index) {
+    size_t hash  = (size_t)inode * 0x9e3779b1u ^ ((size_t)vfs >> 4);
+    hash        ^= (size_t)index * 0x85ebca6bu;
+    return (hash ^ (hash >> 16)) & (VFS_PCACHE_BUCKETS - 1);
+}
+
+// Get the bucket that holds a page of a file.
+static pcache_bucket_t *page_bucket(vfs_t const *vfs, inode_t inode, fileoff_t index) {
+    return &pcache_buckets[page_hash(vfs, inode, index)];
+}
+
+// Get the bucket a page belongs to.
+static pcache_bucket_t *bucket_of(vfs_page_t const *page) {
+    return page_bucket(page->vfs, page->inode, page->index);
+}
+
+// Lock a bucket of the page cache.
+static void bucket_lock(pcache_bucket_t *bucket, bool exclusive) {
+    if (exclusive) {
+        assert_always(mutex_acquire(NULL, &bucket->mtx, VFS_MUTEX_TIMEOUT));
+    } else {
+        assert_always(mutex_acquire_shared(NULL, &bucket->mtx, VFS_MUTEX_TIMEOUT));
+    }
+}
+
+// Unlock a bucket of the page cache.
+static void bucket_unlock(pcache_bucket_t *bucket, bool exclusive) {
+    if (exclusive) {
+        mutex_release(NULL, &bucket->mtx);
+    } else {
+        mutex_release_shared(NULL, &bucket->mtx);
+    }
+}
+
+// Wait for another thread to finish with a busy page; the bucket is unlocked while waiting.
+static void bucket_wait(pcache_bucket_t *bucket, bool exclusive) {
+    bucket_unlock(bucket, exclusive);
+    thread_yield();
+    bucket_lock(bucket, exclusive);
+}
+
+// Get the kernel address of the memory of a page.
+static uint8_t *page_mem(vfs_page_t const *page) {
+#if MEMMAP_VMEM
+    return (uint8_t *)(page->ppn * MEMMAP_PAGE_SIZE + mmu_hhdm_vaddr);
+#else
+    return (uint8_t *)(page->ppn * MEMMAP_PAGE_SIZE);
+#endif
+}
+
+// Find a cached page in a bucket.
+static vfs_page_t *page_find(pcache_bucket_t *bucket, vfs_t *vfs, inode_t inode, fileoff_t index) {
+    vfs_page_t *cur = bucket->head;
+    while (cur) {
+        if (cur->vfs == vfs && cur->inode == inode && cur->index == index) {
+            return cur;
+        }
+        cur = cur->hash_next;
+    }
+    return NULL;
+}
+
+// Remove a page from the LRU list.
+static void lru_unlink(vfs_page_t *page) {
+    if (page->lru_prev) {
+        page->lru_prev->lru_next = page->lru_next;
+    } else {
+        pcache_lru_head = page->lru_next;
+    }
+    if (page->lru_next) {
+        page->lru_next->lru_prev = page->lru_prev;
+    } else {
+        pcache_lru_tail = page->lru_prev;
+    }
+    page->lru_prev = NULL;
+    page->lru_next = NULL;
+}
+
+// Insert a page at the most recently used end of the LRU list.
+static void lru_push(vfs_page_t *page) {
+    page->lru_prev = NULL;
+    page->lru_next = pcache_lru_head;
+    if (pcache_lru_head) {
+        pcache_lru_head->lru_prev = page;
+    } else {
+        pcache_lru_tail = page;
+    }
+    pcache_lru_head = page;
+}
+
+// Mark a page as dirty.
+static void page_set_dirty(vfs_page_t *page, vfs_file_shared_t *file) {
+    if (!page->dirty) {
+        page->dirty       = true;
+        page->dirty_since = time_us();
+        page->dirty_file  = file;
+        atomic_fetch_add(&file->pcache_dirty, 1);
+    }
+}
+
+// Mark a page as clean.
+static void page_set_clean(vfs_page_t *page) {
+    if (page->dirty) {
+        atomic_fetch_sub(&page->dirty_file->pcache_dirty, 1);
+        page->dirty      = false;
+        page->dirty_file = NULL;
+    }
+}
+
+// Write a dirty page back to its file.
+// Must be called with the page's bucket locked exclusively, the page not busy and `page->dirty_file->mutex` held.
+// The bucket is unlocked while the filesystem writes the page, during which readers can still use it.
+static void page_writeback(badge_err_t *ec, pcache_bucket_t *bucket, vfs_page_t *page) {
+    vfs_file_shared_t *file   = page->dirty_file;
+    fileoff_t          offset = page->index * VFS_PCACHE_PAGE_SIZE;
+    fileoff_t          len    = file->size - offset;
+    if (len > VFS_PCACHE_PAGE_SIZE) {
+        len = VFS_PCACHE_PAGE_SIZE;
+    }
+    badge_err_set_ok(ec);
+    if (len > 0) {
+        page->busy = true;
+        bucket_unlock(bucket, true);
+        vfs_file_write_direct(ec, file, offset, page_mem(page), len);
+        bucket_lock(bucket, true);
+        page->busy = false;
+    }
+    if (badge_err_is_ok(ec)) {
+        page_set_clean(page);
+    }
+}
+
+// Remove a page from its bucket without freeing it or removing it from the LRU list.
+// Must be called with the bucket locked exclusively.
+static void page_unhash(pcache_bucket_t *bucket, vfs_page_t *page) {
+    vfs_page_t **cur = &bucket->head;
+    while (*cur != page) {
+        cur = &(*cur)->hash_next;
+    }
+    *cur = page->hash_next;
+    atomic_fetch_sub(&pcache_len, 1);
+    if (page->pins) {
+        atomic_fetch_sub(&pcache_pinned, 1);
+    }
+}
+
+// Free the memory of a page that is no longer cached.
+static void page_free(vfs_page_t *page) {
+    phys_page_free(page->ppn);
+    free(page);
+}
+
+// Remove a page from the cache and free it, discarding any dirty data.
+// Pinned pages stay allocated until they are unpinned because processes still map them.
+// Must be called with the bucket locked exclusively and the page not busy.
+static void page_drop(pcache_bucket_t *bucket, vfs_page_t *page) {
+    page_set_clean(page);
+    page_unhash(bucket, page);
+    assert_always(mutex_acquire(NULL, &pcache_lru_mtx, VFS_MUTEX_TIMEOUT));
+    lru_unlink(page);
+    mutex_release(NULL, &pcache_lru_mtx);
+    if (page->pins) {
+        page->dropped = true;
+    } else {
+        page_free(page);
+    }
+}
+
+// Get an unused page, evicting the least recently used page if the cache is full or out of memory.
+// Pages used since eviction last looked at them get a second chance.
+// Dirty pages of `file` can be written back because the caller holds its mutex;
+// those of other files are only written back if their mutex is free right away and skipped otherwise.
+// Must be called without any bucket locked.
+static vfs_page_t *page_alloc(badge_err_t *ec, vfs_file_shared_t *file) {
+    if (atomic_load(&pcache_len) - atomic_load(&pcache_pinned) < VFS_PCACHE_MAX_PAGES) {
+        vfs_page_t *page = malloc(sizeof(vfs_page_t));
+        size_t      ppn  = page ? phys_page_alloc(1, false) : 0;
+        if (ppn) {
+            page->ppn = ppn;
+            return page;
+        }
+        free(page);
+    }
+
+    assert_always(mutex_acquire(NULL, &pcache_lru_mtx, VFS_MUTEX_TIMEOUT));
+    // Each page is looked at about twice so referenced pages can't make this loop forever.
+    size_t      budget = 2 * atomic_load(&pcache_len);
+    vfs_page_t *victim = pcache_lru_tail;
+    while (victim && budget--) {
+        vfs_page_t      *prev   = victim->lru_prev;
+        pcache_bucket_t *bucket = bucket_of(victim);
+        if (atomic_exchange(&victim->referenced, false)) {
+            lru_unlink(victim);
+            lru_push(victim);
+            victim = prev;
+            continue;
+        }
+        if (!mutex_acquire(NULL, &bucket->mtx, 0)) {
+            victim = prev;
+            continue;
+        } else if (victim->pins || victim->busy) {
+            mutex_release(NULL, &bucket->mtx);
+            victim = prev;
+            continue;
+        }
+
+        if (victim->dirty) {
+            vfs_file_shared_t *owner = victim->dirty_file;
+            if (owner != file && !mutex_acquire_shared(NULL, &owner->mutex, 0)) {
+                mutex_release(NULL, &bucket->mtx);
+                victim = prev;
+                continue;
+            }
+            mutex_release(NULL, &pcache_lru_mtx);
+            badge_err_t ec0;
+            page_writeback(&ec0, bucket, victim);
+            if (owner != file) {
+                mutex_release_shared(NULL, &owner->mutex);
+            }
+            assert_always(mutex_acquire(NULL, &pcache_lru_mtx, VFS_MUTEX_TIMEOUT));
+            if (!badge_err_is_ok(&ec0)) {
+                // The list may have changed while it was unlocked.
+                mutex_release(NULL, &bucket->mtx);
+                victim = pcache_lru_tail;
+                continue;
+            }
+        }
+
+        page_unhash(bucket, victim);
+        lru_unlink(victim);
+        mutex_release(NULL, &pcache_lru_mtx);
+        mutex_release(NULL, &bucket->mtx);
+        return victim;
+    }
+    mutex_release(NULL, &pcache_lru_mtx);
+    badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+    return NULL;
+}
+
+// Add a new page of a file to the cache; it is busy and not valid until its data is loaded.
+// Must be called with the bucket locked exclusively.
+static void page_insert(pcache_bucket_t *bucket, vfs_page_t *page, vfs_file_shared_t *file, fileoff_t index) {
+    page->vfs        = file->vfs;
+    page->inode      = file->inode;
+    page->index      = index;
+    page->dirty      = false;
+    page->dirty_file = NULL;
+    page->pins       = 0;
+    page->busy       = true;
+    page->valid      = false;
+    page->dropped    = false;
+    atomic_store(&page->referenced, false);
+
+    page->hash_next = bucket->head;
+    bucket->head    = page;
+    assert_always(mutex_acquire(NULL, &pcache_lru_mtx, VFS_MUTEX_TIMEOUT));
+    lru_push(page);
+    mutex_release(NULL, &pcache_lru_mtx);
+    atomic_fetch_add(&pcache_len, 1);
+}
+
+// Get the page of a file at a given index, loading it if it is not cached.
+// If `load` is false, a newly cached page is zeroed instead of read because the caller overwrites it entirely.
+// Returns with the page's bucket locked exclusively if `exclusive` is true and shared otherwise.
+// A page returned exclusively is not busy; a page returned shared may be being written back.
+static vfs_page_t *page_get(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t index, bool load, bool exclusive) {
+    pcache_bucket_t *bucket = page_bucket(file->vfs, file->inode, index);
+    while (true) {
+        bucket_lock(bucket, exclusive);
+        vfs_page_t *page = page_find(bucket, file->vfs, file->inode, index);
+        while (page && (!page->valid || (exclusive && page->busy))) {
+            bucket_wait(bucket, exclusive);
+            page = page_find(bucket, file->vfs, file->inode, index);
+        }
+        if (page) {
+            atomic_store(&page->referenced, true);
+            badge_err_set_ok(ec);
+            return page;
+        }
+        bucket_unlock(bucket, exclusive);
+
+        page = page_alloc(ec, file);
+        if (!page) {
+            return NULL;
+        }
+        bucket_lock(bucket, true);
+        if (page_find(bucket, file->vfs, file->inode, index)) {
+            // Another thread cached the page in the meantime.
+            bucket_unlock(bucket, true);
+            page_free(page);
+            continue;
+        }
+        page_insert(bucket, page, file, index);
+        bucket_unlock(bucket, true);
+
+        // Read the part of the page that lies within the file; the rest is zero.
+        uint8_t  *mem    = page_mem(page);
+        fileoff_t offset = index * VFS_PCACHE_PAGE_SIZE;
+        fileoff_t len    = file->size - offset;
+        if (!load || len < 0) {
+            len = 0;
+        } else if (len > VFS_PCACHE_PAGE_SIZE) {
+            len = VFS_PCACHE_PAGE_SIZE;
+        }
+        badge_err_set_ok(ec);
+        if (len) {
+            vfs_file_read_direct(ec, file, offset, mem, len);
+        }
+        mem_set(mem + len, 0, VFS_PCACHE_PAGE_SIZE - len);
+
+        bucket_lock(bucket, true);
+        page->busy = false;
+        if (!badge_err_is_ok(ec)) {
+            page_drop(bucket, page);
+            bucket_unlock(bucket, true);
+            return NULL;
+        }
+        page->valid = true;
+        if (exclusive) {
+            return page;
+        }
+        // Look the page up again with a shared lock.
+        bucket_unlock(bucket, true);
+    }
+}
+
+// Write back the dirty pages of `file`, or of all files if it is NULL, that were made dirty no later than `before`.
+// If `file` is NULL, each page's file mutex is only taken if it is free right away;
+// pages of files locked by another thread are then retried until written if `wait` is true and skipped otherwise.
+static void pcache_writeback(badge_err_t *ec, vfs_file_shared_t *file, timestamp_us_t before, bool wait) {
+    badge_err_set_ok(ec);
+    for (size_t i = 0; i < VFS_PCACHE_BUCKETS && !(file && !atomic_load(&file->pcache_dirty)); i++) {
+        pcache_bucket_t *bucket  = &pcache_buckets[i];
+        bool             skipped = false;
+        bucket_lock(bucket, true);
+        vfs_page_t *page = bucket->head;
+        while (page) {
+            vfs_file_shared_t *owner = page->dirty_file;
+            if (page->dirty && page->dirty_since <= before && (!file || owner == file)) {
+                if (page->busy || (!file && !mutex_acquire_shared(NULL, &owner->mutex, 0))) {
+                    skipped = true;
+                } else {
+                    badge_err_t ec0;
+                    page_writeback(&ec0, bucket, page);
+                    if (!file) {
+                        mutex_release_shared(NULL, &owner->mutex);
+                    }
+                    if (!badge_err_is_ok(&ec0)) {
+                        logkf(LOG_WARN, "Page cache writeback failed for inode %{d}", (int)page->inode);
+                        if (ec) {
+                            *ec = ec0;
+                        }
+                    }
+                }
+            }
+
+            // Busy pages are never removed, so this page is still in the bucket even if it was unlocked.
+            page = page->hash_next;
+            if (!page && skipped && (file || wait)) {
+                bucket_wait(bucket, true);
+                skipped = false;
+                page    = bucket->head;
+            }
+        }
+        bucket_unlock(bucket, true);
+    }
+}
+
+// Drop the cached pages of an inode from page index `first` onwards, or of all inodes if `inode` is NULL.
+static void pcache_drop(vfs_t *vfs, inode_t const *inode, fileoff_t first) {
+    for (size_t i = 0; i < VFS_PCACHE_BUCKETS; i++) {
+        pcache_bucket_t *bucket = &pcache_buckets[i];
+        bucket_lock(bucket, true);
+        vfs_page_t *page = bucket->head;
+        while (page) {
+            vfs_page_t *next = page->hash_next;
+            if (page->vfs == vfs && (!inode || (page->inode == *inode && page->index >= first))) {
+                if (page->busy) {
+                    bucket_wait(bucket, true);
+                    next = bucket->head;
+                } else {
+                    page_drop(bucket, page);
+                }
+            }
+            page = next;
+        }
+        bucket_unlock(bucket, true);
+    }
+}
+
+// Write back dirty pages that have been dirty for long enough.
+static void pcache_housekeeping(int taskno, void *arg) {
+    (void)taskno;
+    (void)arg;
+    pcache_writeback(NULL, NULL, time_us() - VFS_PCACHE_WRITEBACK_AGE, false);
+}
+
+
+
+// Start periodic writeback of dirty pages.
+void vfs_pcache_init() {
+    for (size_t i = 0; i < VFS_PCACHE_BUCKETS; i++) {
+        mutex_init(NULL, &pcache_buckets[i].mtx, true, false);
+    }
+    assert_always(hk_add_repeated(0, VFS_PCACHE_WRITEBACK_TIME, pcache_housekeeping, NULL) != -1);
+}
+
+// Read bytes from a file through the page cache.
+// The caller must hold `file->mutex` and the read must lie within the file.
+void vfs_pcache_read(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t *readbuf, fileoff_t readlen) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+    while (readlen > 0) {
+        fileoff_t index   = offset / VFS_PCACHE_PAGE_SIZE;
+        fileoff_t pageoff = offset % VFS_PCACHE_PAGE_SIZE;
+        fileoff_t count   = VFS_PCACHE_PAGE_SIZE - pageoff;
+        if (count > readlen) {
+            count = readlen;
+        }
+
+        vfs_page_t *page = page_get(ec, file, index, true, false);
+        if (page) {
+            mem_copy(readbuf, page_mem(page) + pageoff, count);
+            bucket_unlock(bucket_of(page), false);
+        } else if (ec->cause == ECAUSE_NOMEM) {
+            // The page is not cached, so the filesystem has the current data.
+            vfs_file_read_direct(ec, file, offset, readbuf, count);
+        }
+        if (!badge_err_is_ok(ec)) {
+            break;
+        }
+
+        offset  += count;
+        readbuf += count;
+        readlen -= count;
+    }
+}
+
+// Write bytes to a file through the page cache.
+// The caller must hold `file->mutex` exclusively and the file must already be large enough.
+void vfs_pcache_write(
+    badge_err_t *ec, vfs_file_shared_t *file, fileoff_t offset, uint8_t const *writebuf, fileoff_t writelen
+) {
+    badge_err_t ec0;
+    if (!ec)
+        ec = &ec0;
+    badge_err_set_ok(ec);
+    while (writelen > 0) {
+        fileoff_t index   = offset / VFS_PCACHE_PAGE_SIZE;
+        fileoff_t pageoff = offset % VFS_PCACHE_PAGE_SIZE;
+        fileoff_t count   = VFS_PCACHE_PAGE_SIZE - pageoff;
+        if (count > writelen) {
+            count = writelen;
+        }
+
+        vfs_page_t *page = page_get(ec, file, index, count < VFS_PCACHE_PAGE_SIZE, true);
+        if (page) {
+            mem_copy(page_mem(page) + pageoff, writebuf, count);
+            page_set_dirty(page, file);
+            bucket_unlock(bucket_of(page), true);
+        } else if (ec->cause == ECAUSE_NOMEM) {
+            // The page is not cached, so the data can go straight to the filesystem.
+            vfs_file_write_direct(ec, file, offset, writebuf, count);
+        }
+        if (!badge_err_is_ok(ec)) {
+            break;
+        }
+
+        offset   += count;
+        writebuf += count;
+        writelen -= count;
+    }
+}
+
+// Change the length of a file, dropping cached pages past the new end.
+// The caller must hold `file->mutex` exclusively.
+void vfs_pcache_resize(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t new_size) {
+    if (new_size >= 0 && new_size < file->size) {
+        // Drop pages entirely past the new end.
+        pcache_drop(file->vfs, &file->inode, (new_size + VFS_PCACHE_PAGE_SIZE - 1) / VFS_PCACHE_PAGE_SIZE);
+
+        // Zero the tail of the new last page so growing the file again reads zeroes.
+        if (new_size % VFS_PCACHE_PAGE_SIZE) {
+            fileoff_t        index  = new_size / VFS_PCACHE_PAGE_SIZE;
+            pcache_bucket_t *bucket = page_bucket(file->vfs, file->inode, index);
+            bucket_lock(bucket, true);
+            vfs_page_t *page = page_find(bucket, file->vfs, file->inode, index);
+            while (page && page->busy) {
+                bucket_wait(bucket, true);
+                page = page_find(bucket, file->vfs, file->inode, index);
+            }
+            if (page) {
+                fileoff_t pageoff = new_size % VFS_PCACHE_PAGE_SIZE;
+                mem_set(page_mem(page) + pageoff, 0, VFS_PCACHE_PAGE_SIZE - pageoff);
+            }
+            bucket_unlock(bucket, true);
+        }
+    }
+    // Writeback holds `file->mutex`, so the size can't change underneath it.
+    vfs_file_resize_direct(ec, file, new_size);
+}
+
+// Pin the page of a file at a given index in the cache so it can be mapped into a process.
+// Pinned pages do not count towards `VFS_PCACHE_MAX_PAGES`.
+// The caller must hold `file->mutex` and the page must lie within the file.
+vfs_page_t *vfs_pcache_pin(badge_err_t *ec, vfs_file_shared_t *file, fileoff_t index) {
+    vfs_page_t *page = page_get(ec, file, index, true, true);
+    if (page) {
+        if (!page->pins++) {
+            atomic_fetch_add(&pcache_pinned, 1);
+        }
+        bucket_unlock(bucket_of(page), true);
+    }
+    return page;
+}
+
+// Get the kernel address of the memory of a pinned page.
+uint8_t *vfs_pcache_page_mem(vfs_page_t const *page) {
+    return page_mem(page);
+}
+
+// Release a page pinned by `vfs_pcache_pin`.
+// If the page was dropped from the cache while pinned, its memory is freed now.
+void vfs_pcache_unpin(vfs_page_t *page) {
+    // Dropped pages keep their key, so they are still guarded by the same bucket.
+    pcache_bucket_t *bucket = bucket_of(page);
+    bucket_lock(bucket, true);
+    assert_dev_drop(page->pins > 0);
+    if (--page->pins == 0) {
+        if (!page->dropped) {
+            atomic_fetch_sub(&pcache_pinned, 1);
+        } else {
+            page_free(page);
+        }
+    }
+    bucket_unlock(bucket, true);
+}
+
+// Write back the dirty pages of a file.
+// The caller must hold `file->mutex` or otherwise be its only user.
+void vfs_pcache_flush(badge_err_t *ec, vfs_file_shared_t *file) {
+    pcache_writeback(ec, file, TIMESTAMP_US_MAX, true);
+}
+
+// Write back all dirty pages.
+void vfs_pcache_flush_all(badge_err_t *ec) {
+    pcache_writeback(ec, NULL, time_us(), true);
+}
+
+// Drop all cached pages of an inode, e.g. because its number was reused for a new file.
+void vfs_pcache_drop_inode(vfs_t *vfs, inode_t inode) {
+    pcache_drop(vfs, &inode, 0);
+}
+
+// Drop all cached pages of a filesystem that is being unmounted.
+void vfs_pcache_drop_vfs(vfs_t *vfs) {
+    pcache_drop(vfs, NULL, 0);
+}
@@ -9,19 +9,54 @@
 
 
 
+// Number of inodes per word in the inode usage bitmap.
+#define USAGE_BITS (sizeof(size_t) * 8)
+// Bit position of the directory generation in a directory read cookie; the entry offset is stored below it.
+#define DIR_COOKIE_GEN_SHIFT (sizeof(fileoff_t) > 4 ? 32 : 24)
+// Bit mask of the directory generation in a directory read cookie after shifting; leaves the sign bit clear.
+#define DIR_COOKIE_GEN_MASK  ((uint32_t)(((unsigned long)-1 >> 1) >> DIR_COOKIE_GEN_SHIFT))
+// Bit mask of the entry offset in a directory read cookie.
+#define DIR_COOKIE_OFF_MASK  (((fileoff_t)1 << DIR_COOKIE_GEN_SHIFT) - 1)
+
+
+
+// Try to reserve RAM for the filesystem; releases RAM if `new_size < old_size`.
+// Returns false if this would exceed the RAM limit.
+static bool reserve_ram(vfs_t *vfs, size_t old_size, size_t new_size) {
+    if (new_size <= old_size) {
+        atomic_fetch_sub_explicit(&vfs->ramfs.ram_usage, old_size - new_size, memory_order_relaxed);
+        return true;
+    }
+
+    size_t diff  = new_size - old_size;
+    size_t usage = atomic_load_explicit(&vfs->ramfs.ram_usage, memory_order_relaxed);
+    do {
+        if (diff > vfs->ramfs.ram_limit - usage) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(
+        &vfs->ramfs.ram_usage,
+        &usage,
+        usage + diff,
+        memory_order_relaxed,
+        memory_order_relaxed
+    ));
+    return true;
+}
+
 // Try to resize an inode.
 static bool resize_inode(badge_err_t *ec, vfs_t *vfs, vfs_ramfs_inode_t *inode, size_t size) {
-    (void)vfs;
-
-    if (inode->cap >= 2 * size) {
+    if (inode->cap && inode->cap >= 2 * size) {
         // If capacity is too large, try to save some memory.
         size_t cap = inode->cap / 2;
-        void  *mem = realloc(inode->buf, inode->cap / 2);
+        void  *mem = realloc(inode->buf, cap);
         if (mem || cap == 0) {
-            inode->cap /= 2;
-            inode->buf  = mem;
+            reserve_ram(vfs, inode->cap, cap);
+            inode->cap = cap;
+            inode->buf = mem;
         }
         inode->len = size;
+        badge_err_set_ok(ec);
         return true;
 
     } else if (inode->cap >= size) {
@@ -36,25 +71,87 @@ static bool resize_inode(badge_err_t *ec, vfs_t *vfs, vfs_ramfs_inode_t *inode,
         while (cap < size) {
             cap *= 2;
         }
+        if (!reserve_ram(vfs, inode->cap, cap)) {
+            badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOSPACE);
+            return false;
+        }
         void *mem = realloc(inode->buf, cap);
         if (mem) {
             inode->cap = cap;
             inode->buf = mem;
             inode->len = size;
+            badge_err_set_ok(ec);
             return true;
         } else {
+            reserve_ram(vfs, cap, inode->cap);
+            badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+            return false;
+        }
+    }
+}
+
+// Mark an inode as used or unused in the inode usage bitmap.
+static inline void set_inode_usage(vfs_t *vfs, size_t inum, bool used) {
+    if (used) {
+        vfs->ramfs.inode_usage[inum / USAGE_BITS] |= (size_t)1 << (inum % USAGE_BITS);
+    } else {
+        vfs->ramfs.inode_usage[inum / USAGE_BITS] &= ~((size_t)1 << (inum % USAGE_BITS));
+    }
+}
+
+// Try to grow the inode table, up to the inode limit.
+static bool grow_inode_table(vfs_t *vfs) {
+    size_t old_len = vfs->ramfs.inode_list_len;
+    size_t new_len = old_len * 2;
+    if (new_len > vfs->ramfs.inode_limit) {
+        new_len = vfs->ramfs.inode_limit;
+    }
+    if (new_len <= old_len) {
+        return false;
+    }
+
+    // Grow the inode table.
+    vfs_ramfs_inode_t **list = realloc(vfs->ramfs.inode_list, sizeof(*list) * new_len);
+    if (!list) {
+        return false;
+    }
+    vfs->ramfs.inode_list = list;
+    mem_set(list + old_len, 0, sizeof(*list) * (new_len - old_len));
+
+    // Grow the usage bitmap.
+    size_t old_words = (old_len + USAGE_BITS - 1) / USAGE_BITS;
+    size_t new_words = (new_len + USAGE_BITS - 1) / USAGE_BITS;
+    if (new_words > old_words) {
+        size_t *usage = realloc(vfs->ramfs.inode_usage, sizeof(size_t) * new_words);
+        if (!usage) {
             return false;
         }
+        vfs->ramfs.inode_usage = usage;
+        mem_set(usage + old_words, 0, sizeof(size_t) * (new_words - old_words));
     }
+
+    vfs->ramfs.inode_list_len = new_len;
+    return true;
 }
 
-// Find an empty inode.
+// Find an empty inode, growing the inode table if it is full.
 static ptrdiff_t find_inode(vfs_t *vfs) {
-    for (size_t i = VFS_RAMFS_INODE_FIRST; i < vfs->ramfs.inode_list_len; i++) {
-        if (!vfs->ramfs.inode_usage[i])
-            return (ptrdiff_t)i;
+    while (true) {
+        size_t words = (vfs->ramfs.inode_list_len + USAGE_BITS - 1) / USAGE_BITS;
+        for (size_t i = 0; i < words; i++) {
+            size_t vacant = ~vfs->ramfs.inode_usage[i];
+            if (vacant) {
+                size_t inum = i * USAGE_BITS + (size_t)__builtin_ctzl(vacant);
+                if (inum < vfs->ramfs.inode_list_len) {
+                    return (ptrdiff_t)inum;
+                }
+                break;
+            }
+        }
+        if (!grow_inode_table(vfs)) {
+            return -1;
+        }
     }
-    return -1;
 }
 
 // Decrease the refcount of an inode and delete it if it reaches 0.
@@ -62,13 +159,41 @@ static void pop_inode_refcount(vfs_t *vfs, vfs_ramfs_inode_t *inode) {
     inode->links--;
     if (inode->links == 0) {
         // Free inode.
+        reserve_ram(vfs, inode->cap + sizeof(vfs_ramfs_inode_t), 0);
+        set_inode_usage(vfs, inode->inode, false);
+        vfs->ramfs.inode_list[inode->inode] = NULL;
         free(inode->buf);
-        vfs->ramfs.inode_usage[inode->inode] = false;
+        free(inode);
     }
 }
 
 // Insert a new directory entry.
+// Reuses the space of a removed entry if one is large enough, or appends to the directory otherwise.
 static bool insert_dirent(badge_err_t *ec, vfs_t *vfs, vfs_ramfs_inode_t *dir, vfs_ramfs_dirent_t *ent) {
+    // Look for a removed entry to reuse; what is left of it stays a removed entry if large enough for one.
+    size_t min_size = offsetof(vfs_ramfs_dirent_t, name) + 1;
+    min_size       += (~min_size + 1) % sizeof(size_t);
+    size_t off      = 0;
+    while (off < dir->len) {
+        vfs_ramfs_dirent_t *cur = (vfs_ramfs_dirent_t *)(dir->buf + off);
+        if (cur->inode == INODE_NONE && cur->size >= ent->size) {
+            size_t size = cur->size;
+            mem_copy(cur, ent, ent->size);
+            if (size - ent->size >= min_size) {
+                vfs_ramfs_dirent_t *rest = (vfs_ramfs_dirent_t *)(dir->buf + off + ent->size);
+                rest->size               = size - ent->size;
+                rest->inode              = INODE_NONE;
+                rest->name_len           = 0;
+                rest->name[0]            = 0;
+            } else {
+                cur->size = size;
+            }
+            badge_err_set_ok(ec);
+            return true;
+        }
+        off += cur->size;
+    }
+
     // Allocate space in the directory.
     size_t pre_size = dir->len;
     if (!resize_inode(ec, vfs, dir, pre_size + ent->size)) {
@@ -81,16 +206,49 @@ static bool insert_dirent(badge_err_t *ec, vfs_t *vfs, vfs_ramfs_inode_t *dir, v
 }
 
 // Remove a directory entry.
-// Takes a pointer to an entry in the directory's buffer.
+// Takes a pointer to an entry in the directory's buffer, which is no longer valid afterwards.
+// The entry is marked as removed and merged with adjacent removed entries, or trimmed if it ends up last.
 static void remove_dirent(vfs_t *vfs, vfs_ramfs_inode_t *dir, vfs_ramfs_dirent_t *ent) {
-    size_t off      = (size_t)ent - (size_t)dir->buf;
-    size_t ent_size = ent->size;
-
-    // Copy back entries further in.
-    mem_copy(dir->buf + off, dir->buf + off + ent_size, dir->len - ent_size);
+    ent->inode    = INODE_NONE;
+    ent->name_len = 0;
+    ent->name[0]  = 0;
+
+    // Find the entry before this one.
+    size_t ent_off  = (size_t)((char *)ent - dir->buf);
+    size_t prev_off = 0;
+    size_t off      = 0;
+    while (off < ent_off) {
+        prev_off  = off;
+        off      += ((vfs_ramfs_dirent_t *)(dir->buf + off))->size;
+    }
+
+    // Merge with removed entries before and after this one.
+    vfs_ramfs_dirent_t *prev  = (vfs_ramfs_dirent_t *)(dir->buf + prev_off);
+    bool                moved = false;
+    if (ent_off && prev->inode == INODE_NONE) {
+        prev->size += ent->size;
+        ent         = prev;
+        ent_off     = prev_off;
+        moved       = true;
+    }
+    while (ent_off + ent->size < dir->len) {
+        vfs_ramfs_dirent_t *next = (vfs_ramfs_dirent_t *)(dir->buf + ent_off + ent->size);
+        if (next->inode != INODE_NONE) {
+            break;
+        }
+        ent->size += next->size;
+        moved      = true;
+    }
 
-    // Resize the buffer.
-    resize_inode(NULL, vfs, dir, dir->len - ent_size);
+    // Removed entries at the end of the directory take up no space.
+    if (ent_off + ent->size == dir->len) {
+        resize_inode(NULL, vfs, dir, ent_off);
+        moved = true;
+    }
+    if (moved) {
+        // Offsets of entries may now lie inside other entries; see `vfs_ramfs_dir_read`.
+        dir->dir_gen++;
+    }
 }
 
 // Find the directory entry of a given filename in a directory.
@@ -101,7 +259,7 @@ static vfs_ramfs_dirent_t *find_dirent(badge_err_t *ec, vfs_t *vfs, vfs_ramfs_in
     size_t off = 0;
     while (off < dir->len) {
         vfs_ramfs_dirent_t *ent = (vfs_ramfs_dirent_t *)(dir->buf + off);
-        if (cstr_equals(name, ent->name)) {
+        if (ent->inode != INODE_NONE && cstr_equals(name, ent->name)) {
             return ent;
         }
         off += ent->size;
@@ -116,6 +274,7 @@ static vfs_ramfs_inode_t *
     size_t name_len = cstr_length_upto(name, VFS_RAMFS_NAME_MAX + 1);
     if (name_len > VFS_RAMFS_NAME_MAX) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_TOOLONG);
+        return NULL;
     }
     assert_always(mutex_acquire(NULL, &vfs->ramfs.mtx, VFS_MUTEX_TIMEOUT));
 
@@ -145,24 +304,43 @@ static vfs_ramfs_inode_t *
     ent.size += (~ent.size + 1) % sizeof(size_t);
     mem_copy(ent.name, name, name_len + 1);
 
-    // Set up inode.
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[inum];
+    // Allocate inode.
+    if (!reserve_ram(vfs, 0, sizeof(vfs_ramfs_inode_t))) {
+        mutex_release(NULL, &vfs->ramfs.mtx);
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOSPACE);
+        return NULL;
+    }
+    vfs_ramfs_inode_t *iptr = malloc(sizeof(vfs_ramfs_inode_t));
+    if (!iptr) {
+        reserve_ram(vfs, sizeof(vfs_ramfs_inode_t), 0);
+        mutex_release(NULL, &vfs->ramfs.mtx);
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+        return NULL;
+    }
 
-    iptr->buf   = NULL;
-    iptr->len   = 0;
-    iptr->cap   = 0;
-    iptr->inode = inum;
-    iptr->mode  = (type << VFS_RAMFS_MODE_BIT) | 0777; /* TODO. */
-    iptr->links = 1;
-    iptr->uid   = 0; /* TODO. */
-    iptr->gid   = 0; /* TODO. */
+    // Set up inode.
+    iptr->buf     = NULL;
+    iptr->len     = 0;
+    iptr->cap     = 0;
+    iptr->inode   = inum;
+    iptr->mode    = (type << VFS_RAMFS_MODE_BIT) | 0777; /* TODO. */
+    iptr->links   = 1;
+    iptr->uid     = 0; /* TODO. */
+    iptr->gid     = 0; /* TODO. */
+    iptr->dir_gen = 0;
 
     // Copy into the end of the directory.
-    if (insert_dirent(ec, vfs, dirptr, &ent)) {
-        // If successful, mark inode as in use.
-        vfs->ramfs.inode_usage[inum] = true;
+    if (!insert_dirent(ec, vfs, dirptr, &ent)) {
+        reserve_ram(vfs, sizeof(vfs_ramfs_inode_t), 0);
+        free(iptr);
+        mutex_release(NULL, &vfs->ramfs.mtx);
+        return NULL;
     }
 
+    // If successful, mark inode as in use.
+    vfs->ramfs.inode_list[inum] = iptr;
+    set_inode_usage(vfs, inum, true);
+
     mutex_release(NULL, &vfs->ramfs.mtx);
     return iptr;
 }
@@ -172,7 +350,7 @@ static bool is_dir_empty(vfs_ramfs_inode_t *dir) {
     size_t off = 0;
     while (off < dir->len) {
         vfs_ramfs_dirent_t *ent = (vfs_ramfs_dirent_t *)(dir->buf + off);
-        if (!cstr_equals(".", ent->name) && !cstr_equals("..", ent->name)) {
+        if (ent->inode != INODE_NONE && !cstr_equals(".", ent->name) && !cstr_equals("..", ent->name)) {
             return false;
         }
         off += ent->size;
@@ -183,36 +361,52 @@ static bool is_dir_empty(vfs_ramfs_inode_t *dir) {
 
 
 // Try to mount a ramfs filesystem.
-void vfs_ramfs_mount(badge_err_t *ec, vfs_t *vfs) {
+void vfs_ramfs_mount(badge_err_t *ec, vfs_t *vfs, mountopts_t const *opts) {
     // RAMFS does not use a block device.
     if (vfs->media) {
         badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
         return;
     }
 
-    // TODO: Parameters.
+    // Apply mount options.
+    size_t ram_limit   = opts->ramfs_ram_limit ? opts->ramfs_ram_limit : VFS_RAMFS_DEFAULT_RAM_LIMIT;
+    size_t inode_limit = opts->ramfs_inode_limit ? opts->ramfs_inode_limit : VFS_RAMFS_DEFAULT_INODE_LIMIT;
+    if (inode_limit <= VFS_RAMFS_INODE_FIRST) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_PARAM);
+        return;
+    }
+    size_t inode_list_len = VFS_RAMFS_INODE_INITIAL;
+    if (inode_list_len > inode_limit) {
+        inode_list_len = inode_limit;
+    }
+    size_t usage_words = (inode_list_len + USAGE_BITS - 1) / USAGE_BITS;
+
     atomic_store_explicit(&vfs->ramfs.ram_usage, 0, memory_order_relaxed);
     vfs->type                 = FS_TYPE_RAMFS;
-    vfs->ramfs.ram_limit      = 65536;
-    vfs->ramfs.inode_list_len = 32;
-    vfs->ramfs.inode_list     = malloc(sizeof(*vfs->ramfs.inode_list) * vfs->ramfs.inode_list_len);
-    if (!badge_err_is_ok(ec))
-        return;
-    vfs->ramfs.inode_usage = malloc(sizeof(*vfs->ramfs.inode_usage) * vfs->ramfs.inode_list_len);
-    if (!badge_err_is_ok(ec)) {
-        free(vfs->ramfs.inode_list);
-        return;
+    vfs->ramfs.ram_limit      = ram_limit;
+    vfs->ramfs.inode_limit    = inode_limit;
+    vfs->ramfs.inode_list_len = inode_list_len;
+    vfs->ramfs.inode_list     = calloc(inode_list_len, sizeof(*vfs->ramfs.inode_list));
+    vfs->ramfs.inode_usage    = calloc(usage_words, sizeof(*vfs->ramfs.inode_usage));
+    vfs_ramfs_inode_t *iptr   = calloc(1, sizeof(vfs_ramfs_inode_t));
+    bool               rsvd   = false;
+    if (!vfs->ramfs.inode_list || !vfs->ramfs.inode_usage || !iptr) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
+        goto error;
     }
+    if (!reserve_ram(vfs, 0, sizeof(vfs_ramfs_inode_t))) {
+        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOSPACE);
+        goto error;
+    }
+    rsvd = true;
     vfs->inode_root = VFS_RAMFS_INODE_ROOT;
-    mutex_init(ec, &vfs->ramfs.mtx, true, false);
 
-    // Clear inode usage.
-    mem_set(vfs->ramfs.inode_list, 0, sizeof(*vfs->ramfs.inode_list) * vfs->ramfs.inode_list_len);
-    mem_set(vfs->ramfs.inode_usage, false, vfs->ramfs.inode_list_len - 2);
+    // Inodes 0 and 1 are never allocated.
+    set_inode_usage(vfs, 0, true);
+    set_inode_usage(vfs, VFS_RAMFS_INODE_ROOT, true);
 
     // Create root directory.
-    vfs->ramfs.inode_usage[VFS_RAMFS_INODE_ROOT] = true;
-    vfs_ramfs_inode_t *iptr                      = &vfs->ramfs.inode_list[VFS_RAMFS_INODE_ROOT];
+    vfs->ramfs.inode_list[VFS_RAMFS_INODE_ROOT] = iptr;
 
     iptr->buf   = NULL;
     iptr->len   = 0;
@@ -229,29 +423,46 @@ void vfs_ramfs_mount(badge_err_t *ec, vfs_t *vfs) {
         .name_len = 1,
         .name     = {'.', 0},
     };
-    insert_dirent(ec, vfs, iptr, &ent);
-    if (!badge_err_is_ok(ec)) {
-        free(iptr->buf);
-        free(vfs->ramfs.inode_list);
-        free(vfs->ramfs.inode_usage);
-        mutex_destroy(NULL, &vfs->ramfs.mtx);
+    if (!insert_dirent(ec, vfs, iptr, &ent)) {
+        goto error;
     }
 
     ent.name_len = 2;
     ent.name[1]  = '.';
     ent.name[2]  = 0;
-    insert_dirent(ec, vfs, iptr, &ent);
-    if (!badge_err_is_ok(ec)) {
+    if (!insert_dirent(ec, vfs, iptr, &ent)) {
+        goto error;
+    }
+
+    mutex_init(ec, &vfs->ramfs.mtx, true, false);
+    if (badge_err_is_ok(ec)) {
+        return;
+    }
+
+error:
+    if (iptr) {
+        if (rsvd) {
+            // Return the root inode and any directory entries already inserted to the RAM budget.
+            reserve_ram(vfs, sizeof(vfs_ramfs_inode_t) + iptr->cap, 0);
+        }
         free(iptr->buf);
-        free(vfs->ramfs.inode_list);
-        free(vfs->ramfs.inode_usage);
-        mutex_destroy(NULL, &vfs->ramfs.mtx);
     }
+    free(iptr);
+    free(vfs->ramfs.inode_list);
+    free(vfs->ramfs.inode_usage);
+    vfs->ramfs.inode_list  = NULL;
+    vfs->ramfs.inode_usage = NULL;
 }
 
 // Unmount a ramfs filesystem.
 void vfs_ramfs_umount(vfs_t *vfs) {
     mutex_destroy(NULL, &vfs->ramfs.mtx);
+    for (size_t i = 0; i < vfs->ramfs.inode_list_len; i++) {
+        if (vfs->ramfs.inode_list[i]) {
+            free(vfs->ramfs.inode_list[i]->buf);
+            free(vfs->ramfs.inode_list[i]);
+        }
+    }
     free(vfs->ramfs.inode_list);
     free(vfs->ramfs.inode_usage);
 }
@@ -333,7 +544,7 @@ void vfs_ramfs_unlink(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, char
 
 
     // If it is also a directory, assert that it is empty.
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[ent->inode];
+    vfs_ramfs_inode_t *iptr = vfs->ramfs.inode_list[ent->inode];
     if ((iptr->mode & VFS_RAMFS_MODE_MASK) == FILETYPE_DIR << VFS_RAMFS_MODE_BIT) {
         // Directories that are not empty cannot be removed.
         if (!is_dir_empty(iptr)) {
@@ -369,18 +580,10 @@ bool vfs_ramfs_exists(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, char
 
 
 
-// Determine the record length for converting a RAMFS dirent to a BadgerOS dirent.
-// Returns the record length for a matching `dirent_t`.
-static inline size_t measure_dirent(vfs_ramfs_dirent_t *ent) {
-    size_t ent_size  = offsetof(dirent_t, name) + ent->name_len + 1;
-    ent_size        += (~ent_size + 1) % sizeof(size_t);
-    return ent_size;
-}
-
 // Convert a RAMFS dirent to a BadgerOS dirent.
 // Returns the record length for a matching `dirent_t`.
 static inline size_t convert_dirent(vfs_t *vfs, dirent_t *out, vfs_ramfs_dirent_t *in) {
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[in->inode];
+    vfs_ramfs_inode_t *iptr = vfs->ramfs.inode_list[in->inode];
 
     out->record_len  = offsetof(dirent_t, name) + in->name_len + 1;
     out->record_len += (fileoff_t)((size_t)(~out->record_len + 1) % sizeof(size_t));
@@ -393,57 +596,52 @@ static inline size_t convert_dirent(vfs_t *vfs, dirent_t *out, vfs_ramfs_dirent_
     return out->record_len;
 }
 
-// Atomically read all directory entries and cache them into the directory handle.
-// Refer to `dirent_t` for the structure of the cache.
-void vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_handle_t *dir) {
+// Read the directory entry at `*cookie` and advance `*cookie` to the next entry.
+// The cookie of a RAMFS directory entry is its offset in the directory, which never changes.
+// Returns false without error at the end of the directory.
+bool vfs_ramfs_dir_read(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, fileoff_t *cookie, dirent_t *out) {
     assert_always(mutex_acquire_shared(NULL, &vfs->ramfs.mtx, VFS_MUTEX_TIMEOUT));
-    size_t             off  = 0;
-    vfs_ramfs_inode_t *iptr = dir->shared->ramfs_file;
-
-    // Measure required memory.
-    size_t cap = 0;
-    while (off < iptr->len) {
-        vfs_ramfs_dirent_t *ent  = (vfs_ramfs_dirent_t *)(iptr->buf + off);
-        cap                     += measure_dirent(ent);
-        off                     += ent->size;
+    vfs_ramfs_inode_t *iptr = dir->ramfs_file;
+    size_t             off  = (size_t)(*cookie & DIR_COOKIE_OFF_MASK);
+
+    if ((uint32_t)(*cookie >> DIR_COOKIE_GEN_SHIFT) != (iptr->dir_gen & DIR_COOKIE_GEN_MASK)) {
+        // Entries were merged or trimmed since this cookie was made; find the first entry at or after it.
+        size_t cur = 0;
+        while (cur < iptr->len && cur < off) {
+            cur += ((vfs_ramfs_dirent_t *)(iptr->buf + cur))->size;
+        }
+        off = cur;
     }
 
-    // Allocate memory.
-    void *mem = realloc(dir->dir_cache, cap); // NOLINT
-    if (!mem) {
-        mutex_release_shared(NULL, &vfs->ramfs.mtx);
-        badge_err_set(ec, ELOC_FILESYSTEM, ECAUSE_NOMEM);
-        return;
+    // Skip removed entries.
+    while (off < iptr->len && ((vfs_ramfs_dirent_t *)(iptr->buf + off))->inode == INODE_NONE) {
+        off += ((vfs_ramfs_dirent_t *)(iptr->buf + off))->size;
     }
-    dir->dir_cache      = mem;
-    dir->dir_cache_size = (fileoff_t)cap;
-
-    // Generate entries.
-    size_t out_off = 0;
-    off            = 0;
-    while (off < iptr->len) {
-        vfs_ramfs_dirent_t *in  = (vfs_ramfs_dirent_t *)(iptr->buf + off);
-        dirent_t           *out = (dirent_t *)(dir->dir_cache + out_off);
+    bool found = off < iptr->len;
+    if (found) {
+        vfs_ramfs_dirent_t *in = (vfs_ramfs_dirent_t *)(iptr->buf + off);
         convert_dirent(vfs, out, in);
-        off     += in->size;
-        out_off += out->record_len;
+        off += in->size;
     }
+    *cookie = ((fileoff_t)(iptr->dir_gen & DIR_COOKIE_GEN_MASK) << DIR_COOKIE_GEN_SHIFT) | (fileoff_t)off;
 
     mutex_release_shared(NULL, &vfs->ramfs.mtx);
     badge_err_set_ok(ec);
+    return found;
 }
 
 // Atomically read the directory entry with the matching name.
 // Returns true if the entry was found.
 bool vfs_ramfs_dir_find_ent(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *dir, dirent_t *out, char const *name) {
+    // The lock keeps the entry from being moved by concurrent inserts and removals while it is copied.
+    assert_always(mutex_acquire_shared(NULL, &vfs->ramfs.mtx, VFS_MUTEX_TIMEOUT));
     vfs_ramfs_inode_t  *iptr = dir->ramfs_file;
     vfs_ramfs_dirent_t *in   = find_dirent(ec, vfs, iptr, name);
-    if (!in) {
-        return false;
-    } else {
+    if (in) {
         convert_dirent(vfs, out, in);
-        return true;
     }
+    mutex_release_shared(NULL, &vfs->ramfs.mtx);
+    return in != NULL;
 }
 
 
@@ -453,11 +651,10 @@ void vfs_ramfs_root_open(badge_err_t *ec, vfs_t *vfs, vfs_file_shared_t *file) {
     assert_always(mutex_acquire_shared(NULL, &vfs->ramfs.mtx, VFS_MUTEX_TIMEOUT));
 
     // Install in shared file handle.
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[VFS_RAMFS_INODE_ROOT];
+    vfs_ramfs_inode_t *iptr = vfs->ramfs.inode_list[VFS_RAMFS_INODE_ROOT];
     file->ramfs_file        = iptr;
     file->inode             = VFS_RAMFS_INODE_ROOT;
     file->vfs               = vfs;
-    file->refcount          = 1;
 
     iptr->links++;
 
@@ -485,14 +682,13 @@ void vfs_ramfs_file_open(
     }
 
     // Increase refcount.
-    vfs_ramfs_inode_t *iptr = &vfs->ramfs.inode_list[ent->inode];
+    vfs_ramfs_inode_t *iptr = vfs->ramfs.inode_list[ent->inode];
     iptr->links++;
 
     // Install in shared file handle.
     file->ramfs_file = iptr;
     file->inode      = iptr->inode;
     file->vfs        = vfs;
-    file->refcount   = 1;
     file->size       = (fileoff_t)iptr->len;
 
     mutex_release(NULL, &vfs->ramfs.mtx);
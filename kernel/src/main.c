@@ -4,6 +4,7 @@
 #include "assertions.h"
 #include "cpu/panic.h"
 #include "filesystem.h"
+#include "filesystem/vfs_pcache.h"
 #include "housekeeping.h"
 #include "interrupt.h"
 #include "isr_ctx.h"
@@ -124,6 +125,19 @@ void syscall_sys_shutdown(bool is_reboot) {
     atomic_store(&kernel_shutdown_mode, 1 + is_reboot);
 }
 
+// Get the time since boot in microseconds.
+long long syscall_sys_time_us() {
+    return time_us();
+}
+
+// Get the read-only time page mapped into this process, or NULL if the time can only be read with a system call.
+time_page_t const *syscall_sys_time_page() {
+    if (proc_map_contains_raw(proc_current(), PROC_TIME_PAGE_VADDR, sizeof(time_page_t)) & MEMPROTECT_FLAG_R) {
+        return (time_page_t const *)PROC_TIME_PAGE_VADDR;
+    }
+    return NULL;
+}
+
 
 
 // After basic runtime initialization, the booting CPU core continues here.
@@ -137,8 +151,11 @@ static void kernel_init() {
     // Full hardware initialization.
     port_init();
 
+    // Filesystem page cache writeback.
+    vfs_pcache_init();
+
     // Temporary filesystem image.
-    fs_mount(&ec, FS_TYPE_RAMFS, NULL, "/", 0);
+    fs_mount(&ec, FS_TYPE_RAMFS, NULL, "/", 0, NULL);
     badge_err_assert_always(&ec);
     init_ramfs();
 }
@@ -6,14 +6,17 @@
 #include "badge_strings.h"
 #include "cpu/panic.h"
 #include "log.h"
+#include "malloc.h"
 #include "memprotect.h"
 #include "page_alloc.h"
 #include "port/hardware_allocation.h"
 #include "process/internal.h"
 #include "process/process.h"
+#include "process/shm.h"
 #include "process/types.h"
 #include "scheduler/cpu.h"
 #include "scheduler/types.h"
+#include "time.h"
 
 #if MEMMAP_VMEM
 #include "cpu/mmu.h"
@@ -41,11 +44,10 @@ static int proc_memmap_cmp(void const *a, void const *b) {
 }
 
 #if MEMMAP_VMEM
-// Allocate more memory to a process.
-size_t proc_map_raw(
-    badge_err_t *ec, process_t *proc, size_t vaddr_req, size_t min_size, size_t min_align, uint32_t flags
-) {
-    proc_memmap_t *map = &proc->memmap;
+// Pick a page-aligned virtual address for a new mapping and round its size up to whole pages.
+// Returns 0 if there is no suitable free range.
+static size_t proc_map_vaddr(badge_err_t *ec, process_t *proc, size_t vaddr_req, size_t *size_io, size_t min_align) {
+    size_t min_size = *size_io;
 
     // Correct virtual address.
     if (min_align & (min_align - 1)) {
@@ -83,6 +85,20 @@ size_t proc_map_raw(
         return 0;
     }
 
+    *size_io = min_size;
+    return vaddr_req;
+}
+
+// Allocate more memory to a process.
+size_t proc_map_raw(
+    badge_err_t *ec, process_t *proc, size_t vaddr_req, size_t min_size, size_t min_align, uint32_t flags
+) {
+    proc_memmap_t *map = &proc->memmap;
+    vaddr_req          = proc_map_vaddr(ec, proc, vaddr_req, &min_size, min_align);
+    if (!vaddr_req) {
+        return 0;
+    }
+
     // Convert to page numbers.
     size_t vpn   = vaddr_req / MEMMAP_PAGE_SIZE;
     size_t pages = min_size / MEMMAP_PAGE_SIZE;
@@ -140,6 +156,237 @@ error:
     return 0;
 }
 
+// Map part of a file into a process.
+// Shared mappings use the file's cached pages directly and must not be writable.
+// Private mappings start out sharing the cached pages read-only and copy a page when it is first written.
+size_t proc_map_file_raw(
+    badge_err_t *ec, process_t *proc, size_t vaddr_req, size_t size, file_t file, fileoff_t offset, uint32_t flags
+) {
+    proc_memmap_t *map = &proc->memmap;
+    bool           cow = flags & PROC_MAP_PRIVATE;
+    flags              &= MEMPROTECT_FLAG_RWX;
+    if (!size || ((flags & MEMPROTECT_FLAG_W) && !cow)) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_PARAM);
+        return 0;
+    }
+    vaddr_req = proc_map_vaddr(ec, proc, vaddr_req, &size, 1);
+    if (!vaddr_req) {
+        return 0;
+    }
+    size_t pages = size / MEMMAP_PAGE_SIZE;
+    void **pins  = calloc(pages, sizeof(void *));
+    if (!pins) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
+    }
+
+    // Map the file's pages without write access so writes to private mappings fault and can be copied.
+    size_t i;
+    for (i = 0; i < pages; i++) {
+        size_t ppn = fs_pin_page(ec, file, offset + (fileoff_t)(i * MEMMAP_PAGE_SIZE), &pins[i]);
+        if (!ppn) {
+            goto error;
+        }
+        if (!memprotect_u(
+                map,
+                &map->mpu_ctx,
+                vaddr_req + i * MEMMAP_PAGE_SIZE,
+                ppn * MEMMAP_PAGE_SIZE,
+                MEMMAP_PAGE_SIZE,
+                flags & ~MEMPROTECT_FLAG_W
+            )) {
+            fs_unpin_page(pins[i]);
+            badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+            goto error;
+        }
+    }
+
+    proc_memmap_ent_t new_ent = {
+        .vaddr     = vaddr_req,
+        .size      = size,
+        .write     = flags & MEMPROTECT_FLAG_W,
+        .exec      = flags & MEMPROTECT_FLAG_X,
+        .cow       = cow,
+        .file_pins = pins,
+    };
+    if (!array_lencap_sorted_insert(
+            &map->regions,
+            sizeof(proc_memmap_ent_t),
+            &map->regions_len,
+            &map->regions_cap,
+            &new_ent,
+            proc_memmap_cmp
+        )) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        goto error;
+    }
+
+    memprotect_commit(&map->mpu_ctx);
+    logkf(LOG_INFO, "Mapped %{size;d} bytes of file at %{size;x} to process %{d}", size, vaddr_req, proc->pid);
+    badge_err_set_ok(ec);
+    return vaddr_req;
+
+error:
+    // Unmap and release the pages mapped so far.
+    while (i--) {
+        assert_dev_keep(memprotect_u(map, &map->mpu_ctx, vaddr_req + i * MEMMAP_PAGE_SIZE, 0, MEMMAP_PAGE_SIZE, 0));
+        fs_unpin_page(pins[i]);
+    }
+    memprotect_commit(&map->mpu_ctx);
+    free(pins);
+    return 0;
+}
+
+// Map a shared memory object into a process.
+// Returns actual virtual address on success, 0 on failure.
+size_t proc_map_shm_raw(badge_err_t *ec, process_t *proc, size_t vaddr_req, int shm_id, uint32_t flags) {
+    proc_memmap_t *map = &proc->memmap;
+    flags              &= MEMPROTECT_FLAG_RWX;
+    shm_t *shm         = shm_get(ec, shm_id);
+    if (!shm) {
+        return 0;
+    }
+    size_t size = shm->size;
+    vaddr_req   = proc_map_vaddr(ec, proc, vaddr_req, &size, 1);
+    if (!vaddr_req) {
+        shm_unref(shm);
+        return 0;
+    }
+
+    // Map the object's pages; they stay owned by the object.
+    size_t i;
+    for (i = 0; i < size / MEMMAP_PAGE_SIZE; i++) {
+        if (!memprotect_u(
+                map,
+                &map->mpu_ctx,
+                vaddr_req + i * MEMMAP_PAGE_SIZE,
+                shm->ppns[i] * MEMMAP_PAGE_SIZE,
+                MEMMAP_PAGE_SIZE,
+                flags
+            )) {
+            badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+            goto error;
+        }
+    }
+
+    proc_memmap_ent_t new_ent = {
+        .vaddr = vaddr_req,
+        .size  = size,
+        .write = flags & MEMPROTECT_FLAG_W,
+        .exec  = flags & MEMPROTECT_FLAG_X,
+        .shm   = shm,
+    };
+    if (!array_lencap_sorted_insert(
+            &map->regions,
+            sizeof(proc_memmap_ent_t),
+            &map->regions_len,
+            &map->regions_cap,
+            &new_ent,
+            proc_memmap_cmp
+        )) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        goto error;
+    }
+
+    memprotect_commit(&map->mpu_ctx);
+    logkf(LOG_INFO, "Mapped shared memory #%{d} at %{size;x} to process %{d}", shm->id, vaddr_req, proc->pid);
+    badge_err_set_ok(ec);
+    return vaddr_req;
+
+error:
+    // Unmap the pages mapped so far.
+    while (i--) {
+        assert_dev_keep(memprotect_u(map, &map->mpu_ctx, vaddr_req + i * MEMMAP_PAGE_SIZE, 0, MEMMAP_PAGE_SIZE, 0));
+    }
+    memprotect_commit(&map->mpu_ctx);
+    shm_unref(shm);
+    return 0;
+}
+
+// Give the process its own copy of pages of private file mappings in this range that still share the file's pages.
+// Returns the number of pages copied.
+size_t proc_map_unshare_raw(badge_err_t *ec, process_t *proc, size_t vaddr, size_t size) {
+    proc_memmap_t *map    = &proc->memmap;
+    size_t         copied = 0;
+    badge_err_set_ok(ec);
+    for (size_t i = 0; i < map->regions_len; i++) {
+        proc_memmap_ent_t *region = &map->regions[i];
+        if (!region->cow || !region->write || vaddr + size <= region->vaddr ||
+            vaddr >= region->vaddr + region->size) {
+            continue;
+        }
+
+        // Determine which pages of this region overlap the range.
+        size_t first = vaddr > region->vaddr ? (vaddr - region->vaddr) / MEMMAP_PAGE_SIZE : 0;
+        size_t end   = vaddr + size - region->vaddr;
+        if (end > region->size) {
+            end = region->size;
+        }
+        end = (end + MEMMAP_PAGE_SIZE - 1) / MEMMAP_PAGE_SIZE;
+
+        for (size_t page = first; page < end; page++) {
+            if (!region->file_pins[page]) {
+                continue;
+            }
+            size_t ppn = phys_page_alloc(1, true);
+            if (!ppn) {
+                badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+                goto done;
+            }
+
+            // Copy the shared page and replace it with the now private copy.
+            size_t      page_vaddr = region->vaddr + page * MEMMAP_PAGE_SIZE;
+            virt2phys_t v2p        = memprotect_virt2phys(&map->mpu_ctx, page_vaddr);
+            mem_copy(
+                (void *)(ppn * MEMMAP_PAGE_SIZE + mmu_hhdm_vaddr),
+                (void const *)(v2p.paddr + mmu_hhdm_vaddr),
+                MEMMAP_PAGE_SIZE
+            );
+            uint32_t flags = MEMPROTECT_FLAG_RW | (region->exec ? MEMPROTECT_FLAG_X : 0);
+            assert_dev_keep(memprotect_u(map, &map->mpu_ctx, page_vaddr, ppn * MEMMAP_PAGE_SIZE, MEMMAP_PAGE_SIZE, flags)
+            );
+            fs_unpin_page(region->file_pins[page]);
+            region->file_pins[page] = NULL;
+            copied++;
+        }
+    }
+
+done:
+    if (copied) {
+        memprotect_commit(&map->mpu_ctx);
+    }
+    return copied;
+}
+
+// Whether `vaddr` lies in a writable private file mapping and its page is already the process' own copy.
+bool proc_map_is_unshared_raw(process_t *proc, size_t vaddr) {
+    proc_memmap_t *map = &proc->memmap;
+    for (size_t i = 0; i < map->regions_len; i++) {
+        proc_memmap_ent_t *region = &map->regions[i];
+        if (region->cow && region->write && vaddr >= region->vaddr && vaddr < region->vaddr + region->size) {
+            return !region->file_pins[(vaddr - region->vaddr) / MEMMAP_PAGE_SIZE];
+        }
+    }
+    return false;
+}
+
+// Unmap the pages of a file mapping.
+// Pages still shared with the file are unpinned, pages copied on write are freed.
+static void proc_unmap_file_pages(proc_memmap_t *map, proc_memmap_ent_t const *region) {
+    for (size_t i = 0; i < region->size / MEMMAP_PAGE_SIZE; i++) {
+        size_t      vaddr = region->vaddr + i * MEMMAP_PAGE_SIZE;
+        virt2phys_t v2p   = memprotect_virt2phys(&map->mpu_ctx, vaddr);
+        assert_dev_keep(memprotect_u(map, &map->mpu_ctx, vaddr, 0, MEMMAP_PAGE_SIZE, 0));
+        if (region->file_pins[i]) {
+            fs_unpin_page(region->file_pins[i]);
+        } else {
+            phys_page_free(v2p.paddr / MEMMAP_PAGE_SIZE);
+        }
+    }
+    memprotect_commit(&map->mpu_ctx);
+    free(region->file_pins);
+}
+
 // Release memory allocated to a process.
 void proc_unmap_raw(badge_err_t *ec, process_t *proc, size_t base) {
     proc_memmap_t *map = &proc->memmap;
@@ -150,6 +397,36 @@ void proc_unmap_raw(badge_err_t *ec, process_t *proc, size_t base) {
             array_remove(&map->regions[0], sizeof(map->regions[0]), map->regions_len, NULL, i);
             map->regions_len--;
 
+            // Shared memory belongs to the shared memory object.
+            if (region.shm) {
+                assert_dev_keep(memprotect_u(map, &map->mpu_ctx, base, 0, region.size, 0));
+                memprotect_commit(&map->mpu_ctx);
+                badge_err_set_ok(ec);
+                logkf(
+                    LOG_INFO,
+                    "Unmapped shared memory #%{d} at %{size;x} from process %{d}",
+                    region.shm->id,
+                    base,
+                    proc->pid
+                );
+                shm_unref(region.shm);
+                return;
+            }
+
+            // File mappings do not own most of their memory.
+            if (region.file_pins) {
+                proc_unmap_file_pages(map, &region);
+                badge_err_set_ok(ec);
+                logkf(
+                    LOG_INFO,
+                    "Unmapped %{size;d} bytes of file at %{size;x} from process %{d}",
+                    region.size,
+                    base,
+                    proc->pid
+                );
+                return;
+            }
+
             // Revoke user access to the memory.
             assert_dev_keep(memprotect_u(map, &map->mpu_ctx, base, 0, region.size, 0));
             memprotect_commit(&map->mpu_ctx);
@@ -194,6 +471,42 @@ int proc_map_contains_raw(process_t *proc, size_t vaddr, size_t size) {
     }
 }
 
+// Physical address of the time page shared by all processes, 0 if not yet allocated.
+static size_t time_page_paddr;
+
+// Map the shared read-only time page into a new process, if this platform lets userland read the timer.
+void proc_map_time_page_raw(process_t *proc) {
+    // Allocate the page on first use; the caller holds `proc_mtx`.
+    if (!time_page_paddr) {
+        time_page_t params;
+        if (!time_get_user_params(&params)) {
+            return;
+        }
+        size_t ppn = phys_page_alloc(1, true);
+        if (!ppn) {
+            logk(LOG_WARN, "Out of memory for the time page");
+            return;
+        }
+        time_page_paddr = ppn * MEMMAP_PAGE_SIZE;
+        mem_set((void *)(time_page_paddr + mmu_hhdm_vaddr), 0, MEMMAP_PAGE_SIZE);
+        mem_copy((void *)(time_page_paddr + mmu_hhdm_vaddr), &params, sizeof(params));
+    }
+
+    // The page is not in the region list, so process teardown leaves it alone.
+    if (!memprotect_u(
+            &proc->memmap,
+            &proc->memmap.mpu_ctx,
+            PROC_TIME_PAGE_VADDR,
+            time_page_paddr,
+            MEMMAP_PAGE_SIZE,
+            MEMPROTECT_FLAG_R
+        )) {
+        logk(LOG_WARN, "Failed to map the time page");
+        return;
+    }
+    memprotect_commit(&proc->memmap.mpu_ctx);
+}
+
 #else
 
 // Allocate more memory to a process.
@@ -293,6 +606,57 @@ void proc_unmap_raw(badge_err_t *ec, process_t *proc, size_t base) {
     badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
 }
 
+// Map part of a file into a process.
+// Without virtual memory, the file's pages cannot be shared, so the mapping is a private copy of the file.
+size_t proc_map_file_raw(
+    badge_err_t *ec, process_t *proc, size_t vaddr_req, size_t size, file_t file, fileoff_t offset, uint32_t flags
+) {
+    if (!size || ((flags & MEMPROTECT_FLAG_W) && !(flags & PROC_MAP_PRIVATE))) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_PARAM);
+        return 0;
+    }
+    size_t base = proc_map_raw(ec, proc, vaddr_req, size, 0, flags & MEMPROTECT_FLAG_RWX);
+    if (!base) {
+        return 0;
+    }
+    fs_pread(ec, file, (void *)base, (fileoff_t)size, offset);
+    if (!badge_err_is_ok(ec)) {
+        proc_unmap_raw(NULL, proc, base);
+        return 0;
+    }
+    return base;
+}
+
+// Map a shared memory object into a process.
+// Without virtual memory, the same pages cannot appear in more than one process.
+size_t proc_map_shm_raw(badge_err_t *ec, process_t *proc, size_t vaddr_req, int shm_id, uint32_t flags) {
+    (void)proc;
+    (void)vaddr_req;
+    (void)shm_id;
+    (void)flags;
+    badge_err_set(ec, ELOC_PROCESS, ECAUSE_UNSUPPORTED);
+    return 0;
+}
+
+// Give the process its own copy of pages of private file mappings in this range that still share the file's pages.
+// Returns the number of pages copied.
+size_t proc_map_unshare_raw(badge_err_t *ec, process_t *proc, size_t vaddr, size_t size) {
+    // File mappings are always copies without virtual memory.
+    (void)proc;
+    (void)vaddr;
+    (void)size;
+    badge_err_set_ok(ec);
+    return 0;
+}
+
+// Whether `vaddr` lies in a writable private file mapping and its page is already the process' own copy.
+bool proc_map_is_unshared_raw(process_t *proc, size_t vaddr) {
+    // File mappings are always copies without virtual memory, but stores to them never fault.
+    (void)proc;
+    (void)vaddr;
+    return false;
+}
+
 // Whether the process owns this range of virtual memory.
 // Returns the lowest common denominator of the access bits.
 int proc_map_contains_raw(process_t *proc, size_t vaddr, size_t size) {
@@ -329,6 +693,12 @@ int proc_map_contains_raw(process_t *proc, size_t vaddr, size_t size) {
     }
     return access;
 }
+
+// Map the shared read-only time page into a new process, if this platform lets userland read the timer.
+void proc_map_time_page_raw(process_t *proc) {
+    // Without virtual memory, every process would need its own copy at a different address.
+    (void)proc;
+}
 #endif
 
 
@@ -17,6 +17,7 @@
 #include "port/hardware_allocation.h"
 #include "port/port.h"
 #include "process/internal.h"
+#include "process/shm.h"
 #include "process/sighandler.h"
 #include "process/types.h"
 #include "scheduler/cpu.h"
@@ -29,6 +30,7 @@
 #include "cpu/mmu.h"
 #endif
 
+#include <limits.h>
 #include <stdatomic.h>
 
 
@@ -167,8 +169,9 @@ process_t *proc_create_raw(badge_err_t *ec, pid_t parentpid, char const *binary,
         .argc        = 0,
         .argv        = NULL,
         .argv_size   = 0,
-        .fds_len     = 0,
+        .fds_cap     = 0,
         .fds         = NULL,
+        .fds_usage   = NULL,
         .threads_len = 0,
         .threads     = NULL,
         .pid         = pid_counter,
@@ -182,7 +185,8 @@ process_t *proc_create_raw(badge_err_t *ec, pid_t parentpid, char const *binary,
             },
         .mtx        = MUTEX_T_INIT_SHARED,
         .flags      = PROC_PRESTART,
-        .sigpending = DLIST_EMPTY,
+        .sigpending = 0,
+        .sigmask    = 0,
         .children   = DLIST_EMPTY,
     };
 
@@ -220,6 +224,7 @@ process_t *proc_create_raw(badge_err_t *ec, pid_t parentpid, char const *binary,
 
     // Initialise the empty memory map.
     memprotect_create(&handle->memmap.mpu_ctx);
+    proc_map_time_page_raw(handle);
 
     mutex_release(NULL, &proc_mtx);
     badge_err_set_ok(ec);
@@ -329,7 +334,7 @@ void proc_start_raw(badge_err_t *ec, process_t *process) {
     }
 
     // Create the process' main thread.
-    tid_t thread = proc_create_thread_raw(ec, process, (size_t)kbelf_dyn_entrypoint(dyn), 0, SCHED_PRIO_NORMAL);
+    tid_t thread = proc_create_thread_raw(ec, process, (size_t)kbelf_dyn_entrypoint(dyn), 0, SCHED_PRIO_NORMAL, 0);
     if (!thread) {
         kbelf_dyn_unload(dyn);
         kbelf_dyn_destroy(dyn);
@@ -346,8 +351,11 @@ void proc_start_raw(badge_err_t *ec, process_t *process) {
 
 
 // Create a new thread in a process.
+// If `stack_size` is nonzero, a user stack is allocated and the thread shares the global pointer of the current thread.
 // Returns created thread handle.
-tid_t proc_create_thread_raw(badge_err_t *ec, process_t *process, size_t entry_point, size_t arg, int priority) {
+tid_t proc_create_thread_raw(
+    badge_err_t *ec, process_t *process, size_t entry_point, size_t arg, int priority, size_t stack_size
+) {
     // Create an entry for a new thread.
     void *mem = realloc(process->threads, sizeof(tid_t) * (process->threads_len + 1));
     if (!mem) {
@@ -356,15 +364,31 @@ tid_t proc_create_thread_raw(badge_err_t *ec, process_t *process, size_t entry_p
     }
     process->threads = mem;
 
+    // Allocate the user stack.
+    size_t stack = 0;
+    if (stack_size) {
+        stack = proc_map_raw(ec, process, 0, stack_size, 16, MEMPROTECT_FLAG_RW);
+        if (!stack) {
+            return 0;
+        }
+    }
+
     // Create a thread.
     tid_t tid = thread_new_user(ec, NULL, process, entry_point, arg, priority);
     if (!tid) {
+        if (stack) {
+            proc_unmap_raw(NULL, process, stack);
+        }
         return 0;
     }
     sched_thread_t *thread = sched_get_thread(tid);
 
     thread->user_isr_ctx.mpu_ctx   = &process->memmap.mpu_ctx;
     thread->kernel_isr_ctx.mpu_ctx = &process->memmap.mpu_ctx;
+    if (stack) {
+        thread->user_stack = stack;
+        sched_prepare_user_stack(thread, sched_current_thread(), stack + stack_size);
+    }
 
     // Add the thread to the list.
     array_insert(process->threads, sizeof(tid_t), process->threads_len, &tid, process->threads_len);
@@ -375,53 +399,126 @@ tid_t proc_create_thread_raw(badge_err_t *ec, process_t *process, size_t entry_p
 }
 
 
-// Delete a thread in a process.
-void proc_delete_thread_raw_unsafe(badge_err_t *ec, process_t *process, sched_thread_t *thread) {
-    (void)ec;
-    (void)process;
-    (void)thread;
-    __builtin_trap();
+// Whether a thread is in the process' thread list.
+bool proc_has_thread_raw(process_t *process, tid_t thread) {
+    for (size_t i = 0; i < process->threads_len; i++) {
+        if (process->threads[i] == thread) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Remove a thread from the process' thread list.
+// The caller must hold `process->mtx`; the thread itself is not stopped.
+void proc_delete_thread_raw_unsafe(badge_err_t *ec, process_t *process, tid_t thread) {
+    for (size_t i = 0; i < process->threads_len; i++) {
+        if (process->threads[i] == thread) {
+            array_remove(process->threads, sizeof(tid_t), process->threads_len, NULL, i);
+            process->threads_len--;
+            badge_err_set_ok(ec);
+            return;
+        }
+    }
+    badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+}
+
+// Try to grow the file descriptor table of a process.
+static bool proc_grow_fds_raw(process_t *process) {
+    size_t old_cap = process->fds_cap;
+    size_t new_cap = old_cap ? old_cap * 2 : PROC_FD_BITS;
+
+    file_t *fds = realloc(process->fds, sizeof(file_t) * new_cap);
+    if (!fds) {
+        return false;
+    }
+    process->fds = fds;
+    for (size_t i = old_cap; i < new_cap; i++) {
+        fds[i] = FILE_NONE;
+    }
+
+    size_t *usage = realloc(process->fds_usage, sizeof(size_t) * (new_cap / PROC_FD_BITS));
+    if (!usage) {
+        return false;
+    }
+    process->fds_usage = usage;
+    mem_set(usage + old_cap / PROC_FD_BITS, 0, sizeof(size_t) * ((new_cap - old_cap) / PROC_FD_BITS));
+
+    process->fds_cap = new_cap;
+    return true;
 }
 
 // Add a file to the process file handle list.
+// Returns the lowest vacant file descriptor number.
 int proc_add_fd_raw(badge_err_t *ec, process_t *process, file_t real) {
-    proc_fd_t fd = {.real = real, .virt = 0};
-    for (size_t i = 0; i < process->fds_len; i++) {
-        if (process->fds[i].virt > fd.virt) {
-            fd.virt = process->fds[i].virt + 1;
+    size_t virt  = process->fds_cap;
+    size_t words = process->fds_cap / PROC_FD_BITS;
+    for (size_t i = 0; i < words; i++) {
+        size_t vacant = ~process->fds_usage[i];
+        if (vacant) {
+            virt = i * PROC_FD_BITS + (size_t)__builtin_ctzl(vacant);
+            break;
         }
     }
-    if (array_len_insert(&process->fds, sizeof(proc_fd_t), &process->fds_len, &fd, process->fds_len)) {
-        badge_err_set_ok(ec);
-        return fd.virt;
-    } else {
+    if (virt == process->fds_cap && (virt >= INT_MAX || !proc_grow_fds_raw(process))) {
         badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
         return -1;
     }
+
+    process->fds[virt]                      = real;
+    process->fds_usage[virt / PROC_FD_BITS] |= (size_t)1 << (virt % PROC_FD_BITS);
+    badge_err_set_ok(ec);
+    return (int)virt;
 }
 
 // Find a file in the process file handle list.
 file_t proc_find_fd_raw(badge_err_t *ec, process_t *process, int virt) {
-    for (size_t i = 0; i < process->fds_len; i++) {
-        if (process->fds[i].virt == virt) {
-            badge_err_set_ok(ec);
-            return process->fds[i].real;
-        }
+    if (virt < 0 || (size_t)virt >= process->fds_cap || process->fds[virt] == FILE_NONE) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+        return FILE_NONE;
     }
-    badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
-    return -1;
+    badge_err_set_ok(ec);
+    return process->fds[virt];
 }
 
 // Remove a file from the process file handle list.
 void proc_remove_fd_raw(badge_err_t *ec, process_t *process, int virt) {
-    for (size_t i = 0; i < process->fds_len; i++) {
-        if (process->fds[i].virt == virt) {
-            array_len_remove(&process->fds, sizeof(proc_fd_t), &process->fds_len, NULL, i);
-            badge_err_set_ok(ec);
-            return;
-        }
+    if (virt < 0 || (size_t)virt >= process->fds_cap || process->fds[virt] == FILE_NONE) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+        return;
     }
-    badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+    process->fds[virt]                       = FILE_NONE;
+    process->fds_usage[virt / PROC_FD_BITS] &= ~((size_t)1 << (virt % PROC_FD_BITS));
+    badge_err_set_ok(ec);
+}
+
+// Add a file to the process file handle list while holding `process->mtx`.
+// Returns the lowest vacant file descriptor number.
+int proc_add_fd(badge_err_t *ec, process_t *process, file_t real) {
+    mutex_acquire(NULL, &process->mtx, TIMESTAMP_US_MAX);
+    int virt = proc_add_fd_raw(ec, process, real);
+    mutex_release(NULL, &process->mtx);
+    return virt;
+}
+
+// Find a file in the process file handle list while holding `process->mtx` shared.
+file_t proc_find_fd(badge_err_t *ec, process_t *process, int virt) {
+    mutex_acquire_shared(NULL, &process->mtx, TIMESTAMP_US_MAX);
+    file_t real = proc_find_fd_raw(ec, process, virt);
+    mutex_release_shared(NULL, &process->mtx);
+    return real;
+}
+
+// Remove a file from the process file handle list while holding `process->mtx`.
+// Returns the file that was removed.
+file_t proc_remove_fd(badge_err_t *ec, process_t *process, int virt) {
+    mutex_acquire(NULL, &process->mtx, TIMESTAMP_US_MAX);
+    file_t real = proc_find_fd_raw(ec, process, virt);
+    if (real != FILE_NONE) {
+        proc_remove_fd_raw(ec, process, virt);
+    }
+    mutex_release(NULL, &process->mtx);
+    return real;
 }
 
 
@@ -440,6 +537,16 @@ bool proc_signals_pending_raw(process_t *process) {
     return atomic_load(&process->flags) & PROC_SIGPEND;
 }
 
+// Update `PROC_SIGPEND` after the pending or blocked signals changed.
+// The caller must hold `process->mtx`.
+void proc_update_sigpend_raw(process_t *process) {
+    if (process->sigpending & ~process->sigmask) {
+        atomic_fetch_or(&process->flags, PROC_SIGPEND);
+    } else {
+        atomic_fetch_and(&process->flags, ~PROC_SIGPEND);
+    }
+}
+
 // Raise SIGKILL to a process.
 static void proc_raise_sigkill_raw(process_t *process) {
     mutex_acquire(NULL, &process->mtx, TIMESTAMP_US_MAX);
@@ -459,15 +566,11 @@ void proc_raise_signal_raw(badge_err_t *ec, process_t *process, int signum) {
         return;
     }
     mutex_acquire(NULL, &process->mtx, TIMESTAMP_US_MAX);
-    sigpending_t *node = malloc(sizeof(sigpending_t));
-    if (!node) {
-        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
-    } else {
-        node->signum = signum;
-        dlist_append(&process->sigpending, &node->node);
-        atomic_fetch_or(&process->flags, PROC_SIGPEND);
-    }
+    // Like standard POSIX signals, a signal raised again while pending is only delivered once.
+    process->sigpending |= 1u << signum;
+    proc_update_sigpend_raw(process);
     mutex_release(NULL, &process->mtx);
+    badge_err_set_ok(ec);
 }
 
 
@@ -519,10 +622,17 @@ void proc_delete_runtime_raw(process_t *process) {
     }
 
     // Destroy all threads.
-    for (size_t i = 0; i < process->threads_len; i++) {
-        thread_join(process->threads[i]);
+    // The mutex is released while joining because threads blocked on it in a syscall must finish before they can die.
+    // Killing a thread also resumes it if it was suspended, because the scheduler only kills threads in its queue.
+    while (process->threads_len) {
+        tid_t tid = process->threads[process->threads_len - 1];
+        mutex_release(NULL, &process->mtx);
+        thread_kill_user(NULL, tid);
+        thread_join(tid);
+        mutex_acquire(NULL, &process->mtx, TIMESTAMP_US_MAX);
+        // The thread may already have removed itself if it was detached.
+        proc_delete_thread_raw_unsafe(NULL, process, tid);
     }
-    process->threads_len = 0;
     free(process->threads);
 
     // Adopt all children to init.
@@ -541,7 +651,22 @@ void proc_delete_runtime_raw(process_t *process) {
 #endif
     }
 
-    // TODO: Close pipes and files.
+    // Shared memory objects this process created lose their handles; other processes' mappings stay valid.
+    shm_destroy_owned(process->pid);
+
+    // Close files.
+    for (size_t i = 0; i < process->fds_cap; i++) {
+        if (process->fds[i] != FILE_NONE) {
+            fs_close(NULL, process->fds[i]);
+        }
+    }
+    process->fds_cap = 0;
+    free(process->fds);
+    free(process->fds_usage);
+    process->fds       = NULL;
+    process->fds_usage = NULL;
+
+    // TODO: Close pipes.
 
     // Mark the process as exited.
     atomic_fetch_or(&process->flags, PROC_EXITED);
@@ -684,7 +809,10 @@ bool copy_from_user(pid_t pid, void *kernel_vaddr, size_t user_vaddr, size_t len
 // If the user doesn't have access, no copy is performed.
 bool copy_to_user(pid_t pid, size_t user_vaddr, void *const kernel_vaddr, size_t len) {
     mutex_acquire_shared(NULL, &proc_mtx, TIMESTAMP_US_MAX);
-    bool res = copy_to_user_raw(proc_get_unsafe(pid), user_vaddr, kernel_vaddr, len);
+    process_t *process = proc_get_unsafe(pid);
+    mutex_acquire(NULL, &process->mtx, TIMESTAMP_US_MAX);
+    bool res = copy_to_user_raw(process, user_vaddr, kernel_vaddr, len);
+    mutex_release(NULL, &process->mtx);
     mutex_release_shared(NULL, &proc_mtx);
     return res;
 }
@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: MIT
+
+#include "process/shm.h"
+
+#include "arrays.h"
+#include "assertions.h"
+#include "badge_strings.h"
+#include "log.h"
+#include "malloc.h"
+#include "mutex.h"
+#include "page_alloc.h"
+#include "port/hardware_allocation.h"
+
+#if MEMMAP_VMEM
+#include "cpu/mmu.h"
+#endif
+
+
+
+// Shared memory handle counter.
+static int     shm_counter = 1;
+// Shared memory table mutex.
+static mutex_t shm_mtx     = MUTEX_T_INIT_SHARED;
+// Number of shared memory objects with a handle.
+static size_t  shms_len    = 0;
+// Capacity for shared memory objects.
+static size_t  shms_cap    = 0;
+// Shared memory objects with a handle, sorted by handle.
+static shm_t **shms        = NULL;
+
+
+
+// Compare the handle of `shm_t *` to an `int`.
+static int shm_id_cmp(void const *a, void const *b) {
+    shm_t *shm = *(shm_t **)a;
+    int    id  = (int)(ptrdiff_t)b;
+    return shm->id - id;
+}
+
+// Free the memory of a shared memory object.
+static void shm_free(shm_t *shm) {
+    for (size_t i = 0; i < shm->size / MEMMAP_PAGE_SIZE; i++) {
+        if (shm->ppns[i]) {
+            phys_page_free(shm->ppns[i]);
+        }
+    }
+    free(shm->ppns);
+    free(shm);
+}
+
+// Create a zero-filled shared memory object of at least `size` bytes.
+// Returns the handle of the new object, or 0 on failure.
+int shm_create(badge_err_t *ec, pid_t owner, size_t size) {
+#if !MEMMAP_VMEM
+    // Without virtual memory, the same pages cannot appear in more than one process.
+    (void)owner;
+    (void)size;
+    badge_err_set(ec, ELOC_PROCESS, ECAUSE_UNSUPPORTED);
+    return 0;
+#else
+    if (!size || size > SIZE_MAX - MEMMAP_PAGE_SIZE) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_PARAM);
+        return 0;
+    }
+    size_t pages = (size + MEMMAP_PAGE_SIZE - 1) / MEMMAP_PAGE_SIZE;
+
+    shm_t *shm = malloc(sizeof(shm_t));
+    if (!shm) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
+    }
+    shm->owner    = owner;
+    shm->size     = pages * MEMMAP_PAGE_SIZE;
+    shm->refcount = 1;
+    shm->ppns     = calloc(pages, sizeof(size_t));
+    if (!shm->ppns) {
+        free(shm);
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
+    }
+
+    // Pages are allocated one by one because large objects like framebuffers need not be contiguous.
+    for (size_t i = 0; i < pages; i++) {
+        shm->ppns[i] = phys_page_alloc(1, true);
+        if (!shm->ppns[i]) {
+            shm_free(shm);
+            badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+            return 0;
+        }
+        mem_set((void *)(shm->ppns[i] * MEMMAP_PAGE_SIZE + mmu_hhdm_vaddr), 0, MEMMAP_PAGE_SIZE);
+    }
+
+    // Give the object a handle.
+    mutex_acquire(NULL, &shm_mtx, TIMESTAMP_US_MAX);
+    shm->id      = shm_counter;
+    bool success = array_lencap_insert(&shms, sizeof(shm_t *), &shms_len, &shms_cap, &shm, shms_len);
+    if (success) {
+        shm_counter++;
+    }
+    mutex_release(NULL, &shm_mtx);
+    if (!success) {
+        shm_free(shm);
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOMEM);
+        return 0;
+    }
+
+    logkf(LOG_INFO, "Process %{d} created shared memory #%{d} of %{size;d} bytes", owner, shm->id, shm->size);
+    badge_err_set_ok(ec);
+    return shm->id;
+#endif
+}
+
+// Look up a shared memory object by handle and take a reference to it.
+shm_t *shm_get(badge_err_t *ec, int id) {
+    mutex_acquire_shared(NULL, &shm_mtx, TIMESTAMP_US_MAX);
+    array_binsearch_t res = array_binsearch(shms, sizeof(shm_t *), shms_len, (void *)(ptrdiff_t)id, shm_id_cmp);
+    shm_t            *shm = NULL;
+    if (res.found) {
+        // The handle's reference keeps the object alive while it is in the table.
+        shm = shms[res.index];
+        atomic_fetch_add(&shm->refcount, 1);
+        badge_err_set_ok(ec);
+    } else {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+    }
+    mutex_release_shared(NULL, &shm_mtx);
+    return shm;
+}
+
+// Release a reference to a shared memory object; its memory is freed when the last reference is gone.
+void shm_unref(shm_t *shm) {
+    if (atomic_fetch_sub(&shm->refcount, 1) == 1) {
+        logkf(LOG_INFO, "Shared memory #%{d} freed", shm->id);
+        shm_free(shm);
+    }
+}
+
+// Destroy the handle of a shared memory object; existing mappings stay valid.
+// Only the process that created the object may destroy it.
+void shm_destroy(badge_err_t *ec, pid_t caller, int id) {
+    mutex_acquire(NULL, &shm_mtx, TIMESTAMP_US_MAX);
+    array_binsearch_t res = array_binsearch(shms, sizeof(shm_t *), shms_len, (void *)(ptrdiff_t)id, shm_id_cmp);
+    shm_t            *shm = NULL;
+    if (!res.found) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_NOTFOUND);
+    } else if (shms[res.index]->owner != caller) {
+        badge_err_set(ec, ELOC_PROCESS, ECAUSE_PERM);
+    } else {
+        shm = shms[res.index];
+        array_lencap_remove(&shms, sizeof(shm_t *), &shms_len, &shms_cap, NULL, res.index);
+        badge_err_set_ok(ec);
+    }
+    mutex_release(NULL, &shm_mtx);
+    if (shm) {
+        shm_unref(shm);
+    }
+}
+
+// Destroy the handles of all shared memory objects created by a process.
+void shm_destroy_owned(pid_t owner) {
+    mutex_acquire(NULL, &shm_mtx, TIMESTAMP_US_MAX);
+    for (size_t i = shms_len; i-- > 0;) {
+        shm_t *shm = shms[i];
+        if (shm->owner == owner) {
+            array_lencap_remove(&shms, sizeof(shm_t *), &shms_len, &shms_cap, NULL, i);
+            shm_unref(shm);
+        }
+    }
+    mutex_release(NULL, &shm_mtx);
+}
@@ -6,7 +6,7 @@
 #include "backtrace.h"
 #include "cpu/isr.h"
 #include "interrupt.h"
-#include "malloc.h"
+#include "memprotect.h"
 #include "process/internal.h"
 #include "process/types.h"
 #include "scheduler/cpu.h"
@@ -84,12 +84,14 @@ static void run_sighandler(int signum, uint64_t cause) {
 void proc_signal_handler() {
     process_t *const proc = proc_current();
     mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
-    if (proc->sigpending.len) {
-        // Pop the first pending signal and run its handler.
-        sigpending_t *node = (sigpending_t *)dlist_pop_front(&proc->sigpending);
+    uint32_t deliverable = proc->sigpending & ~proc->sigmask;
+    if (deliverable) {
+        // Take the lowest pending signal and run its handler.
+        int signum        = __builtin_ctz(deliverable);
+        proc->sigpending &= ~(1u << signum);
+        proc_update_sigpend_raw(proc);
         mutex_release(NULL, &proc->mtx);
-        run_sighandler(node->signum, 0);
-        free(node);
+        run_sighandler(signum, 0);
     } else {
         mutex_release(NULL, &proc->mtx);
     }
@@ -158,6 +160,27 @@ void proc_sigsegv_handler(size_t vaddr) {
     trap_signal_handler(SIGSEGV, vaddr);
 }
 
+// Handles a store page fault from a user thread.
+// Copies the page if it belongs to a private file mapping and retries the store, otherwise raises a segmentation fault.
+void proc_store_fault_handler(size_t vaddr) {
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    // Another thread may have copied the page first, while this CPU still had the read-only translation cached.
+    size_t copied  = proc_map_unshare_raw(NULL, proc, vaddr, 1);
+    bool   handled = copied || proc_map_is_unshared_raw(proc, vaddr);
+    if (handled && !copied) {
+        memprotect_commit(&proc->memmap.mpu_ctx);
+    }
+    mutex_release(NULL, &proc->mtx);
+    if (!handled) {
+        trap_signal_handler(SIGSEGV, vaddr);
+    }
+    irq_disable();
+    sched_lower_from_isr();
+    isr_context_switch();
+    __builtin_unreachable();
+}
+
 // Raises an illegal instruction fault to the current thread.
 // Called in the kernel side of a used thread when hardware detects an illegal instruction fault.
 void proc_sigill_handler() {
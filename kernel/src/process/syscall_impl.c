@@ -8,6 +8,7 @@
 #include "errno.h"
 #include "interrupt.h"
 #include "process/internal.h"
+#include "process/shm.h"
 #include "process/sighandler.h"
 #include "process/types.h"
 #include "rawprint.h"
@@ -22,18 +23,208 @@
 
 
 
+// Create a new thread that runs `entry(arg)` on a new stack of at least `stack_size` bytes, or a default size if 0.
+// Returns thread ID of the new thread on success, or a (negative) errno on failure.
+tid_t syscall_thread_create(void *entry, void *arg, int priority, size_t stack_size) {
+    if (priority < SCHED_PRIO_LOW || priority > SCHED_PRIO_HIGH) {
+        return -EINVAL;
+    }
+    if (!stack_size) {
+        stack_size = PROC_THREAD_STACK_SIZE;
+    }
+
+    process_t *const proc = proc_current();
+    badge_err_t      ec   = {0};
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    tid_t tid = proc_create_thread_raw(&ec, proc, (size_t)entry, (size_t)arg, priority, stack_size);
+    if (tid) {
+        thread_resume(&ec, tid);
+    }
+    mutex_release(NULL, &proc->mtx);
+
+    return badge_err_is_ok(&ec) ? tid : -ENOMEM;
+}
+
+// Suspend a thread of this process; it will not run again until resumed.
+bool syscall_thread_suspend(tid_t thread) {
+    process_t *const proc = proc_current();
+    mutex_acquire_shared(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    bool found = proc_has_thread_raw(proc, thread);
+    mutex_release_shared(NULL, &proc->mtx);
+    if (!found) {
+        return false;
+    }
+    badge_err_t ec = {0};
+    thread_suspend(&ec, thread, false);
+    return badge_err_is_ok(&ec);
+}
+
+// Resume a thread of this process; this does nothing if it is already running.
+bool syscall_thread_resume(tid_t thread) {
+    process_t *const proc = proc_current();
+    mutex_acquire_shared(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    bool found = proc_has_thread_raw(proc, thread);
+    mutex_release_shared(NULL, &proc->mtx);
+    if (!found) {
+        return false;
+    }
+    badge_err_t ec = {0};
+    thread_resume(&ec, thread);
+    return badge_err_is_ok(&ec);
+}
+
+// Whether a thread of this process may be detached, destroyed or joined.
+// The caller must hold `proc->mtx`.
+static bool thread_is_joinable_raw(process_t *proc, tid_t thread) {
+    if (thread == sched_current_tid() || !proc_has_thread_raw(proc, thread)) {
+        return false;
+    }
+    sched_thread_t *handle = sched_get_thread(thread);
+    return handle && !(atomic_load(&handle->flags) & THREAD_DETACHED);
+}
+
+// Release the user stack the kernel allocated for a thread, if any.
+// The caller must hold `proc->mtx`.
+static void thread_release_stack_raw(process_t *proc, sched_thread_t *thread) {
+    if (thread->user_stack) {
+        proc_unmap_raw(NULL, proc, thread->user_stack);
+        thread->user_stack = 0;
+    }
+}
+
+// Detach a thread of this process; the thread will be destroyed as soon as it exits.
+bool syscall_thread_detach(tid_t thread) {
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    if (!thread_is_joinable_raw(proc, thread)) {
+        mutex_release(NULL, &proc->mtx);
+        return false;
+    }
+    // Threads that are still running remove themselves from the list when they exit.
+    if (atomic_load(&sched_get_thread(thread)->flags) & THREAD_EXITED) {
+        proc_delete_thread_raw_unsafe(NULL, proc, thread);
+    }
+    thread_detach(NULL, thread);
+    mutex_release(NULL, &proc->mtx);
+    return true;
+}
+
+// Destroy a thread of this process that has not been detached; it will be stopped and its resources released.
+bool syscall_thread_destroy(tid_t thread) {
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    if (!thread_is_joinable_raw(proc, thread)) {
+        mutex_release(NULL, &proc->mtx);
+        return false;
+    }
+    // Once out of the list, no other thread can detach or join this thread.
+    proc_delete_thread_raw_unsafe(NULL, proc, thread);
+    // Take over the stack so the thread doesn't release it if it is exiting by itself.
+    sched_thread_t *handle = sched_get_thread(thread);
+    size_t          stack  = handle->user_stack;
+    handle->user_stack     = 0;
+    mutex_release(NULL, &proc->mtx);
+
+    // Wait for the thread to stop before taking its stack away; joining also releases the thread.
+    thread_kill_user(NULL, thread);
+    thread_join(thread);
+
+    if (stack) {
+        mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+        proc_unmap_raw(NULL, proc, stack);
+        mutex_release(NULL, &proc->mtx);
+    }
+    return true;
+}
+
+// Exit the current thread; exit code can be read unless destroyed or detached.
+// If this is the last thread of the process, the process exits with this exit code.
+void syscall_thread_exit(int code) {
+    process_t *const      proc = proc_current();
+    sched_thread_t *const self = sched_current_thread();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+
+    // Check whether any other threads will keep the process alive.
+    bool last = true;
+    for (size_t i = 0; i < proc->threads_len; i++) {
+        sched_thread_t *thread = sched_get_thread(proc->threads[i]);
+        if (thread && thread != self && !(atomic_load(&thread->flags) & (THREAD_EXITING | THREAD_EXITED))) {
+            last = false;
+            break;
+        }
+    }
+    if (last) {
+        mutex_release(NULL, &proc->mtx);
+        proc_exit_self(W_EXITED(code & 255));
+    }
+
+    // This thread no longer runs user code, so it can release its own stack.
+    thread_release_stack_raw(proc, self);
+    if (atomic_load(&self->flags) & THREAD_DETACHED) {
+        proc_delete_thread_raw_unsafe(NULL, proc, self->id);
+    }
+
+    // Mark this thread as exiting before other threads can check whether they are the last.
+    // Interrupts stay disabled so the scheduler can't reap this thread before it has released the mutex.
+    irq_disable();
+    self->exit_code = code;
+    atomic_fetch_or(&self->flags, THREAD_EXITING);
+    mutex_release_from_isr(NULL, &proc->mtx);
+    thread_exit(code);
+}
+
+// Wait for a thread of this process that has not been detached to exit, then release it.
+// If `code` is not NULL, the thread's exit code is stored there.
+bool syscall_thread_join(tid_t thread, int *code) {
+    if (code) {
+        sysutil_memassert_rw(code, sizeof(int));
+    }
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    if (!thread_is_joinable_raw(proc, thread)) {
+        mutex_release(NULL, &proc->mtx);
+        return false;
+    }
+    // Once out of the list, no other thread can detach or join this thread.
+    proc_delete_thread_raw_unsafe(NULL, proc, thread);
+    mutex_release(NULL, &proc->mtx);
+
+    // Exited threads have already released their stack.
+    int res = thread_join(thread);
+    if (code) {
+        mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+        bool copy_ok = copy_to_user_raw(proc, (size_t)code, &res, sizeof(int));
+        mutex_release(NULL, &proc->mtx);
+        sigsegv_assert(copy_ok, (size_t)code);
+    }
+    return true;
+}
+
+
+
 // Map a new range of memory at an arbitrary virtual address.
 // This may round up to a multiple of the page size.
 // Alignment may be less than `align` if the kernel doesn't support it.
 void *syscall_mem_alloc(size_t vaddr_req, size_t min_size, size_t min_align, int flags) {
-    return (void *)proc_map_raw(NULL, proc_current(), vaddr_req, min_size, min_align, flags);
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    size_t res = proc_map_raw(NULL, proc, vaddr_req, min_size, min_align, flags);
+    mutex_release(NULL, &proc->mtx);
+    return (void *)res;
 }
 
 // Get the size of a range of memory previously allocated with `SYSCALL_MEM_ALLOC`.
 // Returns 0 if there is no range starting at the given address.
 size_t syscall_mem_size(void *address) {
     process_t *const proc = proc_current();
-    mutex_acquire_shared(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    bool const       fast = syscall_is_fast();
+    if (!fast) {
+        mutex_acquire_shared(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    } else if (!mutex_acquire_shared_from_isr(NULL, &proc->mtx, 0)) {
+        // Don't wait for the mutex in the trap handler.
+        syscall_fast_defer();
+        return 0;
+    }
     size_t res = 0;
     for (size_t i = 0; i < proc->memmap.regions_len; i++) {
 #if MEMMAP_VMEM
@@ -48,18 +239,68 @@ size_t syscall_mem_size(void *address) {
         }
 #endif
     }
-    mutex_release_shared(NULL, &proc->mtx);
+    if (fast) {
+        mutex_release_shared_from_isr(NULL, &proc->mtx);
+    } else {
+        mutex_release_shared(NULL, &proc->mtx);
+    }
     return res;
 }
 
 // Unmap a range of memory previously allocated with `SYSCALL_MEM_ALLOC`.
 // Returns whether a range of memory was unmapped.
 bool syscall_mem_dealloc(void *address) {
-    badge_err_t *ec = {0};
-    proc_unmap_raw(ec, proc_current(), (size_t)address);
-    return badge_err_is_ok(ec);
+    process_t *const proc = proc_current();
+    badge_err_t      ec   = {0};
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    proc_unmap_raw(&ec, proc, (size_t)address);
+    mutex_release(NULL, &proc->mtx);
+    return badge_err_is_ok(&ec);
+}
+
+
+// Map part of a file opened for reading at an arbitrary virtual address; `offset` must be page-aligned.
+// Without `MEMFLAGS_PRIVATE`, the file's pages are shared and the mapping cannot be writable.
+// With `MEMFLAGS_PRIVATE`, pages are shared until the process first writes them; writes do not reach the file.
+// The mapping stays valid after the file is closed and is unmapped with `SYSCALL_MEM_DEALLOC`.
+// Returns NULL on error.
+void *syscall_mem_map_file(size_t vaddr_req, size_t size, int flags, int virt, long offset) {
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    size_t res = 0;
+    file_t fd  = proc_find_fd_raw(NULL, proc, virt);
+    if (fd != FILE_NONE) {
+        uint32_t map_flags = flags & (MEMPROTECT_FLAG_RWX | PROC_MAP_PRIVATE);
+        res                = proc_map_file_raw(NULL, proc, vaddr_req, size, fd, offset, map_flags);
+    }
+    mutex_release(NULL, &proc->mtx);
+    return (void *)res;
+}
+
+// Create a zero-filled shared memory object of at least `size` bytes that any process can map by its handle.
+// Returns the handle of the new object, or -1 on error.
+int syscall_mem_shm_create(size_t size) {
+    int id = shm_create(NULL, proc_current()->pid, size);
+    return id ? id : -1;
+}
+
+// Map a shared memory object at an arbitrary virtual address; only `MEMFLAGS_RWX` flags apply.
+// Returns NULL on error.
+void *syscall_mem_shm_map(size_t vaddr_req, int shm, int flags) {
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    size_t res = proc_map_shm_raw(NULL, proc, vaddr_req, shm, flags & MEMPROTECT_FLAG_RWX);
+    mutex_release(NULL, &proc->mtx);
+    return (void *)res;
 }
 
+// Destroy the handle of a shared memory object created by this process; existing mappings stay valid.
+// Returns whether the handle was destroyed.
+bool syscall_mem_shm_destroy(int shm) {
+    badge_err_t ec = {0};
+    shm_destroy(&ec, proc_current()->pid, shm);
+    return badge_err_is_ok(&ec);
+}
 
 
 // Sycall: Exit the process; exit code can be read by parent process.
@@ -74,7 +315,7 @@ void syscall_proc_exit(int code) {
 // If the memory was not large enough, it it not modified.
 size_t syscall_proc_getargs(size_t cap, void *memory) {
     process_t *const proc = proc_current();
-    mutex_acquire_shared(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
 
     // Check required size.
     size_t required = proc->argv_size;
@@ -154,6 +395,27 @@ void syscall_proc_sigret() {
     __builtin_unreachable();
 }
 
+// Change the set of blocked signals of this process according to `how`: `SIG_BLOCK`, `SIG_UNBLOCK` or `SIG_SETMASK`.
+// Returns the previous set of blocked signals as a bitmask indexed by signal number.
+uint32_t syscall_proc_sigmask(int how, uint32_t set) {
+    sigsys_assert(how == SIG_BLOCK || how == SIG_UNBLOCK || how == SIG_SETMASK);
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    uint32_t old = proc->sigmask;
+    if (how == SIG_BLOCK) {
+        proc->sigmask |= set;
+    } else if (how == SIG_UNBLOCK) {
+        proc->sigmask &= ~set;
+    } else {
+        proc->sigmask = set;
+    }
+    proc->sigmask &= ~((1u << SIGKILL) | (1u << SIGSTOP));
+    // Unblocked signals that were pending are delivered when this system call returns.
+    proc_update_sigpend_raw(proc);
+    mutex_release(NULL, &proc->mtx);
+    return old;
+}
+
 // Get child process status update.
 NOASAN int syscall_proc_waitpid(int pid, int *wstatus, int options) {
     process_t *proc = proc_current();
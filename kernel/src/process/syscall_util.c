@@ -6,6 +6,7 @@
 #include "process/internal.h"
 #include "process/sighandler.h"
 #include "process/types.h"
+#include "usercopy.h"
 
 
 // Assert that a condition is true, or raise SIGSEGV and don't return.
@@ -22,9 +23,28 @@ void sigsegv_assert(bool condition, size_t vaddr) {
     }
 }
 
+// Copy an error code to the user, or raise SIGSEGV and don't return if the process can't write it.
+// Fast system calls are deferred instead of raising SIGSEGV.
+void sysutil_ec_to_user(badge_err_t *ec, badge_err_t *ec_buf) {
+    if (!syscall_is_fast()) {
+        sigsegv_assert(copy_to_user(proc_current_pid(), (size_t)ec, ec_buf, sizeof(badge_err_t)), (size_t)ec);
+    } else if (!copy_to_user_from_isr(proc_current(), (size_t)ec, ec_buf, sizeof(badge_err_t))) {
+        // The normal system call will resolve copy-on-write or raise SIGSEGV.
+        syscall_fast_defer();
+    }
+}
+
 // Checks whether the process has permission for a range of memory.
 bool sysutil_memperm(void const *ptr, size_t len, uint32_t flags) {
-    return (proc_map_contains_raw(proc_current(), (size_t)ptr, len) & flags) == flags;
+    process_t *const proc = proc_current();
+    mutex_acquire(NULL, &proc->mtx, TIMESTAMP_US_MAX);
+    if (flags & MEMPROTECT_FLAG_W) {
+        // The kernel writes to user memory through its own mapping, which does not fault on copy-on-write pages.
+        proc_map_unshare_raw(NULL, proc, (size_t)ptr, len);
+    }
+    bool res = (proc_map_contains_raw(proc, (size_t)ptr, len) & flags) == flags;
+    mutex_release(NULL, &proc->mtx);
+    return res;
 }
 
 // If the process does not have access, raise SIGSEGV and don't return.
@@ -17,6 +17,7 @@
 #include "scheduler/isr.h"
 #include "scheduler/types.h"
 #include "smp.h"
+#include "syscall.h"
 
 
 
@@ -296,7 +297,7 @@ void sched_request_switch_from_isr() {
 
         // Check for thread exit conditions.
         bool kill_thread = flags & THREAD_EXITING;
-        if (thread->process && (atomic_load(&thread->process->flags) & PROC_EXITING)) {
+        if ((flags & THREAD_KILLUSER) || (thread->process && (atomic_load(&thread->process->flags) & PROC_EXITING))) {
             kill_thread |= !(flags & THREAD_PRIVILEGED);
         }
 
@@ -665,7 +666,12 @@ void thread_sleep(timestamp_us_t delay) {
 
 // Implementation of thread yield system call.
 void syscall_thread_yield() {
-    thread_yield();
+    if (syscall_is_fast()) {
+        // Already in the trap handler; the switch happens when it returns.
+        sched_request_switch_from_isr();
+    } else {
+        thread_yield();
+    }
 }
 
 // Implementation of usleep system call.
@@ -801,6 +807,27 @@ bool thread_is_running(badge_err_t *ec, tid_t tid) {
     return res;
 }
 
+// Makes a user thread exit the next time it is scheduled in user mode, resuming it if it was suspended.
+void thread_kill_user(badge_err_t *ec, tid_t tid) {
+    assert_always(mutex_acquire_shared(NULL, &threads_mtx, TIMESTAMP_US_MAX));
+    sched_thread_t *thread = find_thread(tid);
+    if (!thread) {
+        badge_err_set(ec, ELOC_THREADS, ECAUSE_NOTFOUND);
+    } else if (atomic_load(&thread->flags) & THREAD_KERNEL) {
+        badge_err_set(ec, ELOC_THREADS, ECAUSE_ILLEGAL);
+    } else {
+        atomic_fetch_or(&thread->flags, THREAD_KILLUSER);
+        // The scheduler only kills threads it finds in its queue.
+        if (thread_try_mark_running(thread, false)) {
+            irq_disable();
+            thread_handoff(thread, smp_cur_cpu(), true, 0);
+            irq_enable();
+        }
+        badge_err_set_ok(ec);
+    }
+    assert_always(mutex_release_shared(NULL, &threads_mtx));
+}
+
 
 // Exits the current thread.
 // If the thread is detached, resources will be cleaned up.
@@ -815,19 +842,22 @@ void thread_exit(int code) {
 }
 
 // Wait for another thread to exit.
-void thread_join(tid_t tid) {
+// Returns its exit code, or 0 if it no longer exists.
+int thread_join(tid_t tid) {
     while (1) {
         assert_always(mutex_acquire_shared(NULL, &threads_mtx, TIMESTAMP_US_MAX));
         sched_thread_t *thread = find_thread(tid);
         if (thread) {
             if (atomic_load(&thread->flags) & THREAD_EXITED) {
+                // Housekeeping can't free the thread until the mutex is released.
+                int code = thread->exit_code;
                 atomic_fetch_or(&thread->flags, THREAD_DETACHED);
                 assert_always(mutex_release_shared(NULL, &threads_mtx));
-                return;
+                return code;
             }
         } else {
             assert_always(mutex_release_shared(NULL, &threads_mtx));
-            return;
+            return 0;
         }
         assert_always(mutex_release_shared(NULL, &threads_mtx));
         thread_yield();
@@ -3,6 +3,8 @@
 
 #include "syscall.h"
 
+#include "scheduler/types.h"
+
 
 
 // Table of system calls.
@@ -43,3 +45,16 @@ syscall_info_t syscall_info(int no) {
         return systab[no];
     }
 }
+
+// Whether the current system call is running as a fast system call, directly in the trap handler.
+bool syscall_is_fast() {
+    // User threads only run kernel code without `THREAD_PRIVILEGED` from inside the trap handler.
+    sched_thread_t *thread = sched_current_thread();
+    return thread && !(atomic_load(&thread->flags) & (THREAD_KERNEL | THREAD_PRIVILEGED));
+}
+
+// Abandon the current fast system call; it will be run again from the start as a normal system call.
+// The return value of the fast system call is ignored.
+void syscall_fast_defer() {
+    atomic_fetch_or(&sched_current_thread()->flags, THREAD_FASTDEFER);
+}